@@ -15,3 +15,11 @@ check_c_source_compiles("
 
 int main() {return 0;}
 " ARCH_X86_64)
+
+check_c_source_compiles("
+#ifndef __aarch64__
+#error not aarch64
+#endif
+
+int main() {return 0;}
+" ARCH_AARCH64)
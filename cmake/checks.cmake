@@ -7,8 +7,14 @@ set(CMAKE_REQUIRED_DEFINITIONS "-D_GNU_SOURCE")
 
 if(ARCH_X86 OR ARCH_X86_64)
   check_c_compiler_flag("-mpclmul" HAVE_PCLMUL)
+  check_c_compiler_flag("-msse4.1 -msha" HAVE_SHA)
 endif(ARCH_X86 OR ARCH_X86_64)
 
+if(ARCH_AARCH64 AND LINUX)
+  check_c_compiler_flag("-march=armv8-a+crypto" HAVE_ARMV8_CRYPTO)
+  check_symbol_exists("getauxval" "sys/auxv.h" HAVE_GETAUXVAL)
+endif(ARCH_AARCH64 AND LINUX)
+
 
 
 if(ENABLE_LTO)
@@ -37,6 +43,49 @@ int main() {
 
 check_prototype_definition("get_current_dir_name" "char *get_current_dir_name(void)" "NULL" "unistd.h" HAVE_GET_CURRENT_DIR_NAME)
 
+check_symbol_exists("getrandom" "sys/random.h" HAVE_GETRANDOM)
+
+
+set(CMAKE_REQUIRED_FLAGS "-Werror=implicit-function-declaration")
+set(CMAKE_REQUIRED_INCLUDES ${UECC_INCLUDE_DIRS})
+set(CMAKE_REQUIRED_LIBRARIES ${UECC_LDFLAGS})
+check_c_source_compiles("
+#include <libuecc/ecc.h>
+
+int main() {
+	ecc_int256_t x, y;
+	ecc_25519_work_t work = ecc_25519_work_identity;
+
+	ecc_25519_negate(&work, &work);
+	ecc_25519_sub(&work, &work, &work);
+	ecc_25519_store_xy(&x, &y, &work);
+	return ecc_25519_load_xy(&work, &x, &y);
+}
+" HAVE_UECC_POINT_ARITHMETIC)
+unset(CMAKE_REQUIRED_FLAGS)
+unset(CMAKE_REQUIRED_INCLUDES)
+unset(CMAKE_REQUIRED_LIBRARIES)
+
+if(NOT HAVE_UECC_POINT_ARITHMETIC)
+  message(FATAL_ERROR "libuecc doesn't provide the point arithmetic needed by fastd (ecc_25519_negate(), ecc_25519_sub(), ecc_25519_load_xy() and ecc_25519_store_xy()); please update libuecc")
+endif(NOT HAVE_UECC_POINT_ARITHMETIC)
+
+
+if(WITH_USDT)
+  check_c_source_compiles("
+  #include <sys/sdt.h>
+
+  int main() {
+    DTRACE_PROBE(fastd, test);
+    return 0;
+  }
+  " HAVE_SYS_SDT_H)
+
+  if(NOT HAVE_SYS_SDT_H)
+    message(FATAL_ERROR "WITH_USDT is enabled, but <sys/sdt.h> was not found (it is usually provided by the SystemTap SDT development package)")
+  endif(NOT HAVE_SYS_SDT_H)
+endif(WITH_USDT)
+
 
 if(NOT DARWIN)
   set(RT_LIBRARY "")
@@ -54,6 +103,30 @@ if(NOT DARWIN)
 endif(NOT DARWIN)
 
 
+set(ATOMIC_LIBRARY "")
+set(ATOMIC64_TEST_SOURCE "
+#include <stdint.h>
+
+int64_t value;
+
+int main() {
+	__atomic_store_n(&value, __atomic_load_n(&value, __ATOMIC_RELAXED) + 1, __ATOMIC_RELAXED);
+	return 0;
+}
+")
+check_c_source_compiles("${ATOMIC64_TEST_SOURCE}" HAVE_ATOMIC64)
+
+if(NOT HAVE_ATOMIC64)
+  set(ATOMIC_LIBRARY "atomic")
+  list(APPEND CMAKE_REQUIRED_LIBRARIES "atomic")
+
+  check_c_source_compiles("${ATOMIC64_TEST_SOURCE}" HAVE_ATOMIC64_LIBATOMIC)
+  if(NOT HAVE_ATOMIC64_LIBATOMIC)
+    message(FATAL_ERROR "64-bit atomic operations are neither supported by the compiler nor provided by libatomic")
+  endif(NOT HAVE_ATOMIC64_LIBATOMIC)
+endif(NOT HAVE_ATOMIC64)
+
+
 set(CMAKE_EXTRA_INCLUDE_FILES "netinet/if_ether.h")
 check_type_size("struct ethhdr" SIZEOF_ETHHDR)
 string(COMPARE NOTEQUAL "${SIZEOF_ETHHDR}" "" HAVE_ETHHDR)
@@ -60,6 +60,8 @@ set(WITH_CMDLINE_COMMANDS TRUE CACHE BOOL "Include support for setting handler s
 
 set(WITH_DYNAMIC_PEERS TRUE CACHE BOOL "Include support for dynamic peers (using on-verify handlers)")
 set(WITH_STATUS_SOCKET TRUE CACHE BOOL "Include support for the status socket")
+set(WITH_LATENCY_HISTOGRAMS FALSE CACHE BOOL "Include instrumentation collecting data path latency histograms")
+set(WITH_USDT FALSE CACHE BOOL "Include USDT tracepoints (requires <sys/sdt.h>)")
 
 set(MAX_CONFIG_DEPTH 10 CACHE STRING "Maximum config include depth")
 
@@ -12,7 +12,7 @@ else(ANDROID)
   find_package(PkgConfig REQUIRED)
 endif(ANDROID)
 
-pkg_check_modules(UECC REQUIRED libuecc>=3)
+pkg_check_modules(UECC REQUIRED libuecc>=4)
 
 
 set(NACL_INCLUDE_DIRS "")
@@ -64,13 +64,3 @@ else(WITH_CAPABILITIES)
   set(CAP_INCLUDE_DIR "")
   set(CAP_LIBRARY "")
 endif(WITH_CAPABILITIES)
-
-if(WITH_STATUS_SOCKET)
-  pkg_check_modules(JSONC REQUIRED json-c)
-else(WITH_STATUS_SOCKET)
-  set(JSONC_INCLUDE_DIRS "")
-  set(JSONC_CFLAGS_OTHER "")
-  set(JSONC_LIBRARY_DIRS "")
-  set(JSONC_LIBRARIES "")
-  set(JSONC_LDFLAGS_OTHER "")
-endif(WITH_STATUS_SOCKET)
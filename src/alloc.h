@@ -84,6 +84,17 @@ static inline void * fastd_alloc0(size_t size) {
 	return fastd_alloc0_array(1, size);
 }
 
+/**
+   Allocates a block of memory set to zero on the heap, aligned to \e align bytes
+
+   Terminates the process on failure.
+*/
+static inline void * fastd_alloc0_aligned(size_t size, size_t align) {
+	void *ret = fastd_alloc_aligned(size, align);
+	memset(ret, 0, size);
+	return ret;
+}
+
 /**
    Reallocates a block of memory on the heap
 
@@ -107,6 +118,9 @@ static inline void * fastd_realloc(void *ptr, size_t size) {
 /** Allocates a block of memory set to zero in the size of a given type */
 #define fastd_new0(type) ((type *)fastd_alloc0(sizeof(type)))
 
+/** Allocates a block of memory set to zero in the size of a given type with the given alignment */
+#define fastd_new0_aligned(type, align) ((type *)fastd_alloc0_aligned(sizeof(type), align))
+
 /** Allocates a block of undefined memory for an array of elements of a given type */
 #define fastd_new_array(members, type) ((type *)fastd_alloc(members * sizeof(type)))
 
@@ -31,6 +31,7 @@
 
 
 #include "async.h"
+#include "capture.h"
 #include "fastd.h"
 
 #include <sys/uio.h>
@@ -129,13 +130,27 @@ void fastd_async_handle(void) {
 		break;
 #endif
 
+	case ASYNC_TYPE_WORKER_RETURN:
+		fastd_worker_handle_finished();
+		break;
+
+#ifdef WITH_STATUS_SOCKET
+	case ASYNC_TYPE_CAPTURE:
+		fastd_capture_handle(*(fastd_capture_t *const *)buf);
+		break;
+
+	case ASYNC_TYPE_SUBSCRIPTION:
+		fastd_status_handle_subscription(*(fastd_subscriber_t *const *)buf);
+		break;
+#endif
+
 	default:
 		exit_bug("fastd_async_handle: unknown type");
 	}
 }
 
-/** Enqueues a new async notification */
-void fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len) {
+/** Enqueues a new async notification, returns false if the notification couldn't be sent */
+bool fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len) {
 	fastd_async_hdr_t header;
 	/* use memset to zero the holes in the struct to make valgrind happy */
 	memset(&header, 0, sizeof(header));
@@ -151,6 +166,10 @@ void fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len)
 		.msg_iovlen = len ? 2 : 1,
 	};
 
-	if (sendmsg(ctx.async_wfd, &msg, 0) < 0)
+	if (sendmsg(ctx.async_wfd, &msg, 0) < 0) {
 		pr_warn_errno("fastd_async_enqueue: sendmsg");
+		return false;
+	}
+
+	return true;
 }
@@ -41,6 +41,9 @@ typedef enum fastd_async_type {
 	ASYNC_TYPE_NOP,				/**< Does nothing (is used to ensure poll returns quickly after a signal has occurred) */
 	ASYNC_TYPE_RESOLVE_RETURN,		/**< A DNS resolver response */
 	ASYNC_TYPE_VERIFY_RETURN,		/**< A on-verify return */
+	ASYNC_TYPE_WORKER_RETURN,		/**< Jobs have been finished by the worker threads */
+	ASYNC_TYPE_CAPTURE,			/**< A packet capture has been requested or closed by its client */
+	ASYNC_TYPE_SUBSCRIPTION,		/**< An event subscription has been requested or closed by its client */
 } fastd_async_type_t;
 
 
@@ -68,7 +71,6 @@ typedef struct fastd_async_verify_return {
 	uint8_t protocol_data[] __attribute__((aligned(8))); /**< Protocol-specific data */
 } fastd_async_verify_return_t;
 
-
 void fastd_async_init(void);
 void fastd_async_handle(void);
-void fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len);
+bool fastd_async_enqueue(fastd_async_type_t type, const void *data, size_t len);
@@ -0,0 +1,726 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/**
+   \file
+
+   Packet capture
+*/
+
+
+#include "capture.h"
+
+
+#ifdef WITH_STATUS_SOCKET
+
+#include "async.h"
+#include "peer.h"
+
+#include <fastd_version.h>
+#include <inttypes.h>
+#include <netinet/ip.h>
+#include <netinet/ip6.h>
+#include <netinet/udp.h>
+
+
+/** The default snapshot length */
+#define CAPTURE_SNAPLEN_DEFAULT 65535
+
+/** The default size of the ring buffer in KiB */
+#define CAPTURE_BUFFER_DEFAULT 1024
+
+/** The maximum size of the ring buffer in KiB */
+#define CAPTURE_BUFFER_MAX 65536
+
+/** The interval the ring buffer is drained in (in milliseconds) */
+#define CAPTURE_POLL_INTERVAL 50
+
+/** The space reserved for the synthesized headers and the options of an enhanced packet block */
+#define CAPTURE_BLOCK_OVERHEAD 256
+
+
+/** The pcapng block types used */
+#define PCAPNG_BLOCK_SHB 0x0a0d0d0a
+#define PCAPNG_BLOCK_IDB 0x00000001
+#define PCAPNG_BLOCK_EPB 0x00000006
+
+/** The pcapng option codes used */
+#define PCAPNG_OPT_ENDOFOPT 0
+#define PCAPNG_OPT_COMMENT 1
+#define PCAPNG_OPT_SHB_USERAPPL 4
+#define PCAPNG_OPT_IF_NAME 2
+#define PCAPNG_OPT_IF_TSRESOL 9
+#define PCAPNG_OPT_EPB_FLAGS 2
+#define PCAPNG_OPT_EPB_DROPCOUNT 4
+
+/** The pcapng link types used */
+#define LINKTYPE_ETHERNET 1
+#define LINKTYPE_RAW 101
+
+
+/** The state of a capture */
+typedef enum capture_state {
+	CAPTURE_REQUESTED,		/**< The capture has been passed to the main thread */
+	CAPTURE_ACTIVE,			/**< Packets are recorded */
+	CAPTURE_REFUSED,		/**< The main thread has refused to start the capture */
+	CAPTURE_CLOSING,		/**< The client has closed the connection */
+	CAPTURE_CLOSED,			/**< The main thread has stopped recording packets */
+} capture_state_t;
+
+/** The header of a packet in the ring buffer (followed by the captured data) */
+typedef struct capture_record {
+	uint64_t timestamp;		/**< The time the packet has been captured (in nanoseconds since the epoch) */
+	uint64_t peer_id;		/**< The ID of the peer the packet has been exchanged with */
+	uint32_t len;			/**< The original length of the packet */
+	uint32_t caplen;		/**< The number of bytes captured */
+	uint8_t layer;			/**< The layer the packet has been captured at */
+	bool outbound;			/**< Specifies if the packet has been sent */
+	bool has_peer;			/**< Specifies if \e peer_id is valid */
+
+	fastd_peer_address_t local_addr; /**< The local address of an outer packet */
+	fastd_peer_address_t remote_addr; /**< The remote address of an outer packet */
+} capture_record_t;
+
+/**
+   A packet capture
+
+   The configuration of the capture is set by the connection thread before the capture is
+   passed to the main thread and doesn't change afterwards. The ring buffer has a single
+   producer (the main thread) and a single consumer (the connection thread).
+*/
+struct fastd_capture {
+	pthread_mutex_t mutex;		/**< Protects \e state and \e error */
+	pthread_cond_t cond;		/**< Signals changes of \e state */
+	capture_state_t state;		/**< The state of the capture */
+	const char *error;		/**< The reason the capture has been refused */
+
+	bool layers[CAPTURE_LAYER_MAX];	/**< The layers packets are captured at */
+	char *peer;			/**< The name or key of the peer to capture packets of (or NULL) */
+	bool filter;			/**< Specifies if only packets of the peer \e peer_id are captured */
+	uint64_t peer_id;		/**< The ID of the peer given by \e peer */
+	size_t snaplen;			/**< The maximum number of bytes captured per packet */
+
+	uint8_t *ring;			/**< The ring buffer */
+	size_t ring_size;		/**< The size of the ring buffer (a power of two) */
+	size_t head;			/**< The read position in the ring buffer (only advanced by the consumer) */
+	size_t tail;			/**< The write position in the ring buffer (only advanced by the producer) */
+	unsigned long dropped[CAPTURE_LAYER_MAX]; /**< The number of packets dropped because the ring buffer was full (word-sized, so it can be updated lock-free on all targets) */
+
+	int fd;				/**< The client connection */
+	uint8_t *data;			/**< The buffer packets are taken from the ring buffer to */
+	uint8_t *out;			/**< The output buffer */
+	size_t out_size;		/**< The size of the output buffer */
+	size_t out_len;			/**< The number of bytes in the output buffer */
+	size_t block_start;		/**< The position of the pcapng block currently built in the output buffer */
+};
+
+
+/** Copies data into the ring buffer at a given position, wrapping around at its end */
+static void ring_write(fastd_capture_t *capture, size_t pos, const void *data, size_t len) {
+	size_t offset = pos & (capture->ring_size-1);
+	size_t first = min_size_t(len, capture->ring_size - offset);
+
+	memcpy(capture->ring + offset, data, first);
+	memcpy(capture->ring, (const uint8_t *)data + first, len - first);
+}
+
+/** Copies data from the ring buffer at a given position, wrapping around at its end */
+static void ring_read(const fastd_capture_t *capture, size_t pos, void *data, size_t len) {
+	size_t offset = pos & (capture->ring_size-1);
+	size_t first = min_size_t(len, capture->ring_size - offset);
+
+	memcpy(data, capture->ring + offset, first);
+	memcpy((uint8_t *)data + first, capture->ring, len - first);
+}
+
+/** Checks if a packet matches the filters of the active capture */
+static inline bool capture_match(const fastd_capture_t *capture, fastd_capture_layer_t layer, const fastd_peer_t *peer) {
+	if (!capture->layers[layer])
+		return false;
+
+	return !capture->filter || (peer && peer->id == capture->peer_id);
+}
+
+/**
+   Adds a packet to the ring buffer of the active capture
+
+   The packet consists of \a head_len bytes at \a head followed by the data of \a buffer.
+*/
+static void capture_packet(fastd_capture_t *capture, capture_record_t *record, const uint8_t *head, size_t head_len, fastd_buffer_t buffer) {
+	size_t len = head_len + buffer.len;
+	size_t caplen = min_size_t(len, capture->snaplen);
+	size_t total = sizeof(*record) + caplen;
+
+	size_t tail = capture->tail;
+	if (capture->ring_size - (tail - __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE)) < total) {
+		__atomic_add_fetch(&capture->dropped[record->layer], 1, __ATOMIC_RELAXED);
+		return;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	record->timestamp = 1000000000*(uint64_t)ts.tv_sec + ts.tv_nsec;
+	record->len = len;
+	record->caplen = caplen;
+
+	ring_write(capture, tail, record, sizeof(*record));
+	tail += sizeof(*record);
+
+	size_t head_caplen = min_size_t(head_len, caplen);
+	ring_write(capture, tail, head, head_caplen);
+	ring_write(capture, tail + head_caplen, buffer.data, caplen - head_caplen);
+
+	__atomic_store_n(&capture->tail, tail + caplen, __ATOMIC_RELEASE);
+}
+
+/** Records a plaintext frame sent to or received from a peer if it matches the active capture */
+void fastd_capture_record_inner(const fastd_peer_t *peer, bool outbound, fastd_buffer_t buffer) {
+	fastd_capture_t *capture = ctx.capture;
+
+	if (!capture_match(capture, CAPTURE_INNER, peer))
+		return;
+
+	capture_record_t record = {
+		.layer = CAPTURE_INNER,
+		.outbound = outbound,
+		.has_peer = (peer != NULL),
+		.peer_id = peer ? peer->id : 0,
+	};
+
+	capture_packet(capture, &record, NULL, 0, buffer);
+}
+
+/** Records a datagram sent or received on a socket if it matches the active capture */
+void fastd_capture_record_outer(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr,
+				const fastd_peer_t *peer, bool outbound, const uint8_t *head, size_t head_len, fastd_buffer_t buffer) {
+	fastd_capture_t *capture = ctx.capture;
+
+	if (!capture_match(capture, CAPTURE_OUTER, peer))
+		return;
+
+	capture_record_t record = {
+		.layer = CAPTURE_OUTER,
+		.outbound = outbound,
+		.has_peer = (peer != NULL),
+		.peer_id = peer ? peer->id : 0,
+		.remote_addr = *remote_addr,
+	};
+
+	/* The local address is only known with packet info; the port is always taken from the socket */
+	if (local_addr && local_addr->sa.sa_family)
+		record.local_addr = *local_addr;
+	else if (sock->bound_addr)
+		record.local_addr = *sock->bound_addr;
+
+	uint16_t port = sock->bound_addr ? fastd_peer_address_get_port(sock->bound_addr) : 0;
+
+	switch (record.local_addr.sa.sa_family) {
+	case AF_INET:
+		record.local_addr.in.sin_port = port;
+		break;
+
+	case AF_INET6:
+		record.local_addr.in6.sin6_port = port;
+	}
+
+	capture_packet(capture, &record, head, head_len, buffer);
+}
+
+
+/** Finds the peer a capture is filtered by */
+static bool resolve_peer_filter(fastd_capture_t *capture) {
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
+		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
+		char key[65];
+
+		if ((peer->name && strcmp(peer->name, capture->peer) == 0)
+		    || (conf.protocol->describe_peer(peer, key, sizeof(key)) && strcmp(key, capture->peer) == 0)) {
+			capture->filter = true;
+			capture->peer_id = peer->id;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/**
+   Starts a requested capture or stops a closed one (called in the main thread)
+
+   Each state change is passed to the main thread exactly once, so the capture can't have been
+   freed yet. States that don't need to be handled are ignored.
+*/
+void fastd_capture_handle(fastd_capture_t *capture) {
+	pthread_mutex_lock(&capture->mutex);
+
+	switch (capture->state) {
+	case CAPTURE_REQUESTED:
+		if (ctx.capture) {
+			capture->state = CAPTURE_REFUSED;
+			capture->error = "another capture is active";
+		}
+		else if (capture->peer && !resolve_peer_filter(capture)) {
+			capture->state = CAPTURE_REFUSED;
+			capture->error = "unknown peer";
+		}
+		else {
+			capture->state = CAPTURE_ACTIVE;
+			ctx.capture = capture;
+
+			pr_info("started packet capture%s%s%s", capture->peer ? " of peer `" : "", capture->peer ?: "", capture->peer ? "'" : "");
+		}
+		break;
+
+	case CAPTURE_CLOSING:
+		if (ctx.capture == capture) {
+			ctx.capture = NULL;
+
+			pr_info("stopped packet capture (%U packets dropped)",
+				(uint64_t)__atomic_load_n(&capture->dropped[CAPTURE_INNER], __ATOMIC_RELAXED)
+				+ __atomic_load_n(&capture->dropped[CAPTURE_OUTER], __ATOMIC_RELAXED));
+		}
+
+		capture->state = CAPTURE_CLOSED;
+		break;
+
+	default:
+		break;
+	}
+
+	pthread_cond_broadcast(&capture->cond);
+	pthread_mutex_unlock(&capture->mutex);
+}
+
+
+/** Writes the output buffer to the client, returns false on errors */
+static bool flush_output(fastd_capture_t *capture) {
+	size_t pos = 0;
+
+	while (pos < capture->out_len) {
+		ssize_t ret = write(capture->fd, capture->out + pos, capture->out_len - pos);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			pr_debug_errno("packet capture: write");
+			return false;
+		}
+
+		pos += ret;
+	}
+
+	capture->out_len = 0;
+	return true;
+}
+
+/** Appends data to the output buffer */
+static inline void put(fastd_capture_t *capture, const void *data, size_t len) {
+	memcpy(capture->out + capture->out_len, data, len);
+	capture->out_len += len;
+}
+
+/** Appends a 16 bit value to the output buffer */
+static inline void put16(fastd_capture_t *capture, uint16_t value) {
+	put(capture, &value, sizeof(value));
+}
+
+/** Appends a 32 bit value to the output buffer */
+static inline void put32(fastd_capture_t *capture, uint32_t value) {
+	put(capture, &value, sizeof(value));
+}
+
+/** Pads the output buffer to a multiple of 32 bits */
+static inline void put_padding(fastd_capture_t *capture) {
+	static const uint8_t zero[3] = {};
+	put(capture, zero, (-capture->out_len) & 3);
+}
+
+/** Starts a pcapng block in the output buffer */
+static void block_begin(fastd_capture_t *capture, uint32_t type) {
+	capture->block_start = capture->out_len;
+
+	put32(capture, type);
+	put32(capture, 0);
+}
+
+/** Appends an option to the current pcapng block */
+static void block_option(fastd_capture_t *capture, uint16_t code, const void *data, size_t len) {
+	put16(capture, code);
+	put16(capture, len);
+	put(capture, data, len);
+	put_padding(capture);
+}
+
+/** Finishes the current pcapng block, terminating its option list */
+static void block_end(fastd_capture_t *capture) {
+	block_option(capture, PCAPNG_OPT_ENDOFOPT, NULL, 0);
+
+	uint32_t len = capture->out_len - capture->block_start + 4;
+	memcpy(capture->out + capture->block_start + 4, &len, sizeof(len));
+	put32(capture, len);
+}
+
+/** Writes the section header and interface description blocks */
+static void write_header(fastd_capture_t *capture) {
+	static const char *const names[CAPTURE_LAYER_MAX] = {
+		[CAPTURE_INNER] = "inner",
+		[CAPTURE_OUTER] = "outer",
+	};
+	static const uint8_t tsresol = 9;
+
+	block_begin(capture, PCAPNG_BLOCK_SHB);
+	put32(capture, 0x1a2b3c4d);
+	put16(capture, 1);
+	put16(capture, 0);
+	put32(capture, 0xffffffff);
+	put32(capture, 0xffffffff);
+	block_option(capture, PCAPNG_OPT_SHB_USERAPPL, "fastd " FASTD_VERSION, strlen("fastd " FASTD_VERSION));
+	block_end(capture);
+
+	size_t i;
+	for (i = 0; i < CAPTURE_LAYER_MAX; i++) {
+		block_begin(capture, PCAPNG_BLOCK_IDB);
+		put16(capture, (i == CAPTURE_INNER && conf.mode == MODE_TAP) ? LINKTYPE_ETHERNET : LINKTYPE_RAW);
+		put16(capture, 0);
+		put32(capture, 0);
+		block_option(capture, PCAPNG_OPT_IF_NAME, names[i], strlen(names[i]));
+		block_option(capture, PCAPNG_OPT_IF_TSRESOL, &tsresol, 1);
+		block_end(capture);
+	}
+}
+
+/** Adds data to an internet checksum */
+static uint32_t checksum_add(uint32_t sum, const void *data, size_t len) {
+	const uint8_t *p = data;
+
+	for (; len > 1; len -= 2, p += 2)
+		sum += (p[0] << 8) | p[1];
+
+	if (len)
+		sum += p[0] << 8;
+
+	return sum;
+}
+
+/** Folds an internet checksum (returned in network byte order) */
+static uint16_t checksum_fold(uint32_t sum) {
+	while (sum >> 16)
+		sum = (sum & 0xffff) + (sum >> 16);
+
+	return htons(~sum);
+}
+
+/** Makes the local address of an outer packet use the same address family as the remote address */
+static void match_address_family(fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr) {
+	if (local_addr->sa.sa_family == remote_addr->sa.sa_family)
+		return;
+
+	if (remote_addr->sa.sa_family == AF_INET6) {
+		fastd_peer_address_widen(local_addr);
+		return;
+	}
+
+	fastd_peer_address_simplify(local_addr);
+	if (local_addr->sa.sa_family == AF_INET)
+		return;
+
+	uint16_t port = fastd_peer_address_get_port(local_addr);
+	memset(local_addr, 0, sizeof(*local_addr));
+	local_addr->in.sin_family = AF_INET;
+	local_addr->in.sin_port = port;
+}
+
+/**
+   Appends synthesized IP and UDP headers for an outer packet to the output buffer
+
+   The UDP checksum is only computed if the whole datagram has been captured.
+*/
+static size_t put_outer_headers(fastd_capture_t *capture, capture_record_t *record, const uint8_t *data) {
+	match_address_family(&record->local_addr, &record->remote_addr);
+
+	const fastd_peer_address_t *src = record->outbound ? &record->local_addr : &record->remote_addr;
+	const fastd_peer_address_t *dst = record->outbound ? &record->remote_addr : &record->local_addr;
+
+	struct udphdr udp = {
+		.uh_sport = fastd_peer_address_get_port(src),
+		.uh_dport = fastd_peer_address_get_port(dst),
+		.uh_ulen = htons(sizeof(udp) + record->len),
+	};
+
+	uint32_t sum = IPPROTO_UDP + sizeof(udp) + record->len;
+
+	if (src->sa.sa_family == AF_INET) {
+		struct ip ip = {
+			.ip_v = 4,
+			.ip_hl = sizeof(struct ip) / 4,
+			.ip_len = htons(sizeof(struct ip) + sizeof(udp) + record->len),
+			.ip_off = htons(IP_DF),
+			.ip_ttl = 64,
+			.ip_p = IPPROTO_UDP,
+			.ip_src = src->in.sin_addr,
+			.ip_dst = dst->in.sin_addr,
+		};
+		ip.ip_sum = checksum_fold(checksum_add(0, &ip, sizeof(ip)));
+
+		sum = checksum_add(sum, &ip.ip_src, 2*sizeof(struct in_addr));
+		put(capture, &ip, sizeof(ip));
+	}
+	else {
+		struct ip6_hdr ip6 = {
+			.ip6_flow = htonl(0x60000000),
+			.ip6_plen = udp.uh_ulen,
+			.ip6_nxt = IPPROTO_UDP,
+			.ip6_hlim = 64,
+			.ip6_src = src->in6.sin6_addr,
+			.ip6_dst = dst->in6.sin6_addr,
+		};
+
+		sum = checksum_add(sum, &ip6.ip6_src, 2*sizeof(struct in6_addr));
+		put(capture, &ip6, sizeof(ip6));
+	}
+
+	if (record->caplen == record->len) {
+		sum = checksum_add(sum, &udp, sizeof(udp));
+		udp.uh_sum = checksum_fold(checksum_add(sum, data, record->caplen)) ?: 0xffff;
+	}
+
+	put(capture, &udp, sizeof(udp));
+
+	return (src->sa.sa_family == AF_INET ? sizeof(struct ip) : sizeof(struct ip6_hdr)) + sizeof(udp);
+}
+
+/** Writes an enhanced packet block for a packet taken from the ring buffer */
+static void write_packet(fastd_capture_t *capture, capture_record_t *record, const uint8_t *data, uint64_t dropcount) {
+	block_begin(capture, PCAPNG_BLOCK_EPB);
+	put32(capture, record->layer);
+	put32(capture, record->timestamp >> 32);
+	put32(capture, record->timestamp);
+
+	size_t lengths = capture->out_len;
+	put32(capture, 0);
+	put32(capture, 0);
+
+	size_t hdrlen = 0;
+	if (record->layer == CAPTURE_OUTER)
+		hdrlen = put_outer_headers(capture, record, data);
+
+	put(capture, data, record->caplen);
+	put_padding(capture);
+
+	uint32_t caplen = hdrlen + record->caplen, len = hdrlen + record->len;
+	memcpy(capture->out + lengths, &caplen, sizeof(caplen));
+	memcpy(capture->out + lengths + 4, &len, sizeof(len));
+
+	uint32_t flags = record->outbound ? 2 : 1;
+	block_option(capture, PCAPNG_OPT_EPB_FLAGS, &flags, sizeof(flags));
+
+	if (record->has_peer) {
+		char comment[32];
+		snprintf(comment, sizeof(comment), "peer %" PRIu64, record->peer_id);
+		block_option(capture, PCAPNG_OPT_COMMENT, comment, strlen(comment));
+	}
+
+	if (dropcount)
+		block_option(capture, PCAPNG_OPT_EPB_DROPCOUNT, &dropcount, sizeof(dropcount));
+
+	block_end(capture);
+}
+
+/**
+   Streams all packets in the ring buffer to the client, returns false on errors
+
+   Packets dropped because the ring buffer was full are reported in the dropcount option of
+   the next packet of the same layer.
+*/
+static bool drain(fastd_capture_t *capture, unsigned long reported[CAPTURE_LAYER_MAX]) {
+	uint8_t *data = capture->data;
+	size_t head = capture->head;
+	size_t tail = __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE);
+
+	while (head != tail) {
+		capture_record_t record;
+		ring_read(capture, head, &record, sizeof(record));
+		ring_read(capture, head + sizeof(record), data, record.caplen);
+		head += sizeof(record) + record.caplen;
+
+		__atomic_store_n(&capture->head, head, __ATOMIC_RELEASE);
+
+		unsigned long dropped = __atomic_load_n(&capture->dropped[record.layer], __ATOMIC_RELAXED);
+
+		if (capture->out_size - capture->out_len < capture->snaplen + CAPTURE_BLOCK_OVERHEAD) {
+			if (!flush_output(capture))
+				return false;
+		}
+
+		write_packet(capture, &record, data, dropped - reported[record.layer]);
+		reported[record.layer] = dropped;
+	}
+
+	return flush_output(capture);
+}
+
+/** Passes a capture to the main thread, retrying until the notification could be queued */
+static void notify(fastd_capture_t *capture) {
+	while (!fastd_async_enqueue(ASYNC_TYPE_CAPTURE, &capture, sizeof(capture)))
+		sleep(1);
+}
+
+/** Waits until the main thread has handled the given state of a capture */
+static capture_state_t wait_state(fastd_capture_t *capture, capture_state_t state) {
+	pthread_mutex_lock(&capture->mutex);
+
+	while (capture->state == state)
+		pthread_cond_wait(&capture->cond, &capture->mutex);
+
+	state = capture->state;
+	pthread_mutex_unlock(&capture->mutex);
+
+	return state;
+}
+
+/** Parses the arguments of the capture command, returns an error message or NULL */
+static const char * parse_args(fastd_capture_t *capture, char *args) {
+	size_t buffer = CAPTURE_BUFFER_DEFAULT;
+	bool layers = false;
+	char *saveptr, *token;
+
+	for (token = strtok_r(args, " \t\r\n", &saveptr); token; token = strtok_r(NULL, " \t\r\n", &saveptr)) {
+		if (!strcmp(token, "inner") || !strcmp(token, "outer")) {
+			capture->layers[strcmp(token, "inner") ? CAPTURE_OUTER : CAPTURE_INNER] = true;
+			layers = true;
+			continue;
+		}
+
+		char *arg = strtok_r(NULL, " \t\r\n", &saveptr);
+		if (!arg)
+			return "missing argument";
+
+		if (!strcmp(token, "peer")) {
+			free(capture->peer);
+			capture->peer = fastd_strdup(arg);
+			continue;
+		}
+
+		char *endptr;
+		unsigned long value = strtoul(arg, &endptr, 10);
+		if (*endptr || !*arg)
+			return "invalid number";
+
+		if (!strcmp(token, "snaplen")) {
+			if (value < 1 || value > CAPTURE_SNAPLEN_DEFAULT)
+				return "invalid snapshot length";
+
+			capture->snaplen = value;
+		}
+		else if (!strcmp(token, "buffer")) {
+			if (value < 64 || value > CAPTURE_BUFFER_MAX)
+				return "invalid buffer size";
+
+			buffer = value;
+		}
+		else {
+			return "invalid argument";
+		}
+	}
+
+	if (!layers)
+		capture->layers[CAPTURE_INNER] = capture->layers[CAPTURE_OUTER] = true;
+
+	/* Round the buffer size up to a power of two */
+	capture->ring_size = 1024;
+	while (capture->ring_size < 1024*buffer)
+		capture->ring_size <<= 1;
+
+	return NULL;
+}
+
+/** Frees a capture */
+static void capture_free(fastd_capture_t *capture) {
+	pthread_cond_destroy(&capture->cond);
+	pthread_mutex_destroy(&capture->mutex);
+
+	free(capture->peer);
+	free(capture->ring);
+	free(capture->data);
+	free(capture->out);
+	free(capture);
+}
+
+/**
+   Handles the capture command of a control socket connection (called in the connection's thread)
+
+   Returns when the client has closed the connection or can't keep up with the written data.
+*/
+void fastd_capture_run(int fd, char *args) {
+	fastd_capture_t *capture = fastd_new0(fastd_capture_t);
+	pthread_mutex_init(&capture->mutex, NULL);
+	pthread_cond_init(&capture->cond, NULL);
+	capture->fd = fd;
+	capture->snaplen = CAPTURE_SNAPLEN_DEFAULT;
+
+	const char *error = parse_args(capture, args);
+	if (error) {
+		dprintf(fd, "error: %s\n", error);
+		capture_free(capture);
+		return;
+	}
+
+	capture->ring = fastd_alloc(capture->ring_size);
+	capture->data = fastd_alloc(capture->snaplen);
+	capture->out_size = capture->snaplen + CAPTURE_BLOCK_OVERHEAD + 65536;
+	capture->out = fastd_alloc(capture->out_size);
+
+	capture->state = CAPTURE_REQUESTED;
+	if (!fastd_async_enqueue(ASYNC_TYPE_CAPTURE, &capture, sizeof(capture))) {
+		dprintf(fd, "error: unable to start capture\n");
+		capture_free(capture);
+		return;
+	}
+
+	if (wait_state(capture, CAPTURE_REQUESTED) == CAPTURE_REFUSED) {
+		dprintf(fd, "error: %s\n", capture->error);
+		capture_free(capture);
+		return;
+	}
+
+	unsigned long reported[CAPTURE_LAYER_MAX] = {};
+
+	write_header(capture);
+	while (drain(capture, reported) && !fastd_status_client_closed(fd, CAPTURE_POLL_INTERVAL)) {}
+
+	pthread_mutex_lock(&capture->mutex);
+	capture->state = CAPTURE_CLOSING;
+	pthread_mutex_unlock(&capture->mutex);
+
+	notify(capture);
+	wait_state(capture, CAPTURE_CLOSING);
+
+	capture_free(capture);
+}
+
+#endif
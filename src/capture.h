@@ -0,0 +1,100 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+
+/**
+   \file
+
+   Packet capture
+
+   A capture is requested with the \e capture command on the control socket. While a capture
+   is active, the main thread copies the matching packets into a ring buffer preallocated by
+   the capture, from which the connection's thread streams them to the client in the pcapng
+   format. Packets are recorded at two layers: the plaintext frames exchanged with the TUN/TAP
+   device ("inner") and the UDP datagrams exchanged with the peers ("outer"); IP and UDP
+   headers are synthesized for the latter.
+
+   Without an active capture, each capture point only checks if \e ctx.capture is set.
+*/
+
+
+#pragma once
+
+#include "fastd.h"
+
+
+/** The layers packets can be captured at (also used as pcapng interface IDs) */
+typedef enum fastd_capture_layer {
+	CAPTURE_INNER = 0,		/**< Plaintext frames exchanged with the TUN/TAP device */
+	CAPTURE_OUTER,			/**< UDP datagrams exchanged with the peers */
+	CAPTURE_LAYER_MAX,		/**< (Number of layers) */
+} fastd_capture_layer_t;
+
+
+#ifdef WITH_STATUS_SOCKET
+
+void fastd_capture_run(int fd, char *args);
+void fastd_capture_handle(fastd_capture_t *capture);
+
+void fastd_capture_record_inner(const fastd_peer_t *peer, bool outbound, fastd_buffer_t buffer);
+void fastd_capture_record_outer(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr,
+				const fastd_peer_t *peer, bool outbound, const uint8_t *head, size_t head_len, fastd_buffer_t buffer);
+
+
+/** Captures a plaintext frame sent to or received from a peer */
+static inline void fastd_capture_inner(const fastd_peer_t *peer, bool outbound, fastd_buffer_t buffer) {
+	if (ctx.capture)
+		fastd_capture_record_inner(peer, outbound, buffer);
+}
+
+/** Captures a datagram received on a socket (including the packet type byte) */
+static inline void fastd_capture_outer_rx(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr,
+					  const fastd_peer_address_t *remote_addr, const fastd_peer_t *peer, fastd_buffer_t buffer) {
+	if (ctx.capture)
+		fastd_capture_record_outer(sock, local_addr, remote_addr, peer, false, NULL, 0, buffer);
+}
+
+/** Captures a datagram sent on a socket */
+static inline void fastd_capture_outer_tx(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr,
+					  const fastd_peer_address_t *remote_addr, const fastd_peer_t *peer, const uint8_t *packet_type, fastd_buffer_t buffer) {
+	if (ctx.capture)
+		fastd_capture_record_outer(sock, local_addr, remote_addr, peer, true, packet_type, 1, buffer);
+}
+
+#else
+
+static inline void fastd_capture_inner(UNUSED const fastd_peer_t *peer, UNUSED bool outbound, UNUSED fastd_buffer_t buffer) {
+}
+
+static inline void fastd_capture_outer_rx(UNUSED const fastd_socket_t *sock, UNUSED const fastd_peer_address_t *local_addr,
+					  UNUSED const fastd_peer_address_t *remote_addr, UNUSED const fastd_peer_t *peer, UNUSED fastd_buffer_t buffer) {
+}
+
+static inline void fastd_capture_outer_tx(UNUSED const fastd_socket_t *sock, UNUSED const fastd_peer_address_t *local_addr,
+					  UNUSED const fastd_peer_address_t *remote_addr, UNUSED const fastd_peer_t *peer, UNUSED const uint8_t *packet_type,
+					  UNUSED fastd_buffer_t buffer) {
+}
+
+#endif
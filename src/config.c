@@ -68,6 +68,10 @@ static void default_config(void) {
 	conf.mode = MODE_TAP;
 
 	conf.secure_handshakes = true;
+	conf.handshake_rate = 1000;
+	conf.handshake_burst = 100;
+	conf.handshake_workers = 1;
+	conf.handshake_cookie_threshold = 100;
 	conf.drop_caps = DROP_CAPS_ON;
 
 	conf.protocol = &fastd_protocol_ec25519_fhmqvc;
@@ -224,7 +228,7 @@ static void read_peer_dir(fastd_peer_group_t *group, const char *dir) {
 				continue;
 			}
 
-			fastd_peer_t *peer = fastd_new0(fastd_peer_t);
+			fastd_peer_t *peer = fastd_peer_new();
 			peer->name = fastd_strdup(result->d_name);
 			peer->config_source_dir = dir;
 
@@ -677,6 +681,8 @@ void fastd_config_release(void) {
 
 #ifdef WITH_STATUS_SOCKET
 	free(conf.status_socket);
+	free(conf.metrics_socket);
+	free(conf.control_socket);
 #endif
 
 #ifdef USE_USER
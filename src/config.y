@@ -69,9 +69,12 @@
 %token TOK_ASYNC
 %token TOK_AUTO
 %token TOK_BIND
+%token TOK_BURST
 %token TOK_CAPABILITIES
 %token TOK_CIPHER
 %token TOK_CONNECT
+%token TOK_CONTROL
+%token TOK_COOKIE
 %token TOK_DEBUG
 %token TOK_DEBUG2
 %token TOK_DEFAULT
@@ -86,11 +89,13 @@
 %token TOK_FORWARD
 %token TOK_FROM
 %token TOK_GROUP
+%token TOK_HANDSHAKE
 %token TOK_HANDSHAKES
 %token TOK_HIDE
 %token TOK_INCLUDE
 %token TOK_INFO
 %token TOK_INTERFACE
+%token TOK_INTERVAL
 %token TOK_IP
 %token TOK_IPV4
 %token TOK_IPV6
@@ -101,6 +106,7 @@
 %token TOK_MAC
 %token TOK_MARK
 %token TOK_METHOD
+%token TOK_METRICS
 %token TOK_MODE
 %token TOK_MTU
 %token TOK_NO
@@ -112,8 +118,12 @@
 %token TOK_PORT
 %token TOK_POST_DOWN
 %token TOK_PRE_UP
+%token TOK_PROBE
 %token TOK_PROTOCOL
+%token TOK_RATE
 %token TOK_REMOTE
+%token TOK_RESUMPTION
+%token TOK_RTT
 %token TOK_SECRET
 %token TOK_SECURE
 %token TOK_SOCKET
@@ -122,6 +132,7 @@
 %token TOK_SYNC
 %token TOK_SYSLOG
 %token TOK_TAP
+%token TOK_THRESHOLD
 %token TOK_TO
 %token TOK_TUN
 %token TOK_UP
@@ -130,6 +141,8 @@
 %token TOK_VERBOSE
 %token TOK_VERIFY
 %token TOK_WARN
+%token TOK_WINDOW
+%token TOK_WORKERS
 %token TOK_YES
 
 
@@ -180,6 +193,12 @@ statement:	peer_group_statement
 	|	TOK_GROUP group ';'
 	|	TOK_DROP TOK_CAPABILITIES drop_capabilities ';'
 	|	TOK_SECURE TOK_HANDSHAKES secure_handshakes ';'
+	|	TOK_HANDSHAKE TOK_RATE handshake_rate ';'
+	|	TOK_HANDSHAKE TOK_BURST handshake_burst ';'
+	|	TOK_HANDSHAKE TOK_WORKERS handshake_workers ';'
+	|	TOK_HANDSHAKE TOK_COOKIE TOK_THRESHOLD handshake_cookie_threshold ';'
+	|	TOK_HANDSHAKE TOK_RESUMPTION TOK_WINDOW handshake_resumption_window ';'
+	|	TOK_RTT TOK_PROBE TOK_INTERVAL rtt_probe_interval ';'
 	|	TOK_CIPHER cipher ';'
 	|	TOK_MAC mac ';'
 	|	TOK_LOG log ';'
@@ -201,6 +220,8 @@ statement:	peer_group_statement
 	|	TOK_ON TOK_DISESTABLISH on_disestablish ';'
 	|	TOK_ON TOK_VERIFY on_verify ';'
 	|	TOK_STATUS TOK_SOCKET status_socket ';'
+	|	TOK_METRICS TOK_SOCKET metrics_socket ';'
+	|	TOK_CONTROL TOK_SOCKET control_socket ';'
 	|	TOK_FORWARD forward ';'
 	;
 
@@ -265,6 +286,9 @@ log:		TOK_LEVEL log_level {
 			if (conf.log_stderr_level || !conf.log_syslog_level)
 				conf.log_stderr_level = $2;
 		}
+	|	TOK_ASYNC boolean {
+			conf.log_async = $2;
+		}
 	|	TOK_TO TOK_STDERR maybe_log_level {
 			conf.log_stderr_level = $3;
 		}
@@ -372,6 +396,66 @@ mtu:		TOK_UINT {
 pmtu:		autobool	{ conf.pmtu = $1; }
 	;
 
+handshake_rate:	TOK_UINT {
+			if ($1 < 1 || $1 > 1000000) {
+				fastd_config_error(&@$, state, "invalid handshake rate");
+				YYERROR;
+			}
+
+			conf.handshake_rate = $1;
+		}
+	;
+
+handshake_burst: TOK_UINT {
+			if ($1 < 1 || $1 > 1000000) {
+				fastd_config_error(&@$, state, "invalid handshake burst");
+				YYERROR;
+			}
+
+			conf.handshake_burst = $1;
+		}
+	;
+
+handshake_workers: TOK_UINT {
+			if ($1 > 64) {
+				fastd_config_error(&@$, state, "invalid number of handshake workers");
+				YYERROR;
+			}
+
+			conf.handshake_workers = $1;
+		}
+	;
+
+handshake_cookie_threshold: TOK_UINT {
+			if ($1 > 1000000) {
+				fastd_config_error(&@$, state, "invalid handshake cookie threshold");
+				YYERROR;
+			}
+
+			conf.handshake_cookie_threshold = $1;
+		}
+	;
+
+handshake_resumption_window: TOK_UINT {
+			if ($1 > 86400) {
+				fastd_config_error(&@$, state, "invalid handshake resumption window");
+				YYERROR;
+			}
+
+			conf.handshake_resumption_window = $1;
+		}
+	;
+
+rtt_probe_interval: TOK_UINT {
+			if ($1 > 3600) {
+				fastd_config_error(&@$, state, "invalid RTT probe interval");
+				YYERROR;
+			}
+
+			conf.rtt_probe_interval = $1;
+		}
+	;
+
 mode:		TOK_TAP		{ conf.mode = MODE_TAP; }
 	|	TOK_TUN		{ conf.mode = MODE_TUN; }
 	;
@@ -439,8 +523,28 @@ status_socket:	TOK_STRING {
 		}
 	;
 
+metrics_socket:	TOK_STRING {
+#ifdef WITH_STATUS_SOCKET
+			free(conf.metrics_socket); conf.metrics_socket = fastd_strdup($1->str);
+#else
+			fastd_config_error(&@$, state, "metrics sockets aren't supported by this version of fastd");
+			YYERROR;
+#endif
+		}
+	;
+
+control_socket:	TOK_STRING {
+#ifdef WITH_STATUS_SOCKET
+			free(conf.control_socket); conf.control_socket = fastd_strdup($1->str);
+#else
+			fastd_config_error(&@$, state, "control sockets aren't supported by this version of fastd");
+			YYERROR;
+#endif
+		}
+	;
+
 peer:		TOK_STRING {
-			state->peer = fastd_new0(fastd_peer_t);
+			state->peer = fastd_peer_new();
 			state->peer->name = fastd_strdup($1->str);
 			state->peer->group = state->peer_group;
 		}
@@ -561,7 +665,7 @@ forward:	boolean		{ conf.forward = $1; }
 
 
 include:	TOK_PEER TOK_STRING maybe_as {
-			fastd_peer_t *peer = fastd_new0(fastd_peer_t);
+			fastd_peer_t *peer = fastd_peer_new();
 			peer->name = fastd_strdup(fastd_string_stack_get($3));
 
 			if (!fastd_config_read($2->str, state->peer_group, peer, state->depth))
@@ -45,12 +45,45 @@
 /** The SSSE3 bit in the CPUID return value */
 #define CPUID_SSSE3	((uint64_t)1 << 41)
 
+/** The SSE4.1 bit in the CPUID return value */
+#define CPUID_SSE41	((uint64_t)1 << 51)
+
+
+/** The SHA bit in the extended CPUID return value */
+#define CPUID_EXT_SHA	((uint64_t)1 << 29)
+
+
+/**
+   The CPUID instruction, saving and restoring EBX (which may be used as PIC register) in EDI
+
+   The full register is exchanged on x86-64, as a 32bit move would clear the upper half of RBX.
+*/
+#ifdef __x86_64__
+#define CPUID_ASM "xchgq %%rbx, %%rdi;" "cpuid;" "xchgq %%rbx, %%rdi;"
+#else
+#define CPUID_ASM "xchgl %%ebx, %%edi;" "cpuid;" "xchgl %%ebx, %%edi;"
+#endif
+
 
 /** Returns the ECX and EDX return values of CPUID function 1 as a single uint64 */
 static inline uint64_t fastd_cpuid(void) {
 	unsigned eax, ebx, ecx, edx;
 
-	__asm__ __volatile__ ("mov %%ebx, %%edi;" "cpuid;" "xchgl %%ebx, %%edi;" : "=a" (eax), "=D" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
+	__asm__ __volatile__ (CPUID_ASM : "=a" (eax), "=D" (ebx), "=c" (ecx), "=d" (edx) : "a" (1));
 
 	return ((uint64_t)ecx) << 32 | edx;
 }
+
+/** Returns the EBX and ECX return values of CPUID function 7 (subfunction 0) as a single uint64 */
+static inline uint64_t fastd_cpuid_ext(void) {
+	unsigned eax, ebx, ecx, edx;
+
+	__asm__ __volatile__ (CPUID_ASM : "=a" (eax), "=D" (ebx), "=c" (ecx), "=d" (edx) : "a" (0));
+
+	if (eax < 7)
+		return 0;
+
+	__asm__ __volatile__ (CPUID_ASM : "=a" (eax), "=D" (ebx), "=c" (ecx), "=d" (edx) : "a" (7), "c" (0));
+
+	return ((uint64_t)ecx) << 32 | ebx;
+}
@@ -38,6 +38,10 @@
 #include <string.h>
 
 
+/** The alignment of cipher and MAC contexts */
+#define CRYPTO_STATE_ALIGN 16
+
+
 /** Contains information about a cipher algorithm */
 struct fastd_cipher_info {
 	size_t key_length;		/**< The key length used by the cipher */
@@ -49,12 +53,15 @@ struct fastd_cipher {
 	/**< Checks if the algorithm is available on the platform used. If NULL, the algorithm is always available. */
 	bool (*available)(void);
 
-	/** Initializes a cipher context with the given key */
-	fastd_cipher_state_t * (*init)(const uint8_t *key);
+	/** The size of a cipher context */
+	size_t state_size;
+
+	/** Initializes a cipher context with the given key in memory of state_size bytes aligned to CRYPTO_STATE_ALIGN */
+	void (*init)(fastd_cipher_state_t *state, const uint8_t *key);
 	/** Encrypts or decrypts data */
 	bool (*crypt)(const fastd_cipher_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t len, const uint8_t *iv);
-	/** Frees a cipher context */
-	void (*free)(fastd_cipher_state_t *state);
+	/** Releases the resources held by a cipher context and wipes it (the context memory itself is not freed) */
+	void (*cleanup)(fastd_cipher_state_t *state);
 };
 
 
@@ -68,12 +75,15 @@ struct fastd_mac {
 	/**< Checks if the algorithm is available on the platform used. If NULL, the algorithm is always available. */
 	bool (*available)(void);
 
-	/** Initializes a MAC context with the given key */
-	fastd_mac_state_t * (*init)(const uint8_t *key);
+	/** The size of a MAC context */
+	size_t state_size;
+
+	/** Initializes a MAC context with the given key in memory of state_size bytes aligned to CRYPTO_STATE_ALIGN */
+	void (*init)(fastd_mac_state_t *state, const uint8_t *key);
 	/** Computes the MAC of data blocks */
 	bool (*digest)(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length);
-	/** Frees a MAC context */
-	void (*free)(fastd_mac_state_t *state);
+	/** Releases the resources held by a MAC context and wipes it (the context memory itself is not freed) */
+	void (*cleanup)(fastd_mac_state_t *state);
 };
 
 
@@ -105,6 +115,24 @@ const fastd_mac_info_t * fastd_mac_info_get_by_name(const char *name);
 const fastd_mac_t * fastd_mac_get(const fastd_mac_info_t *info);
 
 
+/**
+   Reserves space for a cipher or MAC context when laying out a session state allocation
+
+   \a size is the size of the allocation so far; it is increased by the aligned context size.
+   The context's offset from the start of the allocation is returned.
+*/
+static inline size_t fastd_crypto_state_reserve(size_t *size, size_t state_size) {
+	size_t offset = (*size + CRYPTO_STATE_ALIGN - 1) & ~(size_t)(CRYPTO_STATE_ALIGN - 1);
+	*size = offset + state_size;
+	return offset;
+}
+
+/** Returns a pointer to a context at the given offset inside a session state allocation */
+static inline void * fastd_crypto_state_at(void *base, size_t offset) {
+	return (uint8_t *)base + offset;
+}
+
+
 /** Sets a range of memory to zero, ensuring the operation can't be optimized out by the compiler */
 static inline void secure_memzero(void *s, size_t n) {
 	memset(s, 0, n);
@@ -31,7 +31,6 @@
 
 
 #include "../../../../crypto.h"
-#include "../../../../alloc.h"
 
 #include <crypto_stream_aes128ctr.h>
 
@@ -43,14 +42,11 @@ struct __attribute__((aligned(16))) fastd_cipher_state {
 
 
 /** Initializes the cipher state */
-static fastd_cipher_state_t * aes128_ctr_init(const uint8_t *key) {
+static void aes128_ctr_init(fastd_cipher_state_t *state, const uint8_t *key) {
 	fastd_block128_t k;
 	memcpy(k.b, key, sizeof(fastd_block128_t));
 
-	fastd_cipher_state_t *state = fastd_new_aligned(fastd_cipher_state_t, 16);
 	crypto_stream_aes128ctr_beforenm(state->d, k.b);
-
-	return state;
 }
 
 /** XORs data with the aes128-ctr cipher stream */
@@ -59,18 +55,17 @@ static bool aes128_ctr_crypt(const fastd_cipher_state_t *state, fastd_block128_t
 	return true;
 }
 
-/** Frees the cipher state */
-static void aes128_ctr_free(fastd_cipher_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the cipher state */
+static void aes128_ctr_cleanup(fastd_cipher_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 
 /** The nacl aes128-ctr implementation */
 const fastd_cipher_t fastd_cipher_aes128_ctr_nacl = {
+	.state_size = sizeof(fastd_cipher_state_t),
+
 	.init = aes128_ctr_init,
 	.crypt = aes128_ctr_crypt,
-	.free = aes128_ctr_free,
+	.cleanup = aes128_ctr_cleanup,
 };
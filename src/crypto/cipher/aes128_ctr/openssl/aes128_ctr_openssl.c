@@ -30,7 +30,6 @@
 */
 
 
-#include "../../../../alloc.h"
 #include "../../../../crypto.h"
 
 #include <openssl/evp.h>
@@ -43,13 +42,9 @@ struct fastd_cipher_state {
 
 
 /** Initializes the cipher state */
-static fastd_cipher_state_t * aes128_ctr_init(const uint8_t *key) {
-	fastd_cipher_state_t *state = fastd_new(fastd_cipher_state_t);
-
+static void aes128_ctr_init(fastd_cipher_state_t *state, const uint8_t *key) {
 	state->aes = EVP_CIPHER_CTX_new();
 	EVP_EncryptInit(state->aes, EVP_aes_128_ctr(), (const unsigned char *)key, NULL);
-
-	return state;
 }
 
 /** XORs data with the aes128-ctr cipher stream */
@@ -71,18 +66,18 @@ static bool aes128_ctr_crypt(const fastd_cipher_state_t *state, fastd_block128_t
 	return true;
 }
 
-/** Frees the cipher state */
-static void aes128_ctr_free(fastd_cipher_state_t *state) {
-	if (state) {
-		EVP_CIPHER_CTX_free(state->aes);
-		free(state);
-	}
+/** Frees the OpenSSL cipher context */
+static void aes128_ctr_cleanup(fastd_cipher_state_t *state) {
+	EVP_CIPHER_CTX_free(state->aes);
+	state->aes = NULL;
 }
 
 
 /** The openssl aes128-ctr implementation */
 const fastd_cipher_t fastd_cipher_aes128_ctr_openssl = {
+	.state_size = sizeof(fastd_cipher_state_t),
+
 	.init = aes128_ctr_init,
 	.crypt = aes128_ctr_crypt,
-	.free = aes128_ctr_free,
+	.cleanup = aes128_ctr_cleanup,
 };
@@ -34,8 +34,7 @@
 
 
 /** Doesn't do anything as the null cipher doesn't use any state */
-static fastd_cipher_state_t * null_init(UNUSED const uint8_t *key) {
-	return NULL;
+static void null_init(UNUSED fastd_cipher_state_t *state, UNUSED const uint8_t *key) {
 }
 
 /** Just copies the input data to the output */
@@ -45,12 +44,12 @@ static bool null_memcpy(UNUSED const fastd_cipher_state_t *state, fastd_block128
 }
 
 /** Doesn't do anything as the null cipher doesn't use any state */
-static void null_free(UNUSED fastd_cipher_state_t *state) {
+static void null_cleanup(UNUSED fastd_cipher_state_t *state) {
 }
 
 /** The memcpy null implementation */
 const fastd_cipher_t fastd_cipher_null_memcpy = {
 	.init = null_init,
 	.crypt = null_memcpy,
-	.free = null_free,
+	.cleanup = null_cleanup,
 };
@@ -30,7 +30,6 @@
 */
 
 
-#include "../../../../alloc.h"
 #include "../../../../crypto.h"
 
 #include <crypto_stream_salsa20.h>
@@ -43,11 +42,8 @@ struct fastd_cipher_state {
 
 
 /** Initializes the cipher state */
-static fastd_cipher_state_t * salsa20_init(const uint8_t *key) {
-	fastd_cipher_state_t *state = fastd_new(fastd_cipher_state_t);
+static void salsa20_init(fastd_cipher_state_t *state, const uint8_t *key) {
 	memcpy(state->key, key, crypto_stream_salsa20_KEYBYTES);
-
-	return state;
 }
 
 /** XORs data with the Salsa20 cipher stream */
@@ -56,18 +52,17 @@ static bool salsa20_crypt(const fastd_cipher_state_t *state, fastd_block128_t *o
 	return true;
 }
 
-/** Frees the cipher state */
-static void salsa20_free(fastd_cipher_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the cipher state */
+static void salsa20_cleanup(fastd_cipher_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 
 /** The nacl salsa20 implementation */
 const fastd_cipher_t fastd_cipher_salsa20_nacl = {
+	.state_size = sizeof(fastd_cipher_state_t),
+
 	.init = salsa20_init,
 	.crypt = salsa20_crypt,
-	.free = salsa20_free,
+	.cleanup = salsa20_cleanup,
 };
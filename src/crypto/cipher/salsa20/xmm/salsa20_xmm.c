@@ -33,7 +33,6 @@
 */
 
 
-#include "../../../../alloc.h"
 #include "../../../../crypto.h"
 #include "../../../../cpuid.h"
 
@@ -67,11 +66,8 @@ static bool salsa20_available(void) {
 }
 
 /** Initializes the cipher state */
-static fastd_cipher_state_t * salsa20_init(const uint8_t *key) {
-	fastd_cipher_state_t *state = fastd_new(fastd_cipher_state_t);
+static void salsa20_init(fastd_cipher_state_t *state, const uint8_t *key) {
 	memcpy(state->key, key, KEYBYTES);
-
-	return state;
 }
 
 /** XORs data with the Salsa20 cipher stream */
@@ -80,12 +76,9 @@ static bool salsa20_crypt(const fastd_cipher_state_t *state, fastd_block128_t *o
 	return true;
 }
 
-/** Frees the cipher state */
-static void salsa20_free(fastd_cipher_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the cipher state */
+static void salsa20_cleanup(fastd_cipher_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 
@@ -93,7 +86,9 @@ static void salsa20_free(fastd_cipher_state_t *state) {
 const fastd_cipher_t fastd_cipher_salsa20_xmm = {
 	.available = salsa20_available,
 
+	.state_size = sizeof(fastd_cipher_state_t),
+
 	.init = salsa20_init,
 	.crypt = salsa20_crypt,
-	.free = salsa20_free,
+	.cleanup = salsa20_cleanup,
 };
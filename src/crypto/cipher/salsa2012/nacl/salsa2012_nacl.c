@@ -30,7 +30,6 @@
 */
 
 
-#include "../../../../alloc.h"
 #include "../../../../crypto.h"
 
 #include <crypto_stream_salsa2012.h>
@@ -43,11 +42,8 @@ struct fastd_cipher_state {
 
 
 /** Initializes the cipher state */
-static fastd_cipher_state_t * salsa2012_init(const uint8_t *key) {
-	fastd_cipher_state_t *state = fastd_new(fastd_cipher_state_t);
+static void salsa2012_init(fastd_cipher_state_t *state, const uint8_t *key) {
 	memcpy(state->key, key, crypto_stream_salsa2012_KEYBYTES);
-
-	return state;
 }
 
 /** XORs data with the Salsa20/12 cipher stream */
@@ -56,18 +52,17 @@ static bool salsa2012_crypt(const fastd_cipher_state_t *state, fastd_block128_t
 	return true;
 }
 
-/** Frees the cipher state */
-static void salsa2012_free(fastd_cipher_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the cipher state */
+static void salsa2012_cleanup(fastd_cipher_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 
 /** The nacl salsa2012 implementation */
 const fastd_cipher_t fastd_cipher_salsa2012_nacl = {
+	.state_size = sizeof(fastd_cipher_state_t),
+
 	.init = salsa2012_init,
 	.crypt = salsa2012_crypt,
-	.free = salsa2012_free,
+	.cleanup = salsa2012_cleanup,
 };
@@ -33,7 +33,6 @@
 */
 
 
-#include "../../../../alloc.h"
 #include "../../../../crypto.h"
 #include "../../../../cpuid.h"
 
@@ -67,11 +66,8 @@ static bool salsa2012_available(void) {
 }
 
 /** Initializes the cipher state */
-static fastd_cipher_state_t * salsa2012_init(const uint8_t *key) {
-	fastd_cipher_state_t *state = fastd_new(fastd_cipher_state_t);
+static void salsa2012_init(fastd_cipher_state_t *state, const uint8_t *key) {
 	memcpy(state->key, key, KEYBYTES);
-
-	return state;
 }
 
 /** XORs data with the Salsa20/12 cipher stream */
@@ -80,12 +76,9 @@ static bool salsa2012_crypt(const fastd_cipher_state_t *state, fastd_block128_t
 	return true;
 }
 
-/** Frees the cipher state */
-static void salsa2012_free(fastd_cipher_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the cipher state */
+static void salsa2012_cleanup(fastd_cipher_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 
@@ -93,7 +86,9 @@ static void salsa2012_free(fastd_cipher_state_t *state) {
 const fastd_cipher_t fastd_cipher_salsa2012_xmm = {
 	.available = salsa2012_available,
 
+	.state_size = sizeof(fastd_cipher_state_t),
+
 	.init = salsa2012_init,
 	.crypt = salsa2012_crypt,
-	.free = salsa2012_free,
+	.cleanup = salsa2012_cleanup,
 };
@@ -30,7 +30,6 @@
 */
 
 
-#include "../../../../alloc.h"
 #include "../../../../crypto.h"
 
 #include <crypto_stream_salsa208.h>
@@ -43,11 +42,8 @@ struct fastd_cipher_state {
 
 
 /** Initializes the cipher state */
-static fastd_cipher_state_t * salsa208_init(const uint8_t *key) {
-	fastd_cipher_state_t *state = fastd_new(fastd_cipher_state_t);
+static void salsa208_init(fastd_cipher_state_t *state, const uint8_t *key) {
 	memcpy(state->key, key, crypto_stream_salsa208_KEYBYTES);
-
-	return state;
 }
 
 /** XORs data with the Salsa20/8 cipher stream */
@@ -56,18 +52,17 @@ static bool salsa208_crypt(const fastd_cipher_state_t *state, fastd_block128_t *
 	return true;
 }
 
-/** Frees the cipher state */
-static void salsa208_free(fastd_cipher_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the cipher state */
+static void salsa208_cleanup(fastd_cipher_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 
 /** The nacl salsa208 implementation */
 const fastd_cipher_t fastd_cipher_salsa208_nacl = {
+	.state_size = sizeof(fastd_cipher_state_t),
+
 	.init = salsa208_init,
 	.crypt = salsa208_crypt,
-	.free = salsa208_free,
+	.cleanup = salsa208_cleanup,
 };
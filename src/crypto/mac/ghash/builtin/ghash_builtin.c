@@ -73,9 +73,7 @@ static inline void mulH_a(fastd_block128_t *x, const fastd_mac_state_t *cstate)
 
 
 /** Initializes the MAC state with the unpacked key data */
-static fastd_mac_state_t * ghash_init(const uint8_t *key) {
-	fastd_mac_state_t *state = fastd_new_aligned(fastd_mac_state_t, 16);
-
+static void ghash_init(fastd_mac_state_t *state, const uint8_t *key) {
 	fastd_block128_t Hbase[4];
 	fastd_block128_t Rbase[4];
 
@@ -113,8 +111,6 @@ static fastd_mac_state_t * ghash_init(const uint8_t *key) {
 			xor_a(&state->H[i][j], &R[carry]);
 		}
 	}
-
-	return state;
 }
 
 /** Calculates the GHASH of the supplied blocks */
@@ -135,17 +131,16 @@ static bool ghash_digest(const fastd_mac_state_t *state, fastd_block128_t *out,
 	return true;
 }
 
-/** Frees the MAC state */
-static void ghash_free(fastd_mac_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the MAC state */
+static void ghash_cleanup(fastd_mac_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 /** The builtin GHASH implementation */
 const fastd_mac_t fastd_mac_ghash_builtin = {
+	.state_size = sizeof(fastd_mac_state_t),
+
 	.init = ghash_init,
 	.digest = ghash_digest,
-	.free = ghash_free,
+	.cleanup = ghash_cleanup,
 };
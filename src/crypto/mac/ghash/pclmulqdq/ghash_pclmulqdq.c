@@ -45,7 +45,9 @@ static bool ghash_available(void) {
 const fastd_mac_t fastd_mac_ghash_pclmulqdq = {
 	.available = ghash_available,
 
+	.state_size = sizeof(fastd_mac_state_t),
+
 	.init = fastd_ghash_pclmulqdq_init,
 	.digest = fastd_ghash_pclmulqdq_digest,
-	.free = fastd_ghash_pclmulqdq_free,
+	.cleanup = fastd_ghash_pclmulqdq_cleanup,
 };
@@ -35,6 +35,12 @@
 #include "../../../../crypto.h"
 
 
-fastd_mac_state_t * fastd_ghash_pclmulqdq_init(const uint8_t *key);
+/** The MAC state used by this GHASH implementation */
+struct fastd_mac_state {
+	fastd_block128_t H;		/**< The hash key used by GHASH */
+};
+
+
+void fastd_ghash_pclmulqdq_init(fastd_mac_state_t *state, const uint8_t *key);
 bool fastd_ghash_pclmulqdq_digest(const fastd_mac_state_t *state, fastd_block128_t *out, const fastd_block128_t *in, size_t length);
-void fastd_ghash_pclmulqdq_free(fastd_mac_state_t *state);
+void fastd_ghash_pclmulqdq_cleanup(fastd_mac_state_t *state);
@@ -44,11 +44,6 @@ typedef union vecblock {
 	fastd_block128_t b;		/**< fastd_block128_t access */
 } vecblock_t;
 
-/** The MAC state used by this GHASH implementation */
-struct fastd_mac_state {
-	vecblock_t H;			/**< The hash key used by GHASH */
-};
-
 
 /** Left shift on a 128bit integer */
 static inline __m128i shl(__m128i v, int a) {
@@ -78,21 +73,18 @@ static inline __m128i byteswap(__m128i v) {
 
 
 /** Initializes the state used by this GHASH implementation */
-fastd_mac_state_t * fastd_ghash_pclmulqdq_init(const uint8_t *key) {
-	fastd_mac_state_t *state = fastd_new_aligned(fastd_mac_state_t, 16);
+void fastd_ghash_pclmulqdq_init(fastd_mac_state_t *state, const uint8_t *key) {
+	vecblock_t H;
 
-	memcpy(&state->H, key, sizeof(__m128i));
-	state->H.v = byteswap(state->H.v);
+	memcpy(&H, key, sizeof(__m128i));
+	H.v = byteswap(H.v);
 
-	return state;
+	state->H = H.b;
 }
 
-/** Frees the state used by this GHASH implementation */
-void fastd_ghash_pclmulqdq_free(fastd_mac_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the state used by this GHASH implementation */
+void fastd_ghash_pclmulqdq_cleanup(fastd_mac_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 /** Performs a carryless multiplication of two 128bit integers modulo \f$ x^{128} + x^7 + x^2 + x + 1 \f$ */
@@ -156,13 +148,14 @@ bool fastd_ghash_pclmulqdq_digest(const fastd_mac_state_t *state, fastd_block128
 
 	size_t n_blocks = length / sizeof(fastd_block128_t);
 
+	__m128i H = ((vecblock_t)state->H).v;
 	vecblock_t v = {.v = _mm_setzero_si128()};
 
 	size_t i;
 	for (i = 0; i < n_blocks; i++) {
 		__m128i b = ((vecblock_t)in[i]).v;
 		v.v = _mm_xor_si128(v.v, byteswap(b));
-		v.v = gmul(v.v, state->H.v);
+		v.v = gmul(v.v, H);
 	}
 
 	v.v = byteswap(v.v);
@@ -97,9 +97,7 @@ static inline uint64_t mod_p36(uint64_t a) {
 
 
 /** Initializes the MAC state with the unpacked key data */
-static fastd_mac_state_t * uhash_init(const uint8_t *key) {
-	fastd_mac_state_t *state = fastd_new(fastd_mac_state_t);
-
+static void uhash_init(fastd_mac_state_t *state, const uint8_t *key) {
 	const uint32_t *key32 = (const uint32_t *)key;
 	size_t i;
 
@@ -120,8 +118,6 @@ static fastd_mac_state_t * uhash_init(const uint8_t *key) {
 
 	for (i = 0; i < array_size(state->L3Key2); i++)
 		state->L3Key2[i] = be32toh(*(key32++));
-
-	return state;
 }
 
 
@@ -287,17 +283,16 @@ static bool uhash_digest(const fastd_mac_state_t *state, fastd_block128_t *out,
 	return true;
 }
 
-/** Frees the MAC state */
-static void uhash_free(fastd_mac_state_t *state) {
-	if (state) {
-		secure_memzero(state, sizeof(*state));
-		free(state);
-	}
+/** Wipes the MAC state */
+static void uhash_cleanup(fastd_mac_state_t *state) {
+	secure_memzero(state, sizeof(*state));
 }
 
 /** The builtin UHASH implementation */
 const fastd_mac_t fastd_mac_uhash_builtin = {
+	.state_size = sizeof(fastd_mac_state_t),
+
 	.init = uhash_init,
 	.digest = uhash_digest,
-	.free = uhash_free,
+	.cleanup = uhash_cleanup,
 };
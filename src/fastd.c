@@ -38,6 +38,7 @@
 #include "async.h"
 #include "config.h"
 #include "crypto.h"
+#include "latency.h"
 #include "peer.h"
 #include "peer_hashtable.h"
 #include "poll.h"
@@ -147,10 +148,14 @@ static inline void init_log(void) {
 		openlog(conf.log_syslog_ident, LOG_PID, LOG_DAEMON);
 
 	ctx.log_initialized = true;
+
+	if (conf.log_async)
+		fastd_log_async_init();
 }
 
 /** Cleans up log destinations */
 static inline void close_log(void) {
+	fastd_log_async_stop();
 	closelog();
 }
 
@@ -419,10 +424,9 @@ static inline void notify_systemd(void) {
 static inline void init_early(void) {
 	fastd_close_all_fds();
 
-	unsigned int seed;
-	fastd_random_bytes(&seed, sizeof(seed), false);
-	srandom(seed);
+	fastd_random_bytes(ctx.handshake_cookie_secret, sizeof(ctx.handshake_cookie_secret), false);
 
+	fastd_sha256_init();
 	fastd_cipher_init();
 	fastd_mac_init();
 }
@@ -479,6 +483,13 @@ static inline void init_config(int *status_fd) {
 	fastd_config_check();
 }
 
+/** Performs periodic maintenance tasks (the callback of the maintenance timer) */
+static void maintenance(fastd_timer_t *timer) {
+	fastd_socket_handle_binds();
+
+	fastd_timer_schedule(timer, timer->timeout + MAINTENANCE_INTERVAL);
+}
+
 /** Initializes fastd */
 static inline void init(int argc, char *argv[]) {
 	int status_fd = -1;
@@ -488,8 +499,9 @@ static inline void init(int argc, char *argv[]) {
 	init_config(&status_fd);
 
 	fastd_update_time();
-	ctx.next_maintenance = ctx.now + MAINTENANCE_INTERVAL;
-	ctx.unknown_handshakes[0].timeout = ctx.now;
+	fastd_timer_wheel_init();
+	fastd_timer_init(&ctx.maintenance_timer, maintenance);
+	fastd_timer_schedule(&ctx.maintenance_timer, ctx.now + MAINTENANCE_INTERVAL);
 
 #ifdef WITH_DYNAMIC_PEERS
 	fastd_sem_init(&ctx.verify_limit, VERIFY_LIMIT);
@@ -506,6 +518,7 @@ static inline void init(int argc, char *argv[]) {
 	ctx.started = ctx.now;
 
 	fastd_cap_init();
+	fastd_latency_init();
 
 	init_sockets();
 	fastd_status_init();
@@ -524,6 +537,7 @@ static inline void init(int argc, char *argv[]) {
 	write_pid();
 
 	fastd_peer_hashtable_init();
+	fastd_handshake_limit_init();
 
 	notify_systemd();
 
@@ -545,20 +559,13 @@ static inline void init(int argc, char *argv[]) {
 	else if (conf.drop_caps == DROP_CAPS_OFF)
 		set_user();
 
+	/* the worker threads are started after dropping privileges so they don't keep any capabilities */
+	fastd_worker_init();
+
 	fastd_config_load_peer_dirs();
 }
 
 
-/** Performs periodic maintenance tasks */
-static inline void maintenance(void) {
-	if (!fastd_timed_out(ctx.next_maintenance))
-		return;
-
-	fastd_socket_handle_binds();
-	fastd_peer_maintenance();
-
-	ctx.next_maintenance += MAINTENANCE_INTERVAL;
-}
 
 /** Reaps zombies of asynchronous shell commands. */
 static inline void reap_zombies(void) {
@@ -612,10 +619,9 @@ static inline void handle_signals(void) {
 
 /** A single iteration of fastd's main loop */
 static inline void run(void) {
-	fastd_peer_handle_handshake_queue();
+	fastd_timer_handle();
 	fastd_poll_handle();
 
-	maintenance();
 	handle_signals();
 }
 
@@ -638,6 +644,7 @@ static inline void cleanup(void) {
 	on_down();
 
 	delete_peers();
+	fastd_worker_cleanup();
 
 	fastd_tuntap_close();
 	fastd_status_close();
@@ -647,11 +654,15 @@ static inline void cleanup(void) {
 	on_post_down();
 
 	fastd_peer_hashtable_free();
+	fastd_handshake_limit_free();
+	fastd_latency_cleanup();
 
 	pthread_attr_destroy(&ctx.detached_thread);
 
 	VECTOR_FREE(ctx.async_pids);
 	VECTOR_FREE(ctx.peers);
+
+	fastd_peer_eth_addr_free_all();
 	VECTOR_FREE(ctx.eth_addrs);
 
 	free(ctx.protocol_state);
@@ -38,11 +38,15 @@
 
 #include "dlist.h"
 #include "buffer.h"
+#include "handshake_limit.h"
 #include "log.h"
 #include "sem.h"
+#include "sha256.h"
 #include "shell.h"
+#include "timer.h"
 #include "util.h"
 #include "vector.h"
+#include "worker.h"
 
 #include <errno.h>
 #include <fcntl.h>
@@ -129,6 +133,9 @@ struct fastd_protocol {
 
 	/** Creates a human-readable representation of the peer */
 	bool (*describe_peer)(const fastd_peer_t *peer, char *buf, size_t len);
+
+	/** Returns the memory used for cached precomputations (in bytes) */
+	size_t (*get_cache_size)(void);
 };
 
 /** An union storing an IPv4 or IPv6 address */
@@ -154,30 +161,47 @@ struct fastd_socket {
 };
 
 
-/** Type of a traffic stat counter */
+/** Type of a traffic stat counter (the counters updated for every packet come first) */
 typedef enum fastd_stat_type {
 	STAT_RX = 0,				/**< Reception statistics (total) */
-	STAT_RX_REORDERED,			/**< Reception statistics (reordered) */
 	STAT_TX,				/**< Transmission statistics (OK) */
+	STAT_RX_REORDERED,			/**< Reception statistics (reordered) */
 	STAT_TX_DROPPED,			/**< Transmission statistics (dropped because of full queues) */
 	STAT_TX_ERROR,				/**< Transmission statistics (other errors) */
 	STAT_MAX,				/**< (Number of defined stat types) */
 } fastd_stat_type_t;
 
+/** Reasons for dropping a packet that are not covered by the traffic statistics */
+typedef enum fastd_drop_reason {
+	DROP_REASON_UNKNOWN_PEER = 0,		/**< A packet was received from an unknown address */
+	DROP_REASON_INVALID_TYPE,		/**< A packet of an unknown type was received */
+	DROP_REASON_NO_SESSION,			/**< A payload packet was received from or should be sent to a peer without a valid session */
+	DROP_REASON_DECRYPT,			/**< A received payload packet couldn't be decrypted or authenticated */
+	DROP_REASON_DUPLICATE,			/**< A received payload packet was a duplicate */
+	DROP_REASON_TOO_OLD,			/**< A received payload packet was older than the reorder window */
+	DROP_REASON_TRUNCATED,			/**< An ethernet frame was shorter than its header */
+	DROP_REASON_INVALID_IP,			/**< A received payload packet had an invalid IP version in TUN mode */
+	DROP_REASON_ENCRYPT,			/**< A payload packet couldn't be encrypted */
+	DROP_REASON_MAX,			/**< (Number of defined drop reasons) */
+} fastd_drop_reason_t;
+
+/** The counters of a single traffic stat type */
+typedef struct fastd_stat_counter {
+	uint64_t packets;			/**< The number of packets transferred */
+	uint64_t bytes;				/**< The number of bytes transferred */
+} fastd_stat_counter_t;
+
 /** Some kind of network transfer statistics */
 struct fastd_stats {
 #ifdef WITH_STATUS_SOCKET
-	uint64_t packets[STAT_MAX];		/**< The number of packets transferred */
-	uint64_t bytes[STAT_MAX];		/**< The number of bytes transferred */
+	fastd_stat_counter_t counters[STAT_MAX]; /**< The traffic counters; packets and bytes of a type share a cache line */
+	uint64_t dropped[DROP_REASON_MAX];	/**< The number of packets dropped, by reason */
 #endif
 };
 
 
-/** A data structure keeping track of an unknown addresses that a handshakes was received from recently */
-struct fastd_handshake_timeout {
-	fastd_peer_address_t address;		/**< An address a handshake was received from */
-	fastd_timeout_t timeout;		/**< Timeout until handshakes from this address are ignored */
-};
+/** The length of a handshake cookie (period number and HMAC-SHA256) */
+#define HANDSHAKE_COOKIE_BYTES (4 + FASTD_SHA256_HASH_BYTES)
 
 
 /** The static configuration of \em fastd */
@@ -185,6 +209,7 @@ struct fastd_config {
 	fastd_loglevel_t log_stderr_level;	/**< The minimum loglevel of messages to print to stderr (or -1 to not print any messages on stderr) */
 	fastd_loglevel_t log_syslog_level;	/**< The minimum loglevel of messages to print to syslog (or -1 to not print any messages on syslog) */
 	char *log_syslog_ident;			/**< The identification string for messages sent to syslog (default: "fastd") */
+	bool log_async;				/**< Makes fastd format and write log messages in a background thread */
 
 	char *ifname;				/**< The configured interface name */
 
@@ -201,6 +226,12 @@ struct fastd_config {
 	bool forward;				/**< Specifies if packet forwarding is enable */
 	fastd_tristate_t pmtu;			/**< Can be set to explicitly enable or disable PMTU detection */
 	bool secure_handshakes;			/**< Can be set to false to support connections with fastd versions before v11 */
+	unsigned handshake_rate;		/**< The maximum number of handshakes per second initiated by fastd */
+	unsigned handshake_burst;		/**< The capacity of the handshake rate limit's token bucket, i.e. the number of handshakes that may be initiated back-to-back before handshake_rate applies */
+	unsigned handshake_workers;		/**< The number of worker threads performing the key derivation of handshakes */
+	unsigned handshake_cookie_threshold;	/**< The number of handshakes from unknown addresses per second above which cookies are required; 0 to disable */
+	unsigned handshake_resumption_window;	/**< The time (in seconds) sessions may be resumed after they have expired; 0 to disable resumption */
+	unsigned rtt_probe_interval;		/**< The interval (in seconds) RTT probes are sent to peers supporting them; 0 to disable RTT probes */
 
 	fastd_drop_caps_t drop_caps;		/**< Specifies if and when to drop capabilities */
 
@@ -243,6 +274,8 @@ struct fastd_config {
 
 #ifdef WITH_STATUS_SOCKET
 	char *status_socket;			/**< The path of the status socket */
+	char *metrics_socket;			/**< The path of the socket providing metrics in OpenMetrics format */
+	char *control_socket;			/**< The path of the socket accepting control commands (like packet captures) */
 #endif
 
 #ifdef __ANDROID__
@@ -264,6 +297,7 @@ struct fastd_config {
 /** The dynamic state of \em fastd */
 struct fastd_context {
 	bool log_initialized;			/**< true if the logging facilities have been properly initialized */
+	fastd_log_ring_t *log_ring;		/**< The queue of the asynchronous logging thread (or NULL if messages are logged synchronously) */
 
 	char *ifname;				/**< The actual interface name */
 
@@ -286,6 +320,10 @@ struct fastd_context {
 
 #ifdef WITH_STATUS_SOCKET
 	int status_fd;				/**< The file descriptor of the status socket */
+	int metrics_fd;				/**< The file descriptor of the metrics socket */
+	int control_fd;				/**< The file descriptor of the control socket */
+	fastd_capture_t *capture;		/**< The active packet capture (or NULL) */
+	VECTOR(fastd_subscriber_t *) subscribers; /**< The clients subscribed to the event stream of the control socket */
 #endif
 
 	bool has_floating;			/**< Specifies if any of the configured peers have floating remotes */
@@ -295,14 +333,23 @@ struct fastd_context {
 	size_t peer_addr_ht_used;		/**< The current number of entries in the peer address hashtable */
 	VECTOR(fastd_peer_t *) *peer_addr_ht;	/**< An array of hash buckets for the peer hash table */
 
-	fastd_dlist_head_t handshake_queue;	/**< A doubly linked list of the peers currently queued for handshakes (ordered by the time of the next handshake) */
-	fastd_timeout_t next_maintenance;	/**< The time of the next maintenance call */
+	fastd_timer_wheel_t timer_wheel;	/**< The timer wheel used to schedule all time-driven tasks */
+	fastd_timer_t maintenance_timer;	/**< The timer for the periodic maintenance tasks */
+
+	int64_t handshake_tokens;		/**< The number of handshakes (in 1/1000) that may be initiated before the handshake rate limit is reached */
+	fastd_timeout_t handshake_tokens_update; /**< The last time handshake_tokens was refilled */
+	int64_t handshake_next_deferred;	/**< The time (in microseconds) the next handshake postponed by the handshake rate limit is scheduled for */
+
+	uint32_t handshake_cookie_secret[FASTD_HMACSHA256_KEY_WORDS]; /**< The secret used to generate handshake cookies */
+	unsigned handshake_load;		/**< The number of handshakes from unknown addresses handled in the current second */
+	fastd_timeout_t handshake_load_period;	/**< The end of the second handshake_load refers to */
 
 	VECTOR(pid_t) async_pids;		/**< PIDs of asynchronously executed commands which still have to be reaped */
 	int async_rfd;				/**< The read side of the pipe used to send data from other threads to the main thread */
 	int async_wfd;				/**< The write side of the pipe used to send data from other threads to the main thread */
 
 	pthread_attr_t detached_thread;		/**< pthread_attr_t for creating detached threads */
+	fastd_worker_pool_t worker_pool;	/**< The worker threads performing CPU-intensive tasks */
 
 	int tunfd;				/**< The file descriptor of the tunnel interface */
 
@@ -317,11 +364,16 @@ struct fastd_context {
 	fastd_socket_t *sock_default_v6;	/**< Points to the socket that is used for new outgoing IPv6 connections */
 
 	fastd_stats_t stats;			/**< Traffic statistics */
+	uint64_t handshakes_sent;		/**< The number of handshake packets sent */
+	uint64_t handshakes_received;		/**< The number of handshake packets received */
 
-	VECTOR(fastd_peer_eth_addr_t) eth_addrs; /**< Sorted vector of all known ethernet addresses with associated peers and timeouts */
+#ifdef WITH_LATENCY_HISTOGRAMS
+	fastd_latency_t *latency;		/**< The state of the data path latency instrumentation */
+#endif
 
-	size_t unknown_handshake_pos;		/**< Current start position in the ring buffer unknown_handshakes */
-	fastd_handshake_timeout_t unknown_handshakes[8]; /**< Ring buffer of unknown addresses handshakes have been received from */
+	VECTOR(fastd_peer_eth_addr_t *) eth_addrs; /**< Sorted vector of all known ethernet addresses with associated peers and timeouts */
+
+	fastd_handshake_limit_t handshake_limit; /**< The rate limit for handshakes sent to unknown addresses */
 
 	fastd_protocol_state_t *protocol_state;	/**< Protocol-specific state */
 };
@@ -369,11 +421,31 @@ void fastd_cap_drop(void);
 
 void fastd_random_bytes(void *buffer, size_t len, bool secure);
 
+/** The peer events reported to the subscribers of the control socket */
+typedef enum fastd_status_event {
+	STATUS_EVENT_ESTABLISHED,		/**< A connection has been established */
+	STATUS_EVENT_DISESTABLISHED,		/**< A connection has been disestablished */
+	STATUS_EVENT_SESSION_REFRESHED,		/**< A new session has been established with an already connected peer */
+	STATUS_EVENT_ADDRESS_CHANGED,		/**< The address of a connected peer has changed */
+	STATUS_EVENT_MAX,			/**< (Number of events) */
+} fastd_status_event_t;
+
 #ifdef WITH_STATUS_SOCKET
 
 void fastd_status_init(void);
 void fastd_status_close(void);
 void fastd_status_handle(void);
+void fastd_status_handle_metrics(void);
+void fastd_status_handle_control(void);
+void fastd_status_handle_subscription(fastd_subscriber_t *subscriber);
+void fastd_status_emit_event(fastd_status_event_t event, const fastd_peer_t *peer);
+bool fastd_status_client_closed(int fd, int timeout);
+
+/** Reports a peer event to the subscribers of the control socket (if there are any) */
+static inline void fastd_status_event(fastd_status_event_t event, const fastd_peer_t *peer) {
+	if (VECTOR_LEN(ctx.subscribers))
+		fastd_status_emit_event(event, peer);
+}
 
 #else
 
@@ -383,12 +455,16 @@ static inline void fastd_status_init(void) {
 static inline void fastd_status_close(void) {
 }
 
+static inline void fastd_status_event(UNUSED fastd_status_event_t event, UNUSED const fastd_peer_t *peer) {
+}
+
 #endif
 
 
 /** Returns a random number between \a min (inclusively) and \a max (exclusively) */
 static inline int fastd_rand(int min, int max) {
-	unsigned int r = (unsigned int)random();
+	uint32_t r;
+	fastd_random_bytes(&r, sizeof(r), false);
 	return (r%(max-min) + min);
 }
 
@@ -504,12 +580,17 @@ static inline bool fastd_timed_out(fastd_timeout_t timeout) {
 	return timeout <= ctx.now;
 }
 
-/** Updates the current time */
-static inline void fastd_update_time(void) {
+/** Returns the current time in milliseconds (unlike ctx.now, this may be used in worker threads) */
+static inline int64_t fastd_get_time(void) {
 	struct timespec ts;
 	clock_gettime(CLOCK_MONOTONIC, &ts);
 
-	ctx.now = (1000*(int64_t)ts.tv_sec) + ts.tv_nsec/1000000;
+	return (1000*(int64_t)ts.tv_sec) + ts.tv_nsec/1000000;
+}
+
+/** Updates the current time */
+static inline void fastd_update_time(void) {
+	ctx.now = fastd_get_time();
 }
 
 /** Checks if a on-verify command is set */
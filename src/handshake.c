@@ -31,8 +31,10 @@
 
 
 #include "handshake.h"
+#include "crypto.h"
 #include "method.h"
 #include "peer.h"
+#include "trace.h"
 #include <fastd_version.h>
 
 
@@ -54,6 +56,11 @@ static const char *const RECORD_TYPES[RECORD_MAX] = {
 	"version name",
 	"method list",
 	"TLV message authentication code",
+	"handshake cookie",
+	"resumption identifier",
+	"sender resumption nonce",
+	"recipient resumption nonce",
+	"RTT probe support",
 };
 
 
@@ -176,6 +183,7 @@ static fastd_handshake_buffer_t new_handshake(uint8_t type, bool little_endian,
 		.buffer = fastd_buffer_alloc(sizeof(fastd_handshake_packet_t), 1,
 					     3*5 +               /* handshake type, mode, reply code */
 					     6 +                 /* MTU */
+					     4 +                 /* RTT probe support */
 					     4+version_len +     /* version name */
 					     4+protocol_len +    /* protocol name */
 					     4+method_len +      /* method name */
@@ -190,6 +198,7 @@ static fastd_handshake_buffer_t new_handshake(uint8_t type, bool little_endian,
 	fastd_handshake_add_uint8(&buffer, RECORD_HANDSHAKE_TYPE, type);
 	fastd_handshake_add_uint8(&buffer, RECORD_MODE, conf.mode);
 	fastd_handshake_add_uint16_endian(&buffer, RECORD_MTU, conf.mtu);
+	fastd_handshake_add(&buffer, RECORD_RTT_PROBE, 0, NULL);
 
 	fastd_handshake_add(&buffer, RECORD_VERSION_NAME, version_len, FASTD_VERSION);
 	fastd_handshake_add(&buffer, RECORD_PROTOCOL_NAME, protocol_len, conf.protocol->name);
@@ -205,9 +214,23 @@ static fastd_handshake_buffer_t new_handshake(uint8_t type, bool little_endian,
 	return buffer;
 }
 
-/** Allocates and initializes a new initial handshake packet */
-fastd_handshake_buffer_t fastd_handshake_new_init(size_t tail_space) {
-	return new_handshake(1, true, NULL, conf.secure_handshakes ? NULL : conf.peer_group->methods, tail_space);
+/**
+   Allocates and initializes a new initial handshake packet
+
+   The handshake contains a cookie record to signal support for handshake cookies; if
+   a valid cookie has been received from the given remote address before, it is echoed back.
+*/
+fastd_handshake_buffer_t fastd_handshake_new_init(const fastd_peer_address_t *remote_addr, const fastd_peer_t *peer, size_t tail_space) {
+	fastd_handshake_buffer_t buffer = new_handshake(1, true, NULL, conf.secure_handshakes ? NULL : conf.peer_group->methods,
+							4+HANDSHAKE_COOKIE_BYTES + tail_space);
+
+	if (peer && !fastd_timed_out(peer->handshake_cookie_timeout)
+	    && fastd_peer_address_equal(&peer->handshake_cookie_address, remote_addr))
+		fastd_handshake_add(&buffer, RECORD_COOKIE, HANDSHAKE_COOKIE_BYTES, peer->handshake_cookie);
+	else
+		fastd_handshake_add(&buffer, RECORD_COOKIE, 0, NULL);
+
+	return buffer;
 }
 
 /** Allocates and initializes a new reply handshake packet */
@@ -284,6 +307,138 @@ static void send_error(fastd_socket_t *sock, const fastd_peer_address_t *local_a
 	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
 }
 
+/**
+   Computes the handshake cookie for a given cookie period, remote address and sender key
+
+   The cookie consists of the period number and a HMAC of the period number, the
+   address and the key, so it can be verified without keeping any state.
+*/
+static void generate_cookie(uint8_t cookie[HANDSHAKE_COOKIE_BYTES], uint32_t period, const fastd_peer_address_t *remote_addr, const fastd_handshake_record_t *sender_key) {
+	uint32_t in[2 + 4 + 8] = { htonl(period) };
+	uint8_t *addr = (uint8_t *)&in[2], *key = (uint8_t *)&in[6];
+
+	switch (remote_addr->sa.sa_family) {
+	case AF_INET:
+		in[1] = htonl(AF_INET << 16 | ntohs(remote_addr->in.sin_port));
+		memcpy(addr, &remote_addr->in.sin_addr, sizeof(remote_addr->in.sin_addr));
+		break;
+
+	case AF_INET6:
+		in[1] = htonl(AF_INET6 << 16 | ntohs(remote_addr->in6.sin6_port));
+		memcpy(addr, &remote_addr->in6.sin6_addr, sizeof(remote_addr->in6.sin6_addr));
+		break;
+
+	default:
+		exit_bug("generate_cookie: unknown address family");
+	}
+
+	memcpy(key, sender_key->data, min_size_t(sender_key->length, 8*sizeof(uint32_t)));
+
+	fastd_sha256_t mac;
+	fastd_hmacsha256(&mac, ctx.handshake_cookie_secret, in, sizeof(in));
+
+	memcpy(cookie, &in[0], 4);
+	memcpy(cookie+4, mac.b, FASTD_SHA256_HASH_BYTES);
+}
+
+/** Checks if a handshake contains a valid cookie for the address it was received from */
+static bool verify_cookie(const fastd_peer_address_t *remote_addr, const fastd_handshake_t *handshake) {
+	const fastd_handshake_record_t *cookie = &handshake->records[RECORD_COOKIE];
+
+	if (cookie->length != HANDSHAKE_COOKIE_BYTES)
+		return false;
+
+	uint32_t period = ctx.now / HANDSHAKE_COOKIE_PERIOD;
+	uint32_t cookie_period = as_uint32(cookie);
+
+	if (cookie_period != period && cookie_period != period-1)
+		return false;
+
+	uint8_t expected[HANDSHAKE_COOKIE_BYTES];
+	generate_cookie(expected, cookie_period, remote_addr, &handshake->records[RECORD_SENDER_KEY]);
+
+	return secure_memequal(expected, cookie->data, HANDSHAKE_COOKIE_BYTES);
+}
+
+/** Sends a cookie reply to an initial handshake */
+static void send_cookie(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, const fastd_handshake_t *handshake) {
+	fastd_handshake_buffer_t buffer = {
+		.buffer = fastd_buffer_alloc(sizeof(fastd_handshake_packet_t), 0, 2*5 + 4+HANDSHAKE_COOKIE_BYTES),
+		.little_endian = handshake->little_endian
+	};
+	fastd_handshake_packet_t *reply = buffer.buffer.data;
+
+	reply->rsv = 0;
+	reply->tlv_len = 0;
+
+	fastd_handshake_add_uint8(&buffer, RECORD_HANDSHAKE_TYPE, 2);
+	fastd_handshake_add_uint8(&buffer, RECORD_REPLY_CODE, REPLY_COOKIE_REQUIRED);
+
+	uint8_t *cookie = fastd_handshake_extend(&buffer, RECORD_COOKIE, HANDSHAKE_COOKIE_BYTES);
+	generate_cookie(cookie, ctx.now / HANDSHAKE_COOKIE_PERIOD, remote_addr, &handshake->records[RECORD_SENDER_KEY]);
+
+	fastd_send_handshake(sock, local_addr, remote_addr, NULL, buffer.buffer);
+}
+
+/**
+   Decides if an initial handshake from an unknown address may be handled
+
+   As long as less than conf.handshake_cookie_threshold such handshakes have been handled in the
+   current second, all handshakes are accepted. Above the threshold, a handshake must carry a
+   valid cookie; senders which signal cookie support are sent a cookie, handshakes of
+   fastd versions without cookie support are ignored.
+*/
+static bool check_cookie(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, const fastd_handshake_t *handshake) {
+	if (!conf.handshake_cookie_threshold)
+		return true;
+
+	if (fastd_timed_out(ctx.handshake_load_period)) {
+		ctx.handshake_load = 0;
+		ctx.handshake_load_period = ctx.now + 1000;
+	}
+
+	if (ctx.handshake_load >= conf.handshake_cookie_threshold && !verify_cookie(remote_addr, handshake)) {
+		if (handshake->records[RECORD_COOKIE].data) {
+			pr_debug("high handshake load, sending cookie to %I", remote_addr);
+			send_cookie(sock, local_addr, remote_addr, handshake);
+		}
+		else {
+			pr_debug("high handshake load, ignoring handshake without cookie support from %I", remote_addr);
+		}
+
+		return false;
+	}
+
+	ctx.handshake_load++;
+	return true;
+}
+
+/** Handles a cookie reply by repeating the initial handshake with the received cookie */
+static void handle_cookie_reply(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const fastd_handshake_t *handshake) {
+	const fastd_handshake_record_t *cookie = &handshake->records[RECORD_COOKIE];
+
+	if (!peer || handshake->type != 2 || cookie->length != HANDSHAKE_COOKIE_BYTES)
+		return;
+
+	if (fastd_timed_out(peer->last_handshake_timeout) || !fastd_peer_address_equal(&peer->last_handshake_address, remote_addr)) {
+		pr_debug("received unexpected handshake cookie from %P[%I]", peer, remote_addr);
+		return;
+	}
+
+	/* Cookie replies are unauthenticated, so only a single retry is allowed for each handshake sent */
+	if (peer->handshake_cookie_retried)
+		return;
+
+	peer->handshake_cookie_retried = true;
+
+	memcpy(peer->handshake_cookie, cookie->data, HANDSHAKE_COOKIE_BYTES);
+	peer->handshake_cookie_address = *remote_addr;
+	peer->handshake_cookie_timeout = ctx.now + HANDSHAKE_COOKIE_PERIOD;
+
+	pr_verbose("received handshake cookie from %P[%I], repeating handshake", peer, remote_addr);
+	conf.protocol->handshake_init(sock, local_addr, remote_addr, peer);
+}
+
 /** Parses the TLV records of a handshake */
 static inline fastd_handshake_t parse_tlvs(const fastd_buffer_t *buffer) {
 	fastd_handshake_t handshake = {};
@@ -381,7 +536,15 @@ static inline bool check_records(fastd_socket_t *sock, const fastd_peer_address_
 			return false;
 		}
 
-		if (as_uint8(&handshake->records[RECORD_REPLY_CODE]) != REPLY_SUCCESS) {
+		switch (as_uint8(&handshake->records[RECORD_REPLY_CODE])) {
+		case REPLY_SUCCESS:
+			break;
+
+		case REPLY_COOKIE_REQUIRED:
+			handle_cookie_reply(sock, local_addr, remote_addr, peer, handshake);
+			return false;
+
+		default:
 			print_error_reply(remote_addr, handshake);
 			return false;
 		}
@@ -435,6 +598,8 @@ void fastd_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *lo
 	char *peer_version = NULL;
 	const fastd_method_info_t *method = NULL;
 
+	ctx.handshakes_received++;
+
 	fastd_handshake_t handshake = parse_tlvs(&buffer);
 
 	if (!handshake.tlv_data) {
@@ -448,10 +613,14 @@ void fastd_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *lo
 	}
 
 	handshake.type = as_uint8(&handshake.records[RECORD_HANDSHAKE_TYPE]);
+	fastd_trace_handshake_received(peer, buffer.len, handshake.type);
 
 	if (!check_records(sock, local_addr, remote_addr, peer, &handshake))
 		goto end_free;
 
+	if (handshake.type == 1 && !peer && !check_cookie(sock, local_addr, remote_addr, &handshake))
+		goto end_free;
+
 	if (!conf.secure_handshakes || handshake.type > 1) {
 		method = get_method(fastd_peer_get_methods(peer), &handshake);
 
@@ -57,6 +57,11 @@ typedef enum fastd_handshake_record_type {
 	RECORD_VERSION_NAME,		/**< The fastd version */
 	RECORD_METHOD_LIST,		/**< Zero-separated list of supported methods */
 	RECORD_TLV_MAC,			/**< Message authentication code of the TLV records */
+	RECORD_COOKIE,			/**< Handshake cookie (empty to signal cookie support) */
+	RECORD_RESUMPTION_ID,		/**< Identifier of the resumption secret a session is resumed with */
+	RECORD_SENDER_RESUMPTION_NONCE,	/**< Sender nonce of a session resumption */
+	RECORD_RECIPIENT_RESUMPTION_NONCE, /**< Recipient nonce of a session resumption */
+	RECORD_RTT_PROBE,		/**< RTT probe support (empty) */
 	RECORD_MAX,			/**< (Number of defined record types) */
 } fastd_handshake_record_type_t;
 
@@ -65,6 +70,7 @@ typedef enum fastd_reply_code {
 	REPLY_SUCCESS = 0,		/**< The handshake was sucessfull */
 	REPLY_MANDATORY_MISSING,	/**< A required TLV field is missing */
 	REPLY_UNACCEPTABLE_VALUE,	/**< A TLV field has an invalid value */
+	REPLY_COOKIE_REQUIRED,		/**< The handshake must be repeated with the supplied cookie */
 	REPLY_MAX,			/**< (Number of defined reply codes */
 } fastd_reply_code_t;
 
@@ -99,7 +105,7 @@ struct fastd_handshake_buffer {
 };
 
 
-fastd_handshake_buffer_t fastd_handshake_new_init(size_t tail_space);
+fastd_handshake_buffer_t fastd_handshake_new_init(const fastd_peer_address_t *remote_addr, const fastd_peer_t *peer, size_t tail_space);
 fastd_handshake_buffer_t fastd_handshake_new_reply(uint8_t type, bool little_endian, const fastd_method_info_t *method, const fastd_string_stack_t *methods, size_t tail_space);
 
 void fastd_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer);
@@ -0,0 +1,200 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Rate limit for handshakes sent to unknown addresses
+*/
+
+
+#include "handshake_limit.h"
+#include "fastd.h"
+#include "hash.h"
+#include "peer.h"
+
+
+/** The number of entries in each set of the token bucket table */
+#define HANDSHAKE_LIMIT_WAYS 4
+
+
+/** A token bucket for a single address or prefix */
+struct fastd_handshake_limit_entry {
+	fastd_peer_address_t key;		/**< The address or prefix (with port 0) */
+	bool prefix;				/**< true if the entry refers to a prefix */
+	int64_t tokens;				/**< The number of tokens in the bucket */
+	fastd_timeout_t updated;		/**< The last time the bucket was refilled */
+};
+
+
+/** Initializes the rate limit table */
+void fastd_handshake_limit_init(void) {
+	fastd_random_bytes(&ctx.handshake_limit.seed, sizeof(ctx.handshake_limit.seed), false);
+	ctx.handshake_limit.entries = fastd_new0_array(HANDSHAKE_LIMIT_SIZE, fastd_handshake_limit_entry_t);
+
+	ctx.handshake_limit.tokens = 1000 * (int64_t)UNKNOWN_HANDSHAKE_RATE;
+	ctx.handshake_limit.updated = ctx.now;
+}
+
+/** Frees the rate limit table */
+void fastd_handshake_limit_free(void) {
+	free(ctx.handshake_limit.entries);
+	ctx.handshake_limit.entries = NULL;
+}
+
+/** Returns the /24 (IPv4) or /64 (IPv6) prefix of an address */
+static fastd_peer_address_t get_prefix(const fastd_peer_address_t *addr) {
+	fastd_peer_address_t prefix = {};
+	prefix.sa.sa_family = addr->sa.sa_family;
+
+	switch (addr->sa.sa_family) {
+	case AF_INET:
+		prefix.in.sin_addr.s_addr = addr->in.sin_addr.s_addr & htonl(0xffffff00);
+		break;
+
+	case AF_INET6:
+		memcpy(&prefix.in6.sin6_addr, &addr->in6.sin6_addr, 8);
+		if (IN6_IS_ADDR_LINKLOCAL(&addr->in6.sin6_addr))
+			prefix.in6.sin6_scope_id = addr->in6.sin6_scope_id;
+		break;
+
+	default:
+		exit_bug("get_prefix: unknown address family");
+	}
+
+	return prefix;
+}
+
+/** Returns the first entry of the table set used for an address or prefix */
+static fastd_handshake_limit_entry_t * get_set(const fastd_peer_address_t *key, bool prefix) {
+	uint32_t hash = ctx.handshake_limit.seed;
+	uint8_t prefix_flag = prefix;
+
+	fastd_hash(&hash, &prefix_flag, sizeof(prefix_flag));
+
+	switch (key->sa.sa_family) {
+	case AF_INET:
+		fastd_hash(&hash, &key->in.sin_addr.s_addr, sizeof(key->in.sin_addr.s_addr));
+		fastd_hash(&hash, &key->in.sin_port, sizeof(key->in.sin_port));
+		break;
+
+	case AF_INET6:
+		fastd_hash(&hash, &key->in6.sin6_addr, sizeof(key->in6.sin6_addr));
+		fastd_hash(&hash, &key->in6.sin6_port, sizeof(key->in6.sin6_port));
+		break;
+
+	default:
+		exit_bug("get_set: unknown address family");
+	}
+
+	fastd_hash_final(&hash);
+
+	size_t n_sets = HANDSHAKE_LIMIT_SIZE / HANDSHAKE_LIMIT_WAYS;
+	return &ctx.handshake_limit.entries[(hash % n_sets) * HANDSHAKE_LIMIT_WAYS];
+}
+
+/**
+   Refills a token bucket
+
+   A bucket allows \e burst handshakes per \e period milliseconds; each handshake takes
+   \e period tokens.
+*/
+static void refill(int64_t *tokens, fastd_timeout_t *updated, unsigned burst, int64_t period) {
+	*tokens += (ctx.now - *updated) * burst;
+	*updated = ctx.now;
+
+	if (*tokens > burst * period)
+		*tokens = burst * period;
+}
+
+/**
+   Finds the token bucket for an address or prefix and refills it
+
+   If there is no entry for the key, the least recently used entry of the set (except \e keep) is replaced.
+*/
+static fastd_handshake_limit_entry_t * get_entry(const fastd_peer_address_t *key, bool prefix, unsigned burst, int64_t period, const fastd_handshake_limit_entry_t *keep) {
+	fastd_handshake_limit_entry_t *set = get_set(key, prefix), *lru = NULL;
+
+	size_t i;
+	for (i = 0; i < HANDSHAKE_LIMIT_WAYS; i++) {
+		fastd_handshake_limit_entry_t *entry = &set[i];
+
+		if (entry->prefix == prefix && fastd_peer_address_equal(&entry->key, key)) {
+			refill(&entry->tokens, &entry->updated, burst, period);
+			return entry;
+		}
+
+		if (entry == keep)
+			continue;
+
+		if (!lru || entry->key.sa.sa_family == AF_UNSPEC
+		    || (lru->key.sa.sa_family != AF_UNSPEC && entry->updated < lru->updated))
+			lru = entry;
+	}
+
+	lru->key = *key;
+	lru->prefix = prefix;
+	lru->tokens = burst * period;
+	lru->updated = ctx.now;
+
+	return lru;
+}
+
+/**
+   Checks if a handshake may be sent to an unknown address
+
+   If all token buckets allow it, a token is taken from each of them.
+*/
+bool fastd_handshake_limit_take(const fastd_peer_address_t *addr) {
+	const fastd_peer_address_t prefix_key = get_prefix(addr);
+
+	fastd_handshake_limit_entry_t *address = get_entry(addr, false, 1, MIN_HANDSHAKE_INTERVAL, NULL);
+	fastd_handshake_limit_entry_t *prefix = get_entry(&prefix_key, true, UNKNOWN_HANDSHAKE_PREFIX_BURST, MIN_HANDSHAKE_INTERVAL, address);
+	refill(&ctx.handshake_limit.tokens, &ctx.handshake_limit.updated, UNKNOWN_HANDSHAKE_RATE, 1000);
+
+	fastd_handshake_limit_reason_t reason;
+
+	if (address->tokens < MIN_HANDSHAKE_INTERVAL) {
+		reason = HANDSHAKE_LIMIT_ADDRESS;
+	}
+	else if (prefix->tokens < MIN_HANDSHAKE_INTERVAL) {
+		reason = HANDSHAKE_LIMIT_PREFIX;
+	}
+	else if (ctx.handshake_limit.tokens < 1000) {
+		reason = HANDSHAKE_LIMIT_GLOBAL;
+	}
+	else {
+		address->tokens -= MIN_HANDSHAKE_INTERVAL;
+		prefix->tokens -= MIN_HANDSHAKE_INTERVAL;
+		ctx.handshake_limit.tokens -= 1000;
+
+		ctx.handshake_limit.sent++;
+		return true;
+	}
+
+	ctx.handshake_limit.dropped[reason]++;
+	pr_debug2("not sending a handshake to unknown address %I (rate limit)", addr);
+	return false;
+}
@@ -0,0 +1,69 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Rate limit for handshakes sent to unknown addresses
+
+   When payload data is received from an unknown address, a handshake is sent to establish a new
+   connection. To avoid flooding hosts with handshakes (and to avoid being used for reflection attacks),
+   these handshakes are limited by token buckets for the source address, for its /24 (IPv4) or /64 (IPv6) prefix,
+   and globally. The per-address and per-prefix buckets are kept in a fixed-size set-associative hash table.
+*/
+
+
+#pragma once
+
+#include "types.h"
+
+
+/** The reasons a handshake to an unknown address may be suppressed */
+typedef enum fastd_handshake_limit_reason {
+	HANDSHAKE_LIMIT_ADDRESS = 0,		/**< The per-address limit was reached */
+	HANDSHAKE_LIMIT_PREFIX,			/**< The per-prefix limit was reached */
+	HANDSHAKE_LIMIT_GLOBAL,			/**< The global limit was reached */
+	HANDSHAKE_LIMIT_MAX,			/**< (Number of defined reasons) */
+} fastd_handshake_limit_reason_t;
+
+typedef struct fastd_handshake_limit_entry fastd_handshake_limit_entry_t;
+
+/** The state of the unknown address handshake rate limit */
+struct fastd_handshake_limit {
+	uint32_t seed;				/**< The hash seed used for the table */
+	fastd_handshake_limit_entry_t *entries;	/**< The table of per-address and per-prefix token buckets */
+
+	int64_t tokens;				/**< The tokens of the global token bucket */
+	fastd_timeout_t updated;		/**< The last time the global token bucket was refilled */
+
+	uint64_t sent;				/**< The number of handshakes allowed by the rate limit */
+	uint64_t dropped[HANDSHAKE_LIMIT_MAX];	/**< The number of handshakes suppressed, by reason */
+};
+
+
+void fastd_handshake_limit_init(void);
+void fastd_handshake_limit_free(void);
+
+bool fastd_handshake_limit_take(const fastd_peer_address_t *addr);
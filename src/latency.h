@@ -0,0 +1,264 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Data path latency instrumentation
+
+   When fastd is built with WITH_LATENCY_HISTOGRAMS, the payload path is timestamped at
+   its stage boundaries (TUN read, encryption, sendmsg(); recvmsg(), decryption, TUN write)
+   and the stage latencies are collected in histograms with power-of-two nanosecond buckets.
+   The time spent in the encrypt and decrypt functions of each method is summed up in CPU
+   timestamp counter ticks.
+
+   The payload path is handled synchronously by the main thread, so the timestamps of the
+   packet currently in flight can simply be kept in the global state. Without
+   WITH_LATENCY_HISTOGRAMS, all functions of this header are empty.
+*/
+
+
+#pragma once
+
+#include "method.h"
+
+
+/** The stages of the payload path latencies are collected for */
+typedef enum fastd_latency_stage {
+	LATENCY_TX_ENCRYPT = 0,		/**< TUN/TAP read to encrypted packet */
+	LATENCY_TX_SEND,		/**< Encrypted packet to return of sendmsg() */
+	LATENCY_TX_TOTAL,		/**< TUN/TAP read to return of sendmsg() */
+	LATENCY_RX_DECRYPT,		/**< Return of recvmsg() to decrypted packet */
+	LATENCY_RX_WRITE,		/**< Decrypted packet to TUN/TAP write */
+	LATENCY_RX_TOTAL,		/**< Return of recvmsg() to TUN/TAP write */
+	LATENCY_MAX,			/**< (Number of stages) */
+} fastd_latency_stage_t;
+
+/**
+   The number of buckets of a latency histogram
+
+   Bucket \e i counts the latencies of at most 2^i nanoseconds (and more than 2^(i-1)
+   nanoseconds); the last bucket counts all latencies above about 1s.
+*/
+#define LATENCY_BUCKETS 32
+
+
+/** A latency histogram */
+typedef struct fastd_latency_histogram {
+	uint64_t count;				/**< The number of samples */
+	uint64_t sum;				/**< The sum of all samples in nanoseconds */
+	uint64_t buckets[LATENCY_BUCKETS];	/**< The number of samples per bucket */
+} fastd_latency_histogram_t;
+
+/** The time spent in the encryption functions of a method */
+typedef struct fastd_latency_method {
+	uint64_t encrypt_calls;			/**< The number of calls of the method's encrypt function */
+	uint64_t encrypt_cycles;		/**< The timestamp counter ticks spent in the method's encrypt function */
+	uint64_t decrypt_calls;			/**< The number of calls of the method's decrypt function */
+	uint64_t decrypt_cycles;		/**< The timestamp counter ticks spent in the method's decrypt function */
+} fastd_latency_method_t;
+
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+
+/** The latency instrumentation state */
+struct fastd_latency {
+	int64_t tx_start;			/**< The time the packet currently sent has been read from the TUN/TAP device (or 0) */
+	int64_t tx_mark;			/**< The time the last TX stage of the current packet has ended */
+	int64_t rx_start;			/**< The time the packet currently received has been returned by recvmsg() (or 0) */
+	int64_t rx_mark;			/**< The time the last RX stage of the current packet has ended */
+
+	fastd_latency_histogram_t histograms[LATENCY_MAX]; /**< The histograms of all stages */
+	fastd_latency_method_t *methods;	/**< The encryption function timings, indexed like conf.methods */
+};
+
+
+void fastd_latency_init(void);
+void fastd_latency_cleanup(void);
+
+
+/** Returns a monotonic timestamp in nanoseconds */
+static inline int64_t fastd_latency_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return 1000000000*(int64_t)ts.tv_sec + ts.tv_nsec;
+}
+
+/**
+   Returns the CPU's timestamp counter
+
+   On architectures without a supported timestamp counter, nanoseconds are counted instead.
+*/
+static inline uint64_t fastd_latency_cycles(void) {
+#if defined(__x86_64__) || defined(__i386__)
+	return __builtin_ia32_rdtsc();
+#else
+	return fastd_latency_now();
+#endif
+}
+
+/** Adds a sample to the histogram of a stage */
+static inline void fastd_latency_record(fastd_latency_stage_t stage, int64_t latency) {
+	fastd_latency_histogram_t *histogram = &ctx.latency->histograms[stage];
+
+	if (latency < 0)
+		latency = 0;
+
+	size_t bucket = (latency > 1) ? 64 - __builtin_clzll(latency-1) : 0;
+	if (bucket >= LATENCY_BUCKETS)
+		bucket = LATENCY_BUCKETS-1;
+
+	histogram->count++;
+	histogram->sum += latency;
+	histogram->buckets[bucket]++;
+}
+
+/** Marks the start of the transmission of a packet read from the TUN/TAP device */
+static inline void fastd_latency_tx_start(void) {
+	ctx.latency->tx_start = ctx.latency->tx_mark = fastd_latency_now();
+}
+
+/** Marks the end of the transmission of a packet read from the TUN/TAP device */
+static inline void fastd_latency_tx_end(void) {
+	ctx.latency->tx_start = 0;
+}
+
+/**
+   Marks the end of the encryption of a packet
+
+   Packets sent to multiple peers are encrypted once for each peer; the encryption stage of
+   each copy starts when the previous one has been sent.
+*/
+static inline void fastd_latency_tx_encrypted(void) {
+	if (!ctx.latency->tx_start)
+		return;
+
+	int64_t now = fastd_latency_now();
+	fastd_latency_record(LATENCY_TX_ENCRYPT, now - ctx.latency->tx_mark);
+	ctx.latency->tx_mark = now;
+}
+
+/** Marks that an encrypted packet has been sent */
+static inline void fastd_latency_tx_sent(void) {
+	if (!ctx.latency->tx_start)
+		return;
+
+	int64_t now = fastd_latency_now();
+	fastd_latency_record(LATENCY_TX_SEND, now - ctx.latency->tx_mark);
+	fastd_latency_record(LATENCY_TX_TOTAL, now - ctx.latency->tx_start);
+	ctx.latency->tx_mark = now;
+}
+
+/** Marks that a packet has been returned by recvmsg() */
+static inline void fastd_latency_rx_start(void) {
+	ctx.latency->rx_start = ctx.latency->rx_mark = fastd_latency_now();
+}
+
+/** Marks the end of the handling of a packet returned by recvmsg() */
+static inline void fastd_latency_rx_end(void) {
+	ctx.latency->rx_start = 0;
+}
+
+/** Marks the end of the decryption of a received packet */
+static inline void fastd_latency_rx_decrypted(void) {
+	if (!ctx.latency->rx_start)
+		return;
+
+	int64_t now = fastd_latency_now();
+	fastd_latency_record(LATENCY_RX_DECRYPT, now - ctx.latency->rx_mark);
+	ctx.latency->rx_mark = now;
+}
+
+/** Marks that a received packet has been written to the TUN/TAP device */
+static inline void fastd_latency_rx_written(void) {
+	if (!ctx.latency->rx_start)
+		return;
+
+	int64_t now = fastd_latency_now();
+	fastd_latency_record(LATENCY_RX_WRITE, now - ctx.latency->rx_mark);
+	fastd_latency_record(LATENCY_RX_TOTAL, now - ctx.latency->rx_start);
+	ctx.latency->rx_mark = now;
+}
+
+/** Accounts a call of a method's encrypt function that has started at the timestamp counter value \a start */
+static inline void fastd_latency_encrypt(const fastd_method_info_t *method, uint64_t start) {
+	fastd_latency_method_t *m = &ctx.latency->methods[method - conf.methods];
+
+	m->encrypt_calls++;
+	m->encrypt_cycles += fastd_latency_cycles() - start;
+}
+
+/** Accounts a call of a method's decrypt function that has started at the timestamp counter value \a start */
+static inline void fastd_latency_decrypt(const fastd_method_info_t *method, uint64_t start) {
+	fastd_latency_method_t *m = &ctx.latency->methods[method - conf.methods];
+
+	m->decrypt_calls++;
+	m->decrypt_cycles += fastd_latency_cycles() - start;
+}
+
+#else
+
+static inline void fastd_latency_init(void) {
+}
+
+static inline void fastd_latency_cleanup(void) {
+}
+
+static inline uint64_t fastd_latency_cycles(void) {
+	return 0;
+}
+
+static inline void fastd_latency_tx_start(void) {
+}
+
+static inline void fastd_latency_tx_end(void) {
+}
+
+static inline void fastd_latency_tx_encrypted(void) {
+}
+
+static inline void fastd_latency_tx_sent(void) {
+}
+
+static inline void fastd_latency_rx_start(void) {
+}
+
+static inline void fastd_latency_rx_end(void) {
+}
+
+static inline void fastd_latency_rx_decrypted(void) {
+}
+
+static inline void fastd_latency_rx_written(void) {
+}
+
+static inline void fastd_latency_encrypt(UNUSED const fastd_method_info_t *method, UNUSED uint64_t start) {
+}
+
+static inline void fastd_latency_decrypt(UNUSED const fastd_method_info_t *method, UNUSED uint64_t start) {
+}
+
+#endif
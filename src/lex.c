@@ -66,9 +66,12 @@ static const keyword_t keywords[] = {
 	{ "async", TOK_ASYNC },
 	{ "auto", TOK_AUTO },
 	{ "bind", TOK_BIND },
+	{ "burst", TOK_BURST },
 	{ "capabilities", TOK_CAPABILITIES },
 	{ "cipher", TOK_CIPHER },
 	{ "connect", TOK_CONNECT },
+	{ "control", TOK_CONTROL },
+	{ "cookie", TOK_COOKIE },
 	{ "debug", TOK_DEBUG },
 	{ "debug2", TOK_DEBUG2 },
 	{ "default", TOK_DEFAULT },
@@ -83,11 +86,13 @@ static const keyword_t keywords[] = {
 	{ "forward", TOK_FORWARD },
 	{ "from", TOK_FROM },
 	{ "group", TOK_GROUP },
+	{ "handshake", TOK_HANDSHAKE },
 	{ "handshakes", TOK_HANDSHAKES },
 	{ "hide", TOK_HIDE },
 	{ "include", TOK_INCLUDE },
 	{ "info", TOK_INFO },
 	{ "interface", TOK_INTERFACE },
+	{ "interval", TOK_INTERVAL },
 	{ "ip", TOK_IP },
 	{ "ipv4", TOK_IPV4 },
 	{ "ipv6", TOK_IPV6 },
@@ -98,6 +103,7 @@ static const keyword_t keywords[] = {
 	{ "mac", TOK_MAC },
 	{ "mark", TOK_MARK },
 	{ "method", TOK_METHOD },
+	{ "metrics", TOK_METRICS },
 	{ "mode", TOK_MODE },
 	{ "mtu", TOK_MTU },
 	{ "no", TOK_NO },
@@ -109,8 +115,12 @@ static const keyword_t keywords[] = {
 	{ "port", TOK_PORT },
 	{ "post-down", TOK_POST_DOWN },
 	{ "pre-up", TOK_PRE_UP },
+	{ "probe", TOK_PROBE },
 	{ "protocol", TOK_PROTOCOL },
+	{ "rate", TOK_RATE },
 	{ "remote", TOK_REMOTE },
+	{ "resumption", TOK_RESUMPTION },
+	{ "rtt", TOK_RTT },
 	{ "secret", TOK_SECRET },
 	{ "secure", TOK_SECURE },
 	{ "socket", TOK_SOCKET },
@@ -119,6 +129,7 @@ static const keyword_t keywords[] = {
 	{ "sync", TOK_SYNC },
 	{ "syslog", TOK_SYSLOG },
 	{ "tap", TOK_TAP },
+	{ "threshold", TOK_THRESHOLD },
 	{ "to", TOK_TO },
 	{ "tun", TOK_TUN },
 	{ "up", TOK_UP },
@@ -127,6 +138,8 @@ static const keyword_t keywords[] = {
 	{ "verbose", TOK_VERBOSE },
 	{ "verify", TOK_VERIFY },
 	{ "warn", TOK_WARN },
+	{ "window", TOK_WINDOW },
+	{ "workers", TOK_WORKERS },
 	{ "yes", TOK_YES },
 };
 
@@ -107,17 +107,188 @@ static size_t snprint_peer_str(char *buffer, size_t size, const fastd_peer_t *pe
 	return snprintf_safe(buffer, size, "(null)");
 }
 
-/** vsnprintf-like function using different conversion specifiers */
-static int fastd_vsnprintf(char *buffer, size_t size, const char *format, va_list ap) {
+/** The maximum number of arguments of a log message (further arguments are cut off) */
+#define LOG_MAX_ARGS 8
+
+/** The size of the buffer for the string arguments of a log message */
+#define LOG_STRINGS_SIZE 512
+
+/** The number of log messages the asynchronous logging thread can queue */
+#define LOG_RING_SIZE 128
+
+
+/** An argument of a log message, copied so it can be formatted later */
+typedef struct log_arg {
+	bool null;				/**< Specifies if a pointer argument was NULL */
+	bool null_iface;			/**< Specifies if the interface argument of a %L conversion was NULL */
+	uint16_t str;				/**< The offset of the string argument (or the interface name of a %L conversion) in the strings buffer */
+
+	union {
+		int i;				/**< %i */
+		unsigned u;			/**< %u */
+		uint64_t U;			/**< %U */
+		const void *p;			/**< %p */
+		fastd_eth_addr_t eth_addr;	/**< %E */
+		fastd_peer_address_t addr;	/**< %I, %B and %L */
+	} v;					/**< The argument value */
+} log_arg_t;
+
+/** A log message with its unformatted arguments */
+typedef struct log_record {
+	fastd_loglevel_t level;			/**< The log level of the message */
+	time_t time;				/**< The time the message has been logged */
+	const char *format;			/**< The format string (which must be a literal) */
+
+	size_t n_args;				/**< The number of arguments */
+	log_arg_t args[LOG_MAX_ARGS];		/**< The arguments */
+
+	size_t strings_len;			/**< The used length of the strings buffer */
+	char strings[LOG_STRINGS_SIZE];		/**< The string arguments (%s, %P and the interface of %L) */
+} log_record_t;
+
+/** A slot of the log ring */
+typedef struct log_slot {
+	size_t seq;				/**< The position in the ring the slot can be written at (or position+1 when it has been filled) */
+	log_record_t record;			/**< The queued message */
+} log_slot_t;
+
+/**
+   The queue of the asynchronous logging thread
+
+   The queue is a bounded lock-free multi-producer ring buffer, so any thread can log messages. The
+   logging thread sleeps on a pipe while the ring is empty and is woken up by the first message.
+*/
+struct fastd_log_ring {
+	size_t tail;				/**< The next position to be reserved by a producer */
+	size_t head;				/**< The next position to be handled by the logging thread */
+	unsigned long dropped;			/**< The number of messages dropped because the ring was full (word-sized, so it can be updated lock-free on all targets) */
+	unsigned long reported;			/**< The number of dropped messages that have been reported */
+	time_t last_report;			/**< The time dropped messages have been reported last */
+
+	bool waiting;				/**< Set by the logging thread before it goes to sleep */
+	bool stop;				/**< Set to make the logging thread terminate */
+
+	int rfd;				/**< The read end of the wakeup pipe */
+	int wfd;				/**< The write end of the wakeup pipe */
+	pthread_t thread;			/**< The logging thread */
+
+	log_slot_t slots[LOG_RING_SIZE];	/**< The ring slots */
+};
+
+
+/** The ring of the asynchronous logging thread */
+static fastd_log_ring_t log_ring;
+
+
+/** Copies a string argument into a log record's strings buffer, truncating it if necessary */
+static uint16_t add_string(log_record_t *record, const char *str) {
+	size_t space = sizeof(record->strings) - record->strings_len;
+
+	/* the last byte of a full buffer terminates the last string */
+	if (!space)
+		return sizeof(record->strings) - 1;
+
+	size_t len = strnlen(str, space-1);
+	uint16_t offset = record->strings_len;
+
+	memcpy(record->strings + offset, str, len);
+	record->strings[offset + len] = 0;
+	record->strings_len += len + 1;
+
+	return offset;
+}
+
+/** Collects the arguments of a log message into a record */
+static void collect_args(log_record_t *record, const char *format, va_list ap) {
+	record->n_args = 0;
+	record->strings_len = 0;
+
+	for (; *format; format++) {
+		if (*format != '%')
+			continue;
+
+		if (record->n_args == LOG_MAX_ARGS)
+			return;
+
+		log_arg_t *arg = &record->args[record->n_args++];
+		const char *str;
+		const void *p;
+		char peer_str[128];
+
+		*arg = (log_arg_t){};
+
+		format++;
+
+		switch (*format) {
+		case 'i':
+			arg->v.i = va_arg(ap, int);
+			break;
+
+		case 'u':
+			arg->v.u = va_arg(ap, unsigned int);
+			break;
+
+		case 'U':
+			arg->v.U = va_arg(ap, uint64_t);
+			break;
+
+		case 's':
+			str = va_arg(ap, const char *);
+			arg->null = !str;
+			if (str)
+				arg->str = add_string(record, str);
+			break;
+
+		case 'p':
+			arg->v.p = va_arg(ap, void *);
+			break;
+
+		case 'E':
+			p = va_arg(ap, const fastd_eth_addr_t *);
+			arg->null = !p;
+			if (p)
+				arg->v.eth_addr = *(const fastd_eth_addr_t *)p;
+			break;
+
+		case 'P':
+			/* the peer may be gone when the message is formatted, so it is described right away */
+			p = va_arg(ap, const fastd_peer_t *);
+			snprint_peer_str(peer_str, sizeof(peer_str), p);
+			arg->str = add_string(record, peer_str);
+			break;
+
+		case 'I':
+		case 'B':
+		case 'L':
+			p = va_arg(ap, const fastd_peer_address_t *);
+			arg->null = !p;
+			if (p)
+				arg->v.addr = *(const fastd_peer_address_t *)p;
+
+			str = (*format == 'L') ? va_arg(ap, const char *) : NULL;
+			arg->null_iface = !str;
+			if (str)
+				arg->str = add_string(record, str);
+			break;
+
+		default:
+			/* the unknown conversion specifier is reported by format_record */
+			return;
+		}
+	}
+}
+
+/** snprintf-like function formatting a log record using fastd's conversion specifiers */
+static int format_record(char *buffer, size_t size, const log_record_t *record) {
 	char *buffer_start = buffer;
 	char *buffer_end = buffer+size;
+	const char *format = record->format;
+	size_t n_arg = 0;
 
 	*buffer = 0;
 
 	for (; *format; format++) {
-		const void *p;
-		const char *iface;
-		const fastd_eth_addr_t *eth_addr;
+		const log_arg_t *arg;
 
 		if (buffer >= buffer_end)
 			break;
@@ -130,31 +301,37 @@ static int fastd_vsnprintf(char *buffer, size_t size, const char *format, va_lis
 
 		format++;
 
+		/* messages with more than LOG_MAX_ARGS arguments are truncated */
+		if (n_arg == record->n_args && *format)
+			break;
+
+		arg = &record->args[n_arg++];
+
 		switch(*format) {
 		case 'i':
-			buffer += snprintf_safe(buffer, buffer_end-buffer, "%i", va_arg(ap, int));
+			buffer += snprintf_safe(buffer, buffer_end-buffer, "%i", arg->v.i);
 			break;
 
 		case 'u':
-			buffer += snprintf_safe(buffer, buffer_end-buffer, "%u", va_arg(ap, unsigned int));
+			buffer += snprintf_safe(buffer, buffer_end-buffer, "%u", arg->v.u);
 			break;
 
 		case 'U':
-			buffer += snprintf_safe(buffer, buffer_end-buffer, "%llu", (unsigned long long)va_arg(ap, uint64_t));
+			buffer += snprintf_safe(buffer, buffer_end-buffer, "%llu", (unsigned long long)arg->v.U);
 			break;
 
 		case 's':
-			buffer += snprintf_safe(buffer, buffer_end-buffer, "%s", va_arg(ap, char *));
+			buffer += snprintf_safe(buffer, buffer_end-buffer, "%s", arg->null ? "(null)" : record->strings + arg->str);
 			break;
 
 		case 'p':
-			buffer += snprintf_safe(buffer, buffer_end-buffer, "%p", va_arg(ap, void *));
+			buffer += snprintf_safe(buffer, buffer_end-buffer, "%p", arg->v.p);
 			break;
 
 		case 'E':
-			eth_addr = va_arg(ap, const fastd_eth_addr_t *);
+			if (!arg->null) {
+				const fastd_eth_addr_t *eth_addr = &arg->v.eth_addr;
 
-			if (eth_addr) {
 				if (conf.hide_mac_addresses)
 					buffer += snprintf_safe(buffer, buffer_end-buffer, "[hidden]");
 				else
@@ -168,24 +345,23 @@ static int fastd_vsnprintf(char *buffer, size_t size, const char *format, va_lis
 			break;
 
 		case 'P':
-			buffer += snprint_peer_str(buffer, buffer_end-buffer, va_arg(ap, const fastd_peer_t *));
+			buffer += snprintf_safe(buffer, buffer_end-buffer, "%s", record->strings + arg->str);
 			break;
 
 		case 'I':
 		case 'B':
 		case 'L':
-			p = va_arg(ap, const fastd_peer_address_t *);
-
-			iface = (*format == 'L') ? va_arg(ap, const char *) : NULL;
-
-			if (p)
-				buffer += fastd_snprint_peer_address(buffer, buffer_end-buffer, (const fastd_peer_address_t *)p, iface, *format != 'I', conf.hide_ip_addresses);
-			else
+			if (!arg->null) {
+				const char *iface = (*format == 'L' && !arg->null_iface) ? record->strings + arg->str : NULL;
+				buffer += fastd_snprint_peer_address(buffer, buffer_end-buffer, &arg->v.addr, iface, *format != 'I', conf.hide_ip_addresses);
+			}
+			else {
 				buffer += snprintf_safe(buffer, buffer_end-buffer, "(null)");
+			}
 			break;
 
 		default:
-			pr_warn("fastd_vsnprintf: unknown format conversion specifier '%c'", *format);
+			pr_warn("format_record: unknown format conversion specifier '%c'", *format);
 			*buffer_start = 0;
 			return -1;
 		}
@@ -237,34 +413,299 @@ static inline int get_syslog_level(fastd_loglevel_t log_level) {
 	}
 }
 
-/** printf-like function handling different conversion specifiers and using the configured log destinations */
-void fastd_logf(fastd_loglevel_t level, const char *format, ...) {
-	char buffer[1024];
-	char timestr[100] = "";
-	va_list ap;
+/** Checks if messages of a given log level are written to any log destination */
+bool fastd_log_enabled(fastd_loglevel_t level) {
+	return (!ctx.log_initialized || level <= conf.log_stderr_level || level <= conf.log_syslog_level);
+}
 
-	va_start(ap, format);
-	fastd_vsnprintf(buffer, sizeof(buffer), format, ap);
-	va_end(ap);
+/**
+   Checks the rate limit of a logging call site
 
-	buffer[sizeof(buffer)-1] = 0;
+   When a message is allowed after messages of the call site have been suppressed, the number of
+   suppressed messages is logged first.
+
+   \return true if the message may be logged
+*/
+bool fastd_log_ratelimit(fastd_log_ratelimit_t *limit, fastd_loglevel_t level, const char *format) {
+	/*
+	  The limit may be checked by different threads; races only make it a bit less accurate
+
+	  On 32-bit targets, the 64-bit timestamps may need libatomic, which is linked when necessary.
+	*/
+	int64_t now = __atomic_load_n(&ctx.now, __ATOMIC_RELAXED);
+
+	if (now - __atomic_load_n(&limit->interval_start, __ATOMIC_RELAXED) >= LOG_RATELIMIT_INTERVAL) {
+		__atomic_store_n(&limit->interval_start, now, __ATOMIC_RELAXED);
+		__atomic_store_n(&limit->count, 0, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_fetch_add(&limit->count, 1, __ATOMIC_RELAXED) >= LOG_RATELIMIT_BURST) {
+		__atomic_add_fetch(&limit->suppressed, 1, __ATOMIC_RELAXED);
+		return false;
+	}
+
+	unsigned long suppressed = __atomic_exchange_n(&limit->suppressed, 0, __ATOMIC_RELAXED);
+	if (suppressed)
+		fastd_logf(level, "suppressed %U similar messages (\"%s\")", (uint64_t)suppressed, format);
+
+	return true;
+}
+
+/** Writes a formatted log message to the configured log destinations */
+static void write_message(fastd_loglevel_t level, time_t t, const char *message) {
+	char timestr[100] = "";
 
 	if (!ctx.log_initialized || level <= conf.log_stderr_level) {
-		time_t t;
 		struct tm tm;
 
-		t = time(NULL);
 		if (localtime_r(&t, &tm) != NULL) {
 			if (strftime(timestr, sizeof(timestr), "%F %T %z --- ", &tm) <= 0)
 				*timestr = 0;
 		}
-	}
 
-	if (!ctx.log_initialized || level <= conf.log_stderr_level)
-		fprintf(stderr, "%s%s%s\n", timestr, get_log_prefix(level), buffer);
+		fprintf(stderr, "%s%s%s\n", timestr, get_log_prefix(level), message);
+	}
 
 	if (ctx.log_initialized) {
 		if (level <= conf.log_syslog_level)
-			syslog(get_syslog_level(level), "%s", buffer);
+			syslog(get_syslog_level(level), "%s", message);
+	}
+}
+
+/** Formats a log record and writes it to the configured log destinations */
+static void write_record(const log_record_t *record) {
+	char buffer[1024];
+
+	format_record(buffer, sizeof(buffer), record);
+	buffer[sizeof(buffer)-1] = 0;
+
+	write_message(record->level, record->time, buffer);
+}
+
+
+/**
+   Reserves the next slot of the log ring
+
+   \return The reserved slot, or NULL if the ring is full
+*/
+static log_slot_t * ring_reserve(fastd_log_ring_t *ring, size_t *pos) {
+	size_t p = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+	while (true) {
+		log_slot_t *slot = &ring->slots[p % LOG_RING_SIZE];
+		size_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		ssize_t diff = (ssize_t)(seq - p);
+
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&ring->tail, &p, p+1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+				*pos = p;
+				return slot;
+			}
+		}
+		else if (diff < 0) {
+			return NULL;
+		}
+		else {
+			p = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+/** Hands a filled slot to the logging thread, waking it up if it is idle */
+static void ring_commit(fastd_log_ring_t *ring, log_slot_t *slot, size_t pos) {
+	__atomic_store_n(&slot->seq, pos+1, __ATOMIC_RELEASE);
+
+	if (__atomic_exchange_n(&ring->waiting, false, __ATOMIC_SEQ_CST)) {
+		static const uint8_t WAKEUP = 0;
+		if (write(ring->wfd, &WAKEUP, 1) < 0) {
+			/* the pipe is only full if the thread will wake up anyways */
+		}
+	}
+}
+
+/** Returns the oldest committed slot of the log ring, or NULL if there is none (only called by the logging thread) */
+static log_slot_t * ring_peek(fastd_log_ring_t *ring) {
+	log_slot_t *slot = &ring->slots[ring->head % LOG_RING_SIZE];
+
+	if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != ring->head+1)
+		return NULL;
+
+	return slot;
+}
+
+/** Releases the oldest slot of the log ring after it has been handled (only called by the logging thread) */
+static void ring_release(fastd_log_ring_t *ring, log_slot_t *slot) {
+	__atomic_store_n(&slot->seq, ring->head + LOG_RING_SIZE, __ATOMIC_RELEASE);
+	ring->head++;
+}
+
+/**
+   Reports messages that have been dropped since the last report (only called by the logging thread)
+
+   Unless \a force is set, reports are made at most once per second.
+*/
+static void report_dropped(fastd_log_ring_t *ring, bool force) {
+	unsigned long dropped = __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	if (dropped == ring->reported)
+		return;
+
+	time_t t = time(NULL);
+	if (!force && t == ring->last_report)
+		return;
+
+	char buffer[100];
+	snprintf(buffer, sizeof(buffer), "log queue overflow: %lu messages have been dropped",
+		 dropped - ring->reported);
+	write_message(LL_WARN, t, buffer);
+
+	ring->reported = dropped;
+	ring->last_report = t;
+}
+
+/** The main function of the logging thread */
+static void * log_thread(void *p) {
+	fastd_log_ring_t *ring = p;
+
+	while (true) {
+		/* the stop flag is checked first, so all messages queued before are written */
+		bool stop = __atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE);
+		log_slot_t *slot;
+
+		while ((slot = ring_peek(ring)) != NULL) {
+			write_record(&slot->record);
+			ring_release(ring, slot);
+		}
+
+		report_dropped(ring, stop);
+
+		if (stop)
+			break;
+
+		__atomic_store_n(&ring->waiting, true, __ATOMIC_SEQ_CST);
+
+		if (ring_peek(ring)) {
+			__atomic_store_n(&ring->waiting, false, __ATOMIC_SEQ_CST);
+			continue;
+		}
+
+		uint8_t buf[64];
+		if (read(ring->rfd, buf, sizeof(buf)) < 0 && errno != EINTR)
+			break;
+	}
+
+	return NULL;
+}
+
+/** Makes forked child processes log synchronously, as they don't inherit the logging thread */
+static void log_fork_child(void) {
+	ctx.log_ring = NULL;
+}
+
+/** Starts the asynchronous logging thread */
+void fastd_log_async_init(void) {
+	fastd_log_ring_t *ring = &log_ring;
+
+	size_t i;
+	for (i = 0; i < LOG_RING_SIZE; i++)
+		ring->slots[i].seq = i;
+
+	int fds[2];
+	if (pipe(fds))
+		exit_errno("pipe");
+
+	ring->rfd = fds[0];
+	ring->wfd = fds[1];
+	fastd_setnonblock(ring->wfd);
+
+	if ((errno = pthread_create(&ring->thread, NULL, log_thread, ring)) != 0) {
+		pr_error_errno("unable to create logging thread, logging synchronously");
+		close(ring->rfd);
+		close(ring->wfd);
+		return;
+	}
+
+	if ((errno = pthread_atfork(NULL, NULL, log_fork_child)) != 0)
+		exit_errno("pthread_atfork");
+
+	ctx.log_ring = ring;
+	atexit(fastd_log_async_stop);
+}
+
+/**
+   Stops the asynchronous logging thread
+
+   All queued messages are written before the thread terminates; later messages are logged synchronously.
+*/
+void fastd_log_async_stop(void) {
+	fastd_log_ring_t *ring = ctx.log_ring;
+	if (!ring || pthread_equal(ring->thread, pthread_self()))
+		return;
+
+	ctx.log_ring = NULL;
+
+	__atomic_store_n(&ring->stop, true, __ATOMIC_RELEASE);
+
+	static const uint8_t WAKEUP = 0;
+	if (write(ring->wfd, &WAKEUP, 1) < 0) {
+		/* the thread will see the stop flag when it has handled the full pipe */
 	}
+
+	pthread_join(ring->thread, NULL);
+
+	/*
+	  The ring and the pipe are not freed, as other threads might still be about
+	  to queue a message; this is only done when fastd terminates anyways.
+	*/
+}
+
+/** Returns the number of log messages dropped because the logging thread couldn't keep up */
+uint64_t fastd_log_async_dropped(void) {
+	fastd_log_ring_t *ring = ctx.log_ring;
+	if (!ring)
+		return 0;
+
+	return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+
+/** printf-like function handling different conversion specifiers and using the configured log destinations */
+void fastd_logf(fastd_loglevel_t level, const char *format, ...) {
+	fastd_log_ring_t *ring = ctx.log_ring;
+	va_list ap;
+
+	/* fatal errors are followed by abort(), so they must be written right away */
+	if (ring && level > LL_FATAL) {
+		if (level > conf.log_stderr_level && level > conf.log_syslog_level)
+			return;
+
+		size_t pos;
+		log_slot_t *slot = ring_reserve(ring, &pos);
+		if (!slot) {
+			__atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+
+		slot->record.level = level;
+		slot->record.time = time(NULL);
+		slot->record.format = format;
+
+		va_start(ap, format);
+		collect_args(&slot->record, format, ap);
+		va_end(ap);
+
+		ring_commit(ring, slot, pos);
+		return;
+	}
+
+	log_record_t record = {
+		.level = level,
+		.time = time(NULL),
+		.format = format,
+	};
+
+	va_start(ap, format);
+	collect_args(&record, format, ap);
+	va_end(ap);
+
+	write_record(&record);
 }
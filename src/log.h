@@ -56,22 +56,77 @@ typedef enum fastd_loglevel {
 size_t fastd_snprint_peer_address(char *buffer, size_t size, const fastd_peer_address_t *address, const char *iface, bool bind_address, bool hide);
 
 
+/** The interval of the per-call-site rate limit of the pr_*_ratelimited macros in milliseconds */
+#define LOG_RATELIMIT_INTERVAL 5000
+
+/** The number of messages a rate-limited call site may log per interval */
+#define LOG_RATELIMIT_BURST 10
+
+
+/** The state of a rate-limited logging call site */
+typedef struct fastd_log_ratelimit {
+	int64_t interval_start;			/**< The start of the current rate limit interval */
+	unsigned count;				/**< The number of messages logged or suppressed in the current interval */
+	unsigned long suppressed;		/**< The number of messages suppressed since the last logged message */
+} fastd_log_ratelimit_t;
+
+
+bool fastd_log_enabled(fastd_loglevel_t level);
 void fastd_logf(const fastd_loglevel_t level, const char *format, ...);
+bool fastd_log_ratelimit(fastd_log_ratelimit_t *limit, fastd_loglevel_t level, const char *format);
+
+void fastd_log_async_init(void);
+void fastd_log_async_stop(void);
+uint64_t fastd_log_async_dropped(void);
+
+
+/**
+   Logs a formatted message with a given log level
+
+   The arguments are only evaluated when messages of the given level are actually logged.
+*/
+#define pr_log(level, args...) do { if (fastd_log_enabled(level)) fastd_logf(level, args); } while(0)
+
+/**
+   Logs a formatted message with a given log level, limiting the rate of messages from the call site
+
+   Each call site may log LOG_RATELIMIT_BURST messages per LOG_RATELIMIT_INTERVAL; the number of
+   suppressed messages is logged before the next message of the call site that isn't suppressed. Like
+   with pr_log, the arguments are only evaluated when the message is actually logged.
+*/
+#define pr_log_ratelimited(level, format, args...) do {			\
+		static fastd_log_ratelimit_t _fastd_log_ratelimit;		\
+		if (fastd_log_enabled(level) && fastd_log_ratelimit(&_fastd_log_ratelimit, level, format)) \
+			fastd_logf(level, format, ##args);			\
+	} while(0)
 
 /** Logs a formatted fatal error message */
 #define pr_fatal(args...) fastd_logf(LL_FATAL, args)
 /** Logs a formatted error message */
-#define pr_error(args...) fastd_logf(LL_ERROR, args)
+#define pr_error(args...) pr_log(LL_ERROR, args)
 /** Logs a formatted warning message */
-#define pr_warn(args...) fastd_logf(LL_WARN, args)
+#define pr_warn(args...) pr_log(LL_WARN, args)
 /** Logs a formatted informational message */
-#define pr_info(args...) fastd_logf(LL_INFO, args)
+#define pr_info(args...) pr_log(LL_INFO, args)
 /** Logs a formatted verbose message */
-#define pr_verbose(args...) fastd_logf(LL_VERBOSE, args)
+#define pr_verbose(args...) pr_log(LL_VERBOSE, args)
 /** Logs a formatted debug message */
-#define pr_debug(args...) fastd_logf(LL_DEBUG, args)
+#define pr_debug(args...) pr_log(LL_DEBUG, args)
 /** Logs a formatted debug2 message */
-#define pr_debug2(args...) fastd_logf(LL_DEBUG2, args)
+#define pr_debug2(args...) pr_log(LL_DEBUG2, args)
+
+/** Logs a formatted error message with a per-call-site rate limit */
+#define pr_error_ratelimited(args...) pr_log_ratelimited(LL_ERROR, args)
+/** Logs a formatted warning message with a per-call-site rate limit */
+#define pr_warn_ratelimited(args...) pr_log_ratelimited(LL_WARN, args)
+/** Logs a formatted informational message with a per-call-site rate limit */
+#define pr_info_ratelimited(args...) pr_log_ratelimited(LL_INFO, args)
+/** Logs a formatted verbose message with a per-call-site rate limit */
+#define pr_verbose_ratelimited(args...) pr_log_ratelimited(LL_VERBOSE, args)
+/** Logs a formatted debug message with a per-call-site rate limit */
+#define pr_debug_ratelimited(args...) pr_log_ratelimited(LL_DEBUG, args)
+/** Logs a formatted debug2 message with a per-call-site rate limit */
+#define pr_debug2_ratelimited(args...) pr_log_ratelimited(LL_DEBUG2, args)
 
 /** Logs a simple error message adding the error found in \e errno */
 #define pr_error_errno(message) pr_error("%s: %s", message, strerror(errno))
@@ -82,6 +137,23 @@ void fastd_logf(const fastd_loglevel_t level, const char *format, ...);
 /** Logs a simple debug2 message adding the error found in \e errno */
 #define pr_debug2_errno(message) pr_debug2("%s: %s", message, strerror(errno))
 
+/**
+   Logs a simple message adding the error found in \e errno with a given log level and a per-call-site rate limit
+
+   \e errno is saved before the rate limit is checked, as logging the number of suppressed messages may change it.
+*/
+#define pr_log_errno_ratelimited(level, message) do {			\
+		int _fastd_log_errno = errno;					\
+		pr_log_ratelimited(level, "%s: %s", message, strerror(_fastd_log_errno)); \
+	} while(0)
+
+/** Logs a simple warning message adding the error found in \e errno with a per-call-site rate limit */
+#define pr_warn_errno_ratelimited(message) pr_log_errno_ratelimited(LL_WARN, message)
+/** Logs a simple debug message adding the error found in \e errno with a per-call-site rate limit */
+#define pr_debug_errno_ratelimited(message) pr_log_errno_ratelimited(LL_DEBUG, message)
+/** Logs a simple debug2 message adding the error found in \e errno with a per-call-site rate limit */
+#define pr_debug2_errno_ratelimited(message) pr_log_errno_ratelimited(LL_DEBUG2, message)
+
 /** Logs a formatted fatal error message and aborts the program */
 #define exit_fatal(args...) do { pr_fatal(args); abort(); } while(0)
 /** Logs a simple fatal error message after a bug was found and aborts the program */
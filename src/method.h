@@ -76,8 +76,13 @@ struct fastd_method_provider {
 
 	/** Encrypts a packet for a given session, adding method-specific headers */
 	bool (*encrypt)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in);
-	/** Decrypts a packet for a given session, stripping method-specific headers */
-	bool (*decrypt)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered);
+	/**
+	   Decrypts a packet for a given session, stripping method-specific headers
+
+	   \e reordered is set to true for reordered packets, and to undefined for authentic packets that must not be
+	   accepted (duplicates and packets that are too old); it is left unchanged for methods without replay protection.
+	*/
+	bool (*decrypt)(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, fastd_tristate_t *reordered);
 };
 
 
@@ -31,14 +31,21 @@
 
 
 #include "common.h"
+#include "../peer.h"
 
 
-/** Common initialization for a new session */
+/**
+   Common initialization for a new session
+
+   Sessions are initialized by the handshake worker threads, so ctx.now must not be used here.
+*/
 void fastd_method_common_init(fastd_method_common_t *session, bool initiator) {
 	memset(session, 0, sizeof(*session));
 
-	session->valid_till = ctx.now + KEY_VALID;
-	session->refresh_after = ctx.now + KEY_REFRESH - fastd_rand(0, KEY_REFRESH_SPLAY);
+	int64_t now = fastd_get_time();
+
+	session->valid_till = now + KEY_VALID;
+	session->refresh_after = now + KEY_REFRESH - fastd_rand(0, KEY_REFRESH_SPLAY);
 
 	if (initiator) {
 		session->send_nonce[COMMON_NONCEBYTES-1] = 3;
@@ -49,7 +56,12 @@ void fastd_method_common_init(fastd_method_common_t *session, bool initiator) {
 	}
 }
 
-/** Checks if a received nonce is valid */
+/**
+   Checks if a received nonce is valid and determines its age
+
+   Nonces that are too old are only rejected by fastd_method_reorder_check() after the packet has been
+   authenticated, so they can be told apart from packets that fail to decrypt.
+*/
 bool fastd_method_is_nonce_valid(const fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t *age) {
 	if ((nonce[0] & 1) != (session->receive_nonce[0] & 1))
 		return false;
@@ -64,14 +76,6 @@ bool fastd_method_is_nonce_valid(const fastd_method_common_t *session, const uin
 
 	*age >>= 1;
 
-	if (*age >= 0) {
-		if (fastd_timed_out(session->reorder_timeout))
-			return false;
-
-		if (*age > 64)
-			return false;
-	}
-
 	return true;
 }
 
@@ -80,7 +84,7 @@ bool fastd_method_is_nonce_valid(const fastd_method_common_t *session, const uin
 
    Returns a tristate: undef if it should not be accepted (duplicate or too old),
    false if the packet is okay and not reordered and true
-   if it is reordered.
+   if it is reordered. Packets that are not accepted are counted as dropped.
 */
 fastd_tristate_t fastd_method_reorder_check(fastd_peer_t *peer, fastd_method_common_t *session, const uint8_t nonce[COMMON_NONCEBYTES], int64_t age) {
 	if (age < 0) {
@@ -98,13 +102,19 @@ fastd_tristate_t fastd_method_reorder_check(fastd_peer_t *peer, fastd_method_com
 		session->reorder_timeout = ctx.now + REORDER_TIME;
 		return fastd_tristate_false;
 	}
-	else if (age == 0 || session->receive_reorder_seen & (1 << (age-1))) {
-		pr_debug("dropping duplicate packet from %P (age %u)", peer, (unsigned)age);
+	else if (age > 64 || fastd_timed_out(session->reorder_timeout)) {
+		pr_debug_ratelimited("dropping old packet from %P (age %U)", peer, (uint64_t)age);
+		fastd_stats_drop(peer, DROP_REASON_TOO_OLD);
+		return fastd_tristate_undef;
+	}
+	else if (age == 0 || session->receive_reorder_seen & (UINT64_C(1) << (age-1))) {
+		pr_debug_ratelimited("dropping duplicate packet from %P (age %u)", peer, (unsigned)age);
+		fastd_stats_drop(peer, DROP_REASON_DUPLICATE);
 		return fastd_tristate_undef;
 	}
 	else {
-		pr_debug2("accepting reordered packet from %P (age %u)", peer, (unsigned)age);
-		session->receive_reorder_seen |= (1 << (age-1));
+		pr_debug2_ratelimited("accepting reordered packet from %P (age %u)", peer, (unsigned)age);
+		session->receive_reorder_seen |= (UINT64_C(1) << (age-1));
 		return fastd_tristate_true;
 	}
 }
@@ -133,16 +133,27 @@ static size_t method_key_length(const fastd_method_t *method) {
 
 /** Initializes a session */
 static fastd_method_session_state_t * method_session_init(const fastd_method_t *method, const uint8_t *secret, bool initiator) {
-	fastd_method_session_state_t *session = fastd_new(fastd_method_session_state_t);
+	const fastd_cipher_t *cipher = fastd_cipher_get(method->cipher_info);
+	const fastd_cipher_t *gmac_cipher = fastd_cipher_get(method->gmac_cipher_info);
+	const fastd_mac_t *ghash = fastd_mac_get(method->ghash_info);
+
+	size_t size = sizeof(fastd_method_session_state_t);
+	size_t cipher_offset = fastd_crypto_state_reserve(&size, cipher->state_size);
+	size_t gmac_cipher_offset = fastd_crypto_state_reserve(&size, gmac_cipher->state_size);
+	size_t ghash_offset = fastd_crypto_state_reserve(&size, ghash->state_size);
+
+	fastd_method_session_state_t *session = fastd_alloc_aligned(size, CRYPTO_STATE_ALIGN);
 
 	fastd_method_common_init(&session->common, initiator);
 	session->method = method;
 
-	session->cipher = fastd_cipher_get(method->cipher_info);
-	session->cipher_state = session->cipher->init(secret);
+	session->cipher = cipher;
+	session->cipher_state = fastd_crypto_state_at(session, cipher_offset);
+	session->cipher->init(session->cipher_state, secret);
 
-	session->gmac_cipher = fastd_cipher_get(method->gmac_cipher_info);
-	session->gmac_cipher_state = session->gmac_cipher->init(secret + method->cipher_info->key_length);
+	session->gmac_cipher = gmac_cipher;
+	session->gmac_cipher_state = fastd_crypto_state_at(session, gmac_cipher_offset);
+	session->gmac_cipher->init(session->gmac_cipher_state, secret + method->cipher_info->key_length);
 
 	fastd_block128_t H;
 
@@ -151,15 +162,16 @@ static fastd_method_session_state_t * method_session_init(const fastd_method_t *
 	memset(zeroiv, 0, gmac_iv_length);
 
 	if (!session->gmac_cipher->crypt(session->gmac_cipher_state, &H, &ZERO_BLOCK, sizeof(fastd_block128_t), zeroiv)) {
-		session->cipher->free(session->cipher_state);
-		session->gmac_cipher->free(session->gmac_cipher_state);
+		session->cipher->cleanup(session->cipher_state);
+		session->gmac_cipher->cleanup(session->gmac_cipher_state);
 		free(session);
 
 		return NULL;
 	}
 
-	session->ghash = fastd_mac_get(method->ghash_info);
-	session->ghash_state = session->ghash->init(H.b);
+	session->ghash = ghash;
+	session->ghash_state = fastd_crypto_state_at(session, ghash_offset);
+	session->ghash->init(session->ghash_state, H.b);
 
 	return session;
 }
@@ -187,9 +199,9 @@ static void method_session_superseded(fastd_method_session_state_t *session) {
 /** Frees the session state */
 static void method_session_free(fastd_method_session_state_t *session) {
 	if (session) {
-		session->cipher->free(session->cipher_state);
-		session->gmac_cipher->free(session->gmac_cipher_state);
-		session->ghash->free(session->ghash_state);
+		session->cipher->cleanup(session->cipher_state);
+		session->gmac_cipher->cleanup(session->gmac_cipher_state);
+		session->ghash->cleanup(session->ghash_state);
 
 		free(session);
 	}
@@ -256,7 +268,7 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 }
 
 /** Verifies and decrypts a packet */
-static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, fastd_tristate_t *reordered) {
 	if (in.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
 		return false;
 
@@ -308,11 +320,8 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 
 	fastd_buffer_push_head(out, sizeof(fastd_block128_t));
 
-	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
-	if (reorder_check.set) {
-		*reordered = reorder_check.state;
-	}
-	else {
+	*reordered = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	if (!reordered->set) {
 		fastd_buffer_free(*out);
 		*out = fastd_buffer_alloc(0, 0, 0);
 	}
@@ -126,19 +126,31 @@ static size_t method_key_length(const fastd_method_t *method) {
 
 /** Initializes a session */
 static fastd_method_session_state_t * method_session_init(const fastd_method_t *method, const uint8_t *secret, bool initiator) {
-	fastd_method_session_state_t *session = fastd_new(fastd_method_session_state_t);
+	const fastd_cipher_t *cipher = fastd_cipher_get(method->cipher_info);
+	const fastd_cipher_t *umac_cipher = fastd_cipher_get(method->umac_cipher_info);
+	const fastd_mac_t *uhash = fastd_mac_get(method->uhash_info);
+
+	size_t size = sizeof(fastd_method_session_state_t);
+	size_t cipher_offset = fastd_crypto_state_reserve(&size, cipher->state_size);
+	size_t umac_cipher_offset = fastd_crypto_state_reserve(&size, umac_cipher->state_size);
+	size_t uhash_offset = fastd_crypto_state_reserve(&size, uhash->state_size);
+
+	fastd_method_session_state_t *session = fastd_alloc_aligned(size, CRYPTO_STATE_ALIGN);
 
 	fastd_method_common_init(&session->common, initiator);
 	session->method = method;
 
-	session->cipher = fastd_cipher_get(method->cipher_info);
-	session->cipher_state = session->cipher->init(secret);
+	session->cipher = cipher;
+	session->cipher_state = fastd_crypto_state_at(session, cipher_offset);
+	session->cipher->init(session->cipher_state, secret);
 
-	session->umac_cipher = fastd_cipher_get(method->umac_cipher_info);
-	session->umac_cipher_state = session->umac_cipher->init(secret + method->cipher_info->key_length);
+	session->umac_cipher = umac_cipher;
+	session->umac_cipher_state = fastd_crypto_state_at(session, umac_cipher_offset);
+	session->umac_cipher->init(session->umac_cipher_state, secret + method->cipher_info->key_length);
 
-	session->uhash = fastd_mac_get(method->uhash_info);
-	session->uhash_state = session->uhash->init(secret + method->cipher_info->key_length + method->umac_cipher_info->key_length);
+	session->uhash = uhash;
+	session->uhash_state = fastd_crypto_state_at(session, uhash_offset);
+	session->uhash->init(session->uhash_state, secret + method->cipher_info->key_length + method->umac_cipher_info->key_length);
 
 	return session;
 }
@@ -166,9 +178,9 @@ static void method_session_superseded(fastd_method_session_state_t *session) {
 /** Frees the session state */
 static void method_session_free(fastd_method_session_state_t *session) {
 	if (session) {
-		session->cipher->free(session->cipher_state);
-		session->umac_cipher->free(session->umac_cipher_state);
-		session->uhash->free(session->uhash_state);
+		session->cipher->cleanup(session->cipher_state);
+		session->umac_cipher->cleanup(session->umac_cipher_state);
+		session->uhash->cleanup(session->uhash_state);
 
 		free(session);
 	}
@@ -221,7 +233,7 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 }
 
 /** Verifies and decrypts a packet */
-static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, fastd_tristate_t *reordered) {
 	if (in.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
 		return false;
 
@@ -272,11 +284,8 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 
 	fastd_buffer_push_head(out, sizeof(fastd_block128_t));
 
-	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
-	if (reorder_check.set) {
-		*reordered = reorder_check.state;
-	}
-	else {
+	*reordered = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	if (!reordered->set) {
 		fastd_buffer_free(*out);
 		*out = fastd_buffer_alloc(0, 0, 0);
 	}
@@ -108,13 +108,21 @@ static size_t method_key_length(const fastd_method_t *method) {
 
 /** Initializes a session */
 static fastd_method_session_state_t * method_session_init(const fastd_method_t *method, const uint8_t *secret, bool initiator) {
-	fastd_method_session_state_t *session = fastd_new(fastd_method_session_state_t);
+	const fastd_cipher_t *cipher = fastd_cipher_get(method->cipher_info);
+	const fastd_mac_t *ghash = fastd_mac_get(method->ghash_info);
+
+	size_t size = sizeof(fastd_method_session_state_t);
+	size_t cipher_offset = fastd_crypto_state_reserve(&size, cipher->state_size);
+	size_t ghash_offset = fastd_crypto_state_reserve(&size, ghash->state_size);
+
+	fastd_method_session_state_t *session = fastd_alloc_aligned(size, CRYPTO_STATE_ALIGN);
 
 	fastd_method_common_init(&session->common, initiator);
 	session->method = method;
 
-	session->cipher = fastd_cipher_get(method->cipher_info);
-	session->cipher_state = session->cipher->init(secret);
+	session->cipher = cipher;
+	session->cipher_state = fastd_crypto_state_at(session, cipher_offset);
+	session->cipher->init(session->cipher_state, secret);
 
 	static const fastd_block128_t zeroblock = {};
 	fastd_block128_t H;
@@ -124,13 +132,14 @@ static fastd_method_session_state_t * method_session_init(const fastd_method_t *
 	memset(zeroiv, 0, iv_length);
 
 	if (!session->cipher->crypt(session->cipher_state, &H, &zeroblock, sizeof(fastd_block128_t), zeroiv)) {
-		session->cipher->free(session->cipher_state);
+		session->cipher->cleanup(session->cipher_state);
 		free(session);
 		return NULL;
 	}
 
-	session->ghash = fastd_mac_get(method->ghash_info);
-	session->ghash_state = session->ghash->init(H.b);
+	session->ghash = ghash;
+	session->ghash_state = fastd_crypto_state_at(session, ghash_offset);
+	session->ghash->init(session->ghash_state, H.b);
 
 	return session;
 }
@@ -158,8 +167,8 @@ static void method_session_superseded(fastd_method_session_state_t *session) {
 /** Frees the session state */
 static void method_session_free(fastd_method_session_state_t *session) {
 	if (session) {
-		session->cipher->free(session->cipher_state);
-		session->ghash->free(session->ghash_state);
+		session->cipher->cleanup(session->cipher_state);
+		session->ghash->cleanup(session->ghash_state);
 
 		free(session);
 	}
@@ -222,7 +231,7 @@ static bool method_encrypt(UNUSED fastd_peer_t *peer, fastd_method_session_state
 }
 
 /** Verifies and decrypts a packet */
-static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, bool *reordered) {
+static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *session, fastd_buffer_t *out, fastd_buffer_t in, fastd_tristate_t *reordered) {
 	if (in.len < COMMON_HEADBYTES+sizeof(fastd_block128_t))
 		return false;
 
@@ -270,11 +279,8 @@ static bool method_decrypt(fastd_peer_t *peer, fastd_method_session_state_t *ses
 
 	fastd_buffer_push_head(out, sizeof(fastd_block128_t));
 
-	fastd_tristate_t reorder_check = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
-	if (reorder_check.set) {
-		*reordered = reorder_check.state;
-	}
-	else {
+	*reordered = fastd_method_reorder_check(peer, &session->common, in_nonce, age);
+	if (!reordered->set) {
 		fastd_buffer_free(*out);
 		*out = fastd_buffer_alloc(0, 0, 0);
 	}
@@ -118,6 +118,12 @@ static void option_status_socket(const char *arg) {
 	conf.status_socket = fastd_strdup(arg);
 }
 
+/** Handles the --metrics-socket option */
+static void option_metrics_socket(const char *arg) {
+	free(conf.metrics_socket);
+	conf.metrics_socket = fastd_strdup(arg);
+}
+
 #endif
 
 /** Handles the --config option */
@@ -131,7 +137,7 @@ static void option_config(const char *arg) {
 
 /** Handles the --config-peer option */
 static void option_config_peer(const char *arg) {
-	fastd_peer_t *peer = fastd_new0(fastd_peer_t);
+	fastd_peer_t *peer = fastd_peer_new();
 
 	if(!fastd_config_read(arg, conf.peer_group, peer, 0))
 		exit(1);
@@ -4,6 +4,7 @@ OPTION(option_daemon, "--daemon" OR "-d", "Runs fastd in the background");
 OPTION_ARG(option_pid_file, "--pid-file", "<filename>", "Writes fastd's PID to the specified file");
 #ifdef WITH_STATUS_SOCKET
 OPTION_ARG(option_status_socket, "--status-socket", "<socket>", "Configure a socket to get fastd's status");
+OPTION_ARG(option_metrics_socket, "--metrics-socket", "<socket>", "Configure a socket to get metrics in OpenMetrics format");
 #endif
 SEPARATOR;
 
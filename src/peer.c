@@ -32,6 +32,7 @@
 #include "peer.h"
 #include "peer_hashtable.h"
 #include "poll.h"
+#include "trace.h"
 
 #include <arpa/inet.h>
 #include <sys/wait.h>
@@ -104,6 +105,22 @@ void fastd_peer_set_shell_env(fastd_shell_env_t *env, const fastd_peer_t *peer,
 		fastd_shell_env_set(env, "PEER_PORT", NULL);
 	}
 
+	if (peer && peer->rtt.srtt) {
+		snprintf(buf, sizeof(buf), "%u", (unsigned)peer->rtt.srtt);
+		fastd_shell_env_set(env, "PEER_RTT", buf);
+
+		snprintf(buf, sizeof(buf), "%u", (unsigned)peer->rtt.jitter);
+		fastd_shell_env_set(env, "PEER_RTT_JITTER", buf);
+
+		snprintf(buf, sizeof(buf), "%.1f", peer->rtt.loss * 100.0 / 65536);
+		fastd_shell_env_set(env, "PEER_RTT_LOSS", buf);
+	}
+	else {
+		fastd_shell_env_set(env, "PEER_RTT", NULL);
+		fastd_shell_env_set(env, "PEER_RTT_JITTER", NULL);
+		fastd_shell_env_set(env, "PEER_RTT_LOSS", NULL);
+	}
+
 	conf.protocol->set_shell_env(env, peer);
 }
 
@@ -256,36 +273,40 @@ void fastd_peer_reset_socket(fastd_peer_t *peer) {
    @param delay	the delay in milliseconds
 */
 void fastd_peer_schedule_handshake(fastd_peer_t *peer, int delay) {
-	fastd_peer_unschedule_handshake(peer);
-
-	peer->next_handshake = ctx.now + delay;
+	fastd_timer_schedule(&peer->handshake_timer, ctx.now + delay);
+}
 
-	fastd_dlist_head_t *list;
-	for (list = &ctx.handshake_queue; list->next; list = list->next) {
-		fastd_peer_t *entry = container_of(list->next, fastd_peer_t, handshake_entry);
+/**
+   Schedules the next timeout and keepalive check of a peer
 
-		if (entry->next_handshake > peer->next_handshake)
-			break;
+   Only established and dynamic peers need to be checked. As the timeouts are updated
+   for every packet, the timer isn't rescheduled when they change; instead, the check
+   is simply rescheduled when the timer turns out to be early.
+*/
+static void schedule_maintenance(fastd_peer_t *peer) {
+	if (!fastd_peer_is_dynamic(peer) && !fastd_peer_is_established(peer)) {
+		fastd_timer_cancel(&peer->maintenance_timer);
+		return;
 	}
 
-	fastd_dlist_insert(list, &peer->handshake_entry);
-}
-
-/** Checks if the peer group \e group1 lies in \e group2 */
-static inline bool is_group_in(const fastd_peer_group_t *group1, const fastd_peer_group_t *group2) {
-	while (group1) {
-		if (group1 == group2)
-			return true;
+	fastd_timeout_t timeout = peer->timeout;
+	if (fastd_peer_is_established(peer)) {
+		if (peer->keepalive_timeout < timeout)
+			timeout = peer->keepalive_timeout;
 
-		group1 = group1->parent;
+		if (fastd_peer_rtt_enabled(&peer->rtt) && peer->rtt.next_probe < timeout)
+			timeout = peer->rtt.next_probe;
 	}
 
-	return false;
+	fastd_timer_schedule(&peer->maintenance_timer, timeout);
 }
 
-/** Checks if a peer lies in a peer group */
-static bool is_peer_in_group(const fastd_peer_t *peer, const fastd_peer_group_t *group) {
-	return is_group_in(peer->group, group);
+/** Adds \e delta to the established connection counters of a peer's group and all its parent groups */
+static void update_group_established(const fastd_peer_t *peer, ssize_t delta) {
+	fastd_peer_group_t *group;
+
+	for (group = peer->group; group; group = group->parent)
+		group->n_established += delta;
 }
 
 /**
@@ -297,7 +318,9 @@ static bool is_peer_in_group(const fastd_peer_t *peer, const fastd_peer_group_t
 */
 static void reset_peer(fastd_peer_t *peer) {
 	if (fastd_peer_is_established(peer)) {
+		update_group_established(peer, -1);
 		on_disestablish(peer);
+		fastd_status_event(STATUS_EVENT_DISESTABLISHED, peer);
 		pr_info("connection with %P disestablished.", peer);
 	}
 
@@ -305,24 +328,18 @@ static void reset_peer(fastd_peer_t *peer) {
 
 	conf.protocol->reset_peer_state(peer);
 
-	size_t i, deleted = 0;
-	for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
-		if (VECTOR_INDEX(ctx.eth_addrs, i).peer == peer) {
-			deleted++;
-		}
-		else if (deleted) {
-			VECTOR_INDEX(ctx.eth_addrs, i-deleted) = VECTOR_INDEX(ctx.eth_addrs, i);
-		}
-	}
-
-	VECTOR_RESIZE(ctx.eth_addrs, VECTOR_LEN(ctx.eth_addrs)-deleted);
+	fastd_peer_eth_addr_delete_all(peer);
 
 	fastd_peer_unschedule_handshake(peer);
+	fastd_timer_cancel(&peer->maintenance_timer);
 
 	fastd_peer_hashtable_remove(peer);
 
 	memset(&peer->stats, 0, sizeof(peer->stats));
 
+	peer->rtt.supported = false;
+	peer->rtt.pending = false;
+
 	peer->address.sa.sa_family = AF_UNSPEC;
 	peer->local_address.sa.sa_family = AF_UNSPEC;
 	peer->state = STATE_INACTIVE;
@@ -392,6 +409,8 @@ static void setup_peer(fastd_peer_t *peer) {
 	peer->verify_valid_timeout = ctx.now;
 #endif
 
+	schedule_maintenance(peer);
+
 	if (!fastd_peer_is_enabled(peer))
 		/* Keep the peer in STATE_INACTIVE */
 		return;
@@ -434,6 +453,7 @@ void fastd_peer_free(fastd_peer_t *peer) {
 	}
 
 	VECTOR_FREE(peer->remotes);
+	VECTOR_FREE(peer->eth_addrs);
 
 	free(peer->name);
 	free(peer);
@@ -601,6 +621,8 @@ bool fastd_peer_claim_address(fastd_peer_t *new_peer, fastd_socket_t *sock, cons
 		}
 	}
 
+	bool changed = fastd_peer_is_established(new_peer) && !fastd_peer_address_equal(&new_peer->address, remote_addr);
+
 	fastd_peer_hashtable_remove(new_peer);
 	new_peer->address = *remote_addr;
 	fastd_peer_hashtable_insert(new_peer);
@@ -613,6 +635,9 @@ bool fastd_peer_claim_address(fastd_peer_t *new_peer, fastd_socket_t *sock, cons
 	if (local_addr)
 		new_peer->local_address = *local_addr;
 
+	if (changed)
+		fastd_status_event(STATUS_EVENT_ADDRESS_CHANGED, new_peer);
+
 	return true;
 }
 
@@ -620,6 +645,7 @@ bool fastd_peer_claim_address(fastd_peer_t *new_peer, fastd_socket_t *sock, cons
 void fastd_peer_reset(fastd_peer_t *peer) {
 	if (peer->state != STATE_INACTIVE) {
 		pr_debug("resetting peer %P", peer);
+		fastd_trace_peer_reset(peer);
 		reset_peer(peer);
 	}
 
@@ -632,19 +658,6 @@ void fastd_peer_delete(fastd_peer_t *peer) {
 	delete_peer(peer);
 }
 
-/** Counts how many peers in the given peer group have established a connection */
-static inline size_t count_established_group_peers(const fastd_peer_group_t *group) {
-	size_t i, ret = 0;
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
-
-		if (fastd_peer_is_established(peer) && is_peer_in_group(peer, group))
-			ret++;
-	}
-
-	return ret;
-}
-
 /** Checks if a peer may currently establish a connection */
 bool fastd_peer_may_connect(fastd_peer_t *peer) {
 	if (fastd_peer_is_established(peer))
@@ -656,7 +669,7 @@ bool fastd_peer_may_connect(fastd_peer_t *peer) {
 		if (group->max_connections < 0)
 			continue;
 
-		if (count_established_group_peers(group) >= (size_t)group->max_connections)
+		if (group->n_established >= (size_t)group->max_connections)
 			return false;
 	}
 
@@ -688,73 +701,6 @@ static inline bool peer_configs_equal(const fastd_peer_t *peer1, const fastd_pee
 	return true;
 }
 
-/** Adds a new peer */
-bool fastd_peer_add(fastd_peer_t *peer) {
-	if (!peer->key) {
-		pr_warn("no valid key configured for peer %P", peer);
-		goto error;
-	}
-
-	fastd_peer_t *other = conf.protocol->find_peer(peer->key);
-	if (other) {
-		if (peer->config_state != CONFIG_NEW)
-			exit_bug("tried to replace with active peer");
-
-		switch (other->config_state) {
-		case CONFIG_NEW:
-		case CONFIG_DISABLED:
-			pr_warn("duplicate key used by peers %P and %P, disabling both", peer, other);
-			other->config_state = CONFIG_DISABLED;
-			goto error;
-
-		case CONFIG_STATIC:
-			if (!strequal(other->name, peer->name))
-				pr_verbose("peer %P has been renamed to %P", other, peer);
-
-			if (peer_configs_equal(other, peer)) {
-				free(other->name);
-				other->name = peer->name;
-				peer->name = NULL;
-
-				fastd_peer_free(peer);
-
-				pr_verbose("peer %P is unchanged", other);
-				other->config_state = CONFIG_NEW;
-
-				return true;
-			}
-			else {
-				pr_verbose("peer %P has changed", peer);
-			}
-
-			fastd_peer_delete(other);
-			break;
-
-#ifdef WITH_DYNAMIC_PEERS
-		case CONFIG_DYNAMIC:
-			pr_verbose("dynamic peer %P is now configured as %P", other, peer);
-			fastd_peer_delete(other);
-#endif
-		}
-	}
-
-	peer->id = ctx.next_peer_id++;
-
-	VECTOR_ADD(ctx.peers, peer);
-	fastd_poll_add_peer();
-
-	conf.protocol->init_peer_state(peer);
-
-	if (fastd_peer_is_dynamic(peer) || peer->config_source_dir)
-		pr_verbose("adding peer %P", peer);
-
-	return true;
-
-  error:
-	fastd_peer_free(peer);
-	return false;
-}
-
 /** Prints a debug message when no handshake could be sent because the current remote didn't resolve successfully */
 static inline void no_valid_address_debug(const fastd_peer_t *peer) {
 	pr_debug("not sending a handshake to %P (no valid address resolved)", peer);
@@ -788,21 +734,59 @@ static void send_handshake(fastd_peer_t *peer, fastd_remote_t *next_remote) {
 
 	peer->last_handshake_timeout = ctx.now + MIN_HANDSHAKE_INTERVAL;
 	peer->last_handshake_address = peer->address;
+	peer->handshake_cookie_retried = false;
 	conf.protocol->handshake_init(peer->sock, &peer->local_address, &peer->address, peer);
 }
 
-/** Sends a handshake to one peer, if a scheduled handshake is due */
-void fastd_peer_handle_handshake_queue(void) {
-	if (!ctx.handshake_queue.next)
-		return;
+/**
+   Checks if the handshake rate limit allows to initiate another handshake
 
-	fastd_peer_t *peer = container_of(ctx.handshake_queue.next, fastd_peer_t, handshake_entry);
-	if (!fastd_timed_out(peer->next_handshake))
-		return;
+   The rate limit is a token bucket which is refilled with conf.handshake_rate
+   tokens per second and holds up to conf.handshake_burst tokens.
+*/
+static bool handshake_rate_limit_take(void) {
+	const int64_t max_tokens = 1000 * (int64_t)conf.handshake_burst;
 
-	fastd_peer_schedule_handshake_default(peer);
+	ctx.handshake_tokens += (ctx.now - ctx.handshake_tokens_update) * conf.handshake_rate;
+	ctx.handshake_tokens_update = ctx.now;
+
+	if (ctx.handshake_tokens > max_tokens)
+		ctx.handshake_tokens = max_tokens;
+
+	if (ctx.handshake_tokens < 1000)
+		return false;
+
+	ctx.handshake_tokens -= 1000;
+	return true;
+}
+
+/**
+   Postpones a handshake that was prevented by the handshake rate limit
+
+   Postponed handshakes are spread out evenly at the configured handshake rate,
+   with a random jitter of up to one interval.
+*/
+static void defer_handshake(fastd_peer_t *peer) {
+	const int64_t interval = 1000000 / conf.handshake_rate;
+
+	int64_t next = ctx.now * 1000;
+	if (ctx.handshake_next_deferred > next)
+		next = ctx.handshake_next_deferred;
+
+	ctx.handshake_next_deferred = next + interval;
+
+	/* The handshake is never rescheduled for the current tick */
+	int delay = (next + fastd_rand(0, interval + 1))/1000 - ctx.now;
+	fastd_peer_schedule_handshake(peer, delay + 1);
+}
+
+/** Sends a scheduled handshake to a peer (the callback of the peer's handshake timer) */
+static void handle_handshake(fastd_timer_t *timer) {
+	fastd_peer_t *peer = container_of(timer, fastd_peer_t, handshake_timer);
 
 	if (!fastd_peer_may_connect(peer)) {
+		fastd_peer_schedule_handshake_default(peer);
+
 		if (peer->next_remote != -1) {
 			pr_debug("temporarily disabling handshakes with %P", peer);
 			peer->next_remote = -1;
@@ -811,6 +795,13 @@ void fastd_peer_handle_handshake_queue(void) {
 		return;
 	}
 
+	if (!handshake_rate_limit_take()) {
+		defer_handshake(peer);
+		return;
+	}
+
+	fastd_peer_schedule_handshake_default(peer);
+
 	fastd_remote_t *next_remote = fastd_peer_get_next_remote(peer);
 
 	if (next_remote || fastd_peer_is_established(peer)) {
@@ -837,6 +828,132 @@ void fastd_peer_handle_handshake_queue(void) {
 		fastd_resolve_peer(peer, next_remote);
 }
 
+/**
+   Performs maintenance tasks for a peer (the callback of the peer's maintenance timer)
+
+   \li If no data was received from the peer for some time, it is reset.
+   \li If RTT probes are enabled and the next probe is due, it is sent; probes also serve as keepalives.
+   \li If no data was sent to the peer for some time, a keepalive is sent.
+ */
+static void maintain_peer(fastd_timer_t *timer) {
+	fastd_peer_t *peer = container_of(timer, fastd_peer_t, maintenance_timer);
+
+	/* check for peer timeout */
+	if (fastd_timed_out(peer->timeout)) {
+#ifdef WITH_DYNAMIC_PEERS
+		if (fastd_peer_is_dynamic(peer)) {
+			if (fastd_timed_out(peer->verify_timeout) && fastd_timed_out(peer->verify_valid_timeout)) {
+				fastd_peer_delete(peer);
+				return;
+			}
+
+			if (fastd_peer_is_established(peer))
+				fastd_peer_reset(peer);
+
+			/* check again when the peer may be deleted */
+			if (peer->verify_timeout > peer->verify_valid_timeout)
+				fastd_timer_schedule(timer, peer->verify_timeout);
+			else
+				fastd_timer_schedule(timer, peer->verify_valid_timeout);
+			return;
+		}
+#endif
+
+		if (fastd_peer_is_established(peer))
+			fastd_peer_reset(peer);
+		return;
+	}
+
+	/* check for RTT probe timeout */
+	if (fastd_peer_is_established(peer) && fastd_peer_rtt_enabled(&peer->rtt) && fastd_timed_out(peer->rtt.next_probe))
+		fastd_peer_rtt_send_probe(peer);
+
+	/* check for keepalive timeout */
+	if (fastd_peer_is_established(peer) && fastd_timed_out(peer->keepalive_timeout)) {
+		pr_debug2("sending keepalive to %P", peer);
+
+		/* The protocol updates the timeout when the packet is sent; make sure it is moved forward even if sending fails */
+		peer->keepalive_timeout = ctx.now + KEEPALIVE_TIMEOUT;
+		conf.protocol->send(peer, fastd_buffer_alloc(0, conf.min_encrypt_head_space, conf.min_encrypt_tail_space));
+	}
+
+	schedule_maintenance(peer);
+}
+
+
+/** Adds a new peer */
+bool fastd_peer_add(fastd_peer_t *peer) {
+	if (!peer->key) {
+		pr_warn("no valid key configured for peer %P", peer);
+		goto error;
+	}
+
+	fastd_peer_t *other = conf.protocol->find_peer(peer->key);
+	if (other) {
+		if (peer->config_state != CONFIG_NEW)
+			exit_bug("tried to replace with active peer");
+
+		switch (other->config_state) {
+		case CONFIG_NEW:
+		case CONFIG_DISABLED:
+			pr_warn("duplicate key used by peers %P and %P, disabling both", peer, other);
+			other->config_state = CONFIG_DISABLED;
+			goto error;
+
+		case CONFIG_STATIC:
+			if (!strequal(other->name, peer->name))
+				pr_verbose("peer %P has been renamed to %P", other, peer);
+
+			if (peer_configs_equal(other, peer)) {
+				free(other->name);
+				other->name = peer->name;
+				peer->name = NULL;
+
+				fastd_peer_free(peer);
+
+				pr_verbose("peer %P is unchanged", other);
+				other->config_state = CONFIG_NEW;
+
+				return true;
+			}
+			else {
+				pr_verbose("peer %P has changed", peer);
+			}
+
+			fastd_peer_delete(other);
+			break;
+
+#ifdef WITH_DYNAMIC_PEERS
+		case CONFIG_DYNAMIC:
+			pr_verbose("dynamic peer %P is now configured as %P", other, peer);
+			fastd_peer_delete(other);
+#endif
+		}
+	}
+
+	peer->id = ctx.next_peer_id++;
+
+	fastd_timer_init(&peer->handshake_timer, handle_handshake);
+	fastd_timer_init(&peer->maintenance_timer, maintain_peer);
+
+	VECTOR_ADD(ctx.peers, peer);
+	fastd_poll_add_peer();
+
+	conf.protocol->init_peer_state(peer);
+
+	if (fastd_peer_is_dynamic(peer))
+		schedule_maintenance(peer);
+
+	if (fastd_peer_is_dynamic(peer) || peer->config_source_dir)
+		pr_verbose("adding peer %P", peer);
+
+	return true;
+
+  error:
+	fastd_peer_free(peer);
+	return false;
+}
+
 /** Marks a peer as established */
 void fastd_peer_set_established(fastd_peer_t *peer) {
 	if (fastd_peer_is_established(peer))
@@ -844,7 +961,12 @@ void fastd_peer_set_established(fastd_peer_t *peer) {
 
 	peer->state = STATE_ESTABLISHED;
 	peer->established = ctx.now;
+	peer->rtt.next_probe = ctx.now;
+	update_group_established(peer, 1);
+	schedule_maintenance(peer);
 	on_establish(peer);
+	fastd_trace_peer_established(peer);
+	fastd_status_event(STATUS_EVENT_ESTABLISHED, peer);
 	pr_info("connection with %P established.", peer);
 }
 
@@ -854,8 +976,61 @@ static inline int eth_addr_cmp(const fastd_eth_addr_t *addr1, const fastd_eth_ad
 }
 
 /** Compares two fastd_peer_eth_addr_t entries by their MAC addresses */
-static int peer_eth_addr_cmp(const fastd_peer_eth_addr_t *addr1, const fastd_peer_eth_addr_t *addr2) {
-	return eth_addr_cmp(&addr1->addr, &addr2->addr);
+static int peer_eth_addr_cmp(fastd_peer_eth_addr_t *const *addr1, fastd_peer_eth_addr_t *const *addr2) {
+	return eth_addr_cmp(&(*addr1)->addr, &(*addr2)->addr);
+}
+
+/** Adds a MAC address entry to the index of its peer */
+static void peer_eth_addr_link(fastd_peer_eth_addr_t *addr) {
+	if (!addr->peer)
+		return;
+
+	addr->peer_index = VECTOR_LEN(addr->peer->eth_addrs);
+	VECTOR_ADD(addr->peer->eth_addrs, addr);
+}
+
+/** Removes a MAC address entry from the index of its peer */
+static void peer_eth_addr_unlink(fastd_peer_eth_addr_t *addr) {
+	fastd_peer_t *peer = addr->peer;
+	if (!peer)
+		return;
+
+	size_t last = VECTOR_LEN(peer->eth_addrs) - 1;
+
+	if (addr->peer_index != last) {
+		fastd_peer_eth_addr_t *moved = VECTOR_INDEX(peer->eth_addrs, last);
+		VECTOR_INDEX(peer->eth_addrs, addr->peer_index) = moved;
+		moved->peer_index = addr->peer_index;
+	}
+
+	VECTOR_RESIZE(peer->eth_addrs, last);
+}
+
+/** Removes a MAC address entry from the sorted list of all addresses and frees it */
+static void eth_addr_delete(fastd_peer_eth_addr_t *addr) {
+	fastd_peer_eth_addr_t **entry = VECTOR_BSEARCH(&addr, ctx.eth_addrs, peer_eth_addr_cmp);
+	if (!entry || *entry != addr)
+		exit_bug("eth_addr_delete: entry not found");
+
+	VECTOR_DELETE(ctx.eth_addrs, entry - VECTOR_DATA(ctx.eth_addrs));
+
+	peer_eth_addr_unlink(addr);
+	fastd_timer_cancel(&addr->timer);
+	free(addr);
+}
+
+/** Removes a MAC address entry after it hasn't been seen for ETH_ADDR_STALE_TIME (the callback of the entry's timer) */
+static void eth_addr_expire(fastd_timer_t *timer) {
+	fastd_peer_eth_addr_t *addr = container_of(timer, fastd_peer_eth_addr_t, timer);
+
+	if (!fastd_timed_out(addr->timeout)) {
+		fastd_timer_schedule(timer, addr->timeout);
+		return;
+	}
+
+	pr_debug("MAC address %E not seen for more than %u seconds, removing", &addr->addr, ETH_ADDR_STALE_TIME/1000);
+
+	eth_addr_delete(addr);
 }
 
 /** Adds a MAC address to the sorted list of addresses associated with a peer (or updates the timeout of an existing entry) */
@@ -867,11 +1042,18 @@ void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
 
 	while (max > min) {
 		int cur = (min+max)/2;
-		int cmp = eth_addr_cmp(&addr, &VECTOR_INDEX(ctx.eth_addrs, cur).addr);
+		fastd_peer_eth_addr_t *entry = VECTOR_INDEX(ctx.eth_addrs, cur);
+		int cmp = eth_addr_cmp(&addr, &entry->addr);
 
 		if (cmp == 0) {
-			VECTOR_INDEX(ctx.eth_addrs, cur).peer = peer;
-			VECTOR_INDEX(ctx.eth_addrs, cur).timeout = ctx.now + ETH_ADDR_STALE_TIME;
+			/* The entry's timer will notice the new timeout when it runs */
+			if (entry->peer != peer) {
+				peer_eth_addr_unlink(entry);
+				entry->peer = peer;
+				peer_eth_addr_link(entry);
+			}
+
+			entry->timeout = ctx.now + ETH_ADDR_STALE_TIME;
 			return; /* We're done here. */
 		}
 		else if (cmp < 0) {
@@ -882,7 +1064,16 @@ void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
 		}
 	}
 
-	VECTOR_INSERT(ctx.eth_addrs, ((fastd_peer_eth_addr_t) {addr, peer, ctx.now + ETH_ADDR_STALE_TIME}), min);
+	fastd_peer_eth_addr_t *entry = fastd_new(fastd_peer_eth_addr_t);
+	entry->addr = addr;
+	entry->peer = peer;
+	entry->timeout = ctx.now + ETH_ADDR_STALE_TIME;
+
+	fastd_timer_init(&entry->timer, eth_addr_expire);
+	fastd_timer_schedule(&entry->timer, entry->timeout);
+
+	VECTOR_INSERT(ctx.eth_addrs, entry, min);
+	peer_eth_addr_link(entry);
 
 	if (peer)
 		pr_debug("learned new MAC address %E on peer %P", &addr, peer);
@@ -892,83 +1083,56 @@ void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr) {
 
 /** Finds the peer that is associated with a given MAC address */
 bool fastd_peer_find_by_eth_addr(const fastd_eth_addr_t addr, fastd_peer_t **peer) {
-	const fastd_peer_eth_addr_t key = {.addr = addr};
-	fastd_peer_eth_addr_t *peer_eth_addr = VECTOR_BSEARCH(&key, ctx.eth_addrs, peer_eth_addr_cmp);
+	fastd_peer_eth_addr_t key = {.addr = addr};
+	fastd_peer_eth_addr_t *keyp = &key;
+	fastd_peer_eth_addr_t **peer_eth_addr = VECTOR_BSEARCH(&keyp, ctx.eth_addrs, peer_eth_addr_cmp);
 
 	if (!peer_eth_addr)
 		return false;
 
-	*peer = peer_eth_addr->peer;
+	*peer = (*peer_eth_addr)->peer;
 	return true;
 }
 
 /**
-   Performs maintenance tasks for a peer
-
-   \li If no data was received from the peer for some time, it is reset.
-   \li If no data was sent to the peer for some time, a keepalive is sent.
- */
-static bool maintain_peer(fastd_peer_t *peer) {
-	if (fastd_peer_is_dynamic(peer) || fastd_peer_is_established(peer)) {
-		/* check for peer timeout */
-		if (fastd_timed_out(peer->timeout)) {
-#ifdef WITH_DYNAMIC_PEERS
-			if (fastd_peer_is_dynamic(peer) &&
-			    fastd_timed_out(peer->verify_timeout) &&
-			    fastd_timed_out(peer->verify_valid_timeout)) {
-				fastd_peer_delete(peer);
-				return false;
-			}
-#endif
-
-			if (fastd_peer_is_established(peer))
-				fastd_peer_reset(peer);
-			return true;
-		}
+   Removes all MAC address entries associated with a peer
 
-		/* check for keepalive timeout */
-		if (!fastd_peer_is_established(peer))
-			return true;
-
-		if (!fastd_timed_out(peer->keepalive_timeout))
-			return true;
-
-		pr_debug2("sending keepalive to %P", peer);
-		conf.protocol->send(peer, fastd_buffer_alloc(0, conf.min_encrypt_head_space, conf.min_encrypt_tail_space));
-	}
-
-	return true;
-}
+   The entries are removed from ctx.eth_addrs in a single compaction pass, which is cheaper than
+   deleting them one by one when a peer has many MAC addresses.
+*/
+void fastd_peer_eth_addr_delete_all(fastd_peer_t *peer) {
+	if (!VECTOR_LEN(peer->eth_addrs))
+		return;
 
-/** Removes all time-outed MAC addresses from \e ctx.eth_addrs */
-static void eth_addr_cleanup(void) {
 	size_t i, deleted = 0;
-
 	for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
-		if (fastd_timed_out(VECTOR_INDEX(ctx.eth_addrs, i).timeout)) {
+		fastd_peer_eth_addr_t *addr = VECTOR_INDEX(ctx.eth_addrs, i);
+
+		if (addr->peer == peer) {
+			fastd_timer_cancel(&addr->timer);
+			free(addr);
 			deleted++;
-			pr_debug("MAC address %E not seen for more than %u seconds, removing",
-				 &VECTOR_INDEX(ctx.eth_addrs, i).addr, ETH_ADDR_STALE_TIME/1000);
 		}
 		else if (deleted) {
-			VECTOR_INDEX(ctx.eth_addrs, i-deleted) = VECTOR_INDEX(ctx.eth_addrs, i);
+			VECTOR_INDEX(ctx.eth_addrs, i-deleted) = addr;
 		}
 	}
 
 	VECTOR_RESIZE(ctx.eth_addrs, VECTOR_LEN(ctx.eth_addrs)-deleted);
+	VECTOR_RESIZE(peer->eth_addrs, 0);
 }
 
-/** Performs periodic maintenance tasks for peers */
-void fastd_peer_maintenance(void) {
+/** Removes all MAC address entries (used on shutdown) */
+void fastd_peer_eth_addr_free_all(void) {
 	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peers);) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
+	for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
+		fastd_peer_eth_addr_t *addr = VECTOR_INDEX(ctx.eth_addrs, i);
 
-		if (maintain_peer(peer))
-			i++;
+		fastd_timer_cancel(&addr->timer);
+		free(addr);
 	}
 
-	eth_addr_cleanup();
+	VECTOR_RESIZE(ctx.eth_addrs, 0);
 }
 
 /** Resets all peers */
@@ -33,6 +33,7 @@
 #pragma once
 
 #include "fastd.h"
+#include "peer_rtt.h"
 
 
 /** The state of a peer */
@@ -54,50 +55,67 @@ typedef enum fastd_peer_config_state {
 #endif
 } fastd_peer_config_state_t;
 
-/** A peer's configuration and state */
-struct fastd_peer {
+/**
+   A peer's configuration and state
+
+   The fields used for every packet are kept together at the beginning of the
+   cache-line-aligned structure, so the data path touches as few cache lines as
+   possible: the fields before the statistics and the RX and TX counters (which
+   come first in the statistics) fill the first two cache lines. The configuration
+   is kept in the same structure after them.
+*/
+struct __attribute__((aligned(CACHELINE_SIZE))) fastd_peer {
+	/* The following fields are used on the data path: */
+
+	fastd_peer_state_t state;			/**< The peer's state */
+	fastd_peer_config_state_t config_state;		/**< Specifies the way this peer was configured and if it is enabled */
+
+	/** The socket used by the peer. This can either be a common bound socket or a
+	    dynamic, unbound socket that is used exclusively by this peer */
+	fastd_socket_t *sock;
+	fastd_protocol_peer_state_t *protocol_state;	/**< Protocol-specific peer state */
+
+	fastd_timeout_t timeout;			/**< The timeout after which the peer is reset */
+	fastd_timeout_t keepalive_timeout;		/**< The timeout after which a keepalive is sent to the peer */
+
+	fastd_peer_address_t address;			/**< The peers current address */
+	fastd_peer_address_t local_address;		/**< The local address used to communicate with this peer */
+
+	fastd_stats_t stats;				/**< Traffic statistics */
+
 	/* The following fields are more or less static configuration: */
 
 	uint64_t id;					/**< A unique ID assigned to each peer */
 
 	char *name;					/**< The peer's name */
-	const fastd_peer_group_t *group;		/**< The peer group the peer belongs to */
+	fastd_peer_group_t *group;			/**< The peer group the peer belongs to */
 	const char *config_source_dir;			/**< The directory this peer's configuration was loaded from */
 
 	VECTOR(fastd_remote_t) remotes;			/**< The vector of the peer's remotes */
 	bool floating;					/**< Specifies if the peer has any floating remotes */
 
-	fastd_peer_config_state_t config_state;		/**< Specifies the way this peer was configured and if it is enabled */
-
 	fastd_protocol_key_t *key;			/**< The peer's public key */
-	fastd_protocol_peer_state_t *protocol_state;	/**< Protocol-specific peer state */
 
-	/* Starting here, more dynamic fields follow: */
-
-	/** The socket used by the peer. This can either be a common bound socket or a
-	    dynamic, unbound socket that is used exclusively by this peer */
-	fastd_socket_t *sock;
-	fastd_peer_address_t local_address;		/**< The local address used to communicate with this peer */
-	fastd_peer_address_t address;			/**< The peers current address */
+	/* Starting here, the state used for handshakes and maintenance follows: */
 
 	fastd_peer_address_t last_handshake_address;	/**< The address the last handshake was sent to */
 	fastd_peer_address_t last_handshake_response_address; /**< The address the last handshake was received from */
 	ssize_t next_remote;				/**< An index into the field remotes or -1 */
 
-	fastd_peer_state_t state;			/**< The peer's state */
-
-	fastd_timeout_t next_handshake;			/**< The time of the next handshake */
 	fastd_timeout_t last_handshake_timeout;		/**< No handshakes are sent to the peer until this timeout has occured to avoid flooding the peer */
 	fastd_timeout_t last_handshake_response_timeout; /**< All handshakes from last_handshake_address will be ignored until this timeout has occured */
+	fastd_peer_address_t handshake_cookie_address;	/**< The address handshake_cookie was received from */
+	fastd_timeout_t handshake_cookie_timeout;	/**< The time after which handshake_cookie isn't used anymore */
+	uint8_t handshake_cookie[HANDSHAKE_COOKIE_BYTES]; /**< The last handshake cookie received from the peer */
+	bool handshake_cookie_retried;			/**< Specifies if the last handshake sent to the peer has already been repeated with a cookie */
+
 	fastd_timeout_t establish_handshake_timeout;	/**< A timeout during which all handshakes for this peer will be ignored after a new connection has been established */
 	int64_t established;				/**< The time this peer connection has been established */
+	VECTOR(fastd_peer_eth_addr_t *) eth_addrs;	/**< The MAC addresses learned on this peer (the entries are shared with ctx.eth_addrs) */
 
-	fastd_timeout_t timeout;			/**< The timeout after which the peer is reset */
-	fastd_timeout_t keepalive_timeout;		/**< The timeout after which a keepalive is sent to the peer */
-
-	fastd_stats_t stats;				/**< Traffic statistics */
-
-	fastd_dlist_head_t handshake_entry;		/**< Entry in the handshake queue */
+	fastd_timer_t handshake_timer;			/**< The timer for the next scheduled handshake */
+	fastd_timer_t maintenance_timer;		/**< The timer for the peer timeout and keepalive checks */
+	fastd_peer_rtt_t rtt;				/**< The round-trip time estimation (kept across connections) */
 
 #ifdef WITH_DYNAMIC_PEERS
 	fastd_timeout_t verify_timeout;			/**< Specifies the minimum time after which on-verify may be run again */
@@ -122,6 +140,9 @@ struct fastd_peer_group {
 	/* constraints */
 	int max_connections;				/**< The maximum number of connections to allow in this group; -1 for no limit */
 	fastd_string_stack_t *methods;			/**< The list of configured method names */
+
+	/* state */
+	size_t n_established;				/**< The number of established connections of peers in this group and its subgroups */
 };
 
 /** An entry for a MAC address seen at another peer */
@@ -129,6 +150,9 @@ struct fastd_peer_eth_addr {
 	fastd_eth_addr_t addr;				/**< The MAC address */
 	fastd_peer_t *peer;				/**< The corresponding peer */
 	fastd_timeout_t timeout;			/**< Timeout after which the address entry will be purged */
+	size_t peer_index;				/**< The index of the entry in the eth_addrs vector of its peer */
+
+	fastd_timer_t timer;				/**< The timer for the removal of the address entry */
 };
 
 /** A remote entry */
@@ -162,6 +186,11 @@ static inline uint16_t fastd_peer_address_get_port(const fastd_peer_address_t *a
 	}
 }
 
+/** Allocates a new peer with all fields set to zero */
+static inline fastd_peer_t * fastd_peer_new(void) {
+	return fastd_new0_aligned(fastd_peer_t, CACHELINE_SIZE);
+}
+
 bool fastd_peer_add(fastd_peer_t *peer);
 void fastd_peer_reset(fastd_peer_t *peer);
 void fastd_peer_delete(fastd_peer_t *peer);
@@ -190,7 +219,7 @@ static inline void fastd_peer_schedule_handshake_default(fastd_peer_t *peer) {
 
 /** Cancels a scheduled handshake */
 static inline void fastd_peer_unschedule_handshake(fastd_peer_t *peer) {
-	fastd_dlist_remove(&peer->handshake_entry);
+	fastd_timer_cancel(&peer->handshake_timer);
 }
 
 #ifdef WITH_DYNAMIC_PEERS
@@ -207,7 +236,7 @@ static inline void fastd_peer_set_verified(fastd_peer_t *peer, bool ok) {
 
 /** Checks if there's a handshake queued for the peer */
 static inline bool fastd_peer_handshake_scheduled(fastd_peer_t *peer) {
-	return fastd_dlist_linked(&peer->handshake_entry);
+	return fastd_timer_scheduled(&peer->handshake_timer);
 }
 
 /** Checks if a peer is floating (is has at least one floating remote or no remotes at all) */
@@ -287,9 +316,9 @@ static inline bool fastd_eth_addr_is_unicast(fastd_eth_addr_t addr) {
 
 void fastd_peer_eth_addr_add(fastd_peer_t *peer, fastd_eth_addr_t addr);
 bool fastd_peer_find_by_eth_addr(const fastd_eth_addr_t addr, fastd_peer_t **peer);
+void fastd_peer_eth_addr_delete_all(fastd_peer_t *peer);
+void fastd_peer_eth_addr_free_all(void);
 
-void fastd_peer_handle_handshake_queue(void);
-void fastd_peer_maintenance(void);
 void fastd_peer_reset_all(void);
 
 /** Adds statistics for a single packet of a given size */
@@ -298,10 +327,20 @@ static inline void fastd_stats_add(UNUSED fastd_peer_t *peer, UNUSED fastd_stat_
 	if (!bytes)
 		return;
 
-	ctx.stats.packets[stat]++;
-	ctx.stats.bytes[stat] += bytes;
+	ctx.stats.counters[stat].packets++;
+	ctx.stats.counters[stat].bytes += bytes;
+
+	peer->stats.counters[stat].packets++;
+	peer->stats.counters[stat].bytes += bytes;
+#endif
+}
+
+/** Counts a dropped packet (\e peer may be NULL if the packet can't be associated with a peer) */
+static inline void fastd_stats_drop(UNUSED fastd_peer_t *peer, UNUSED fastd_drop_reason_t reason) {
+#ifdef WITH_STATUS_SOCKET
+	ctx.stats.dropped[reason]++;
 
-	peer->stats.packets[stat]++;
-	peer->stats.bytes[stat] += bytes;
+	if (peer)
+		peer->stats.dropped[reason]++;
 #endif
 }
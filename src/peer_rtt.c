@@ -0,0 +1,154 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Round-trip time and loss estimation using in-band probes
+*/
+
+
+#include "peer.h"
+
+#include <arpa/inet.h>
+
+
+/**
+   The payload of an RTT probe
+
+   The timestamp is only interpreted by the sender of a probe, so it is sent in the sender's
+   clock and wraps around after about 71 minutes.
+*/
+typedef struct __attribute__((packed)) rtt_probe {
+	uint8_t type;			/**< The probe type (see fastd_rtt_probe_type_t) */
+	uint8_t rsv;			/**< Reserved (set to 0) */
+	uint32_t seq;			/**< The sequence number of the probe (big endian) */
+	uint32_t timestamp;		/**< The time the probe has been sent in microseconds (big endian) */
+} rtt_probe_t;
+
+/** The weight of a new sample in the smoothed loss ratio (as a shift) */
+#define LOSS_WEIGHT_SHIFT 3
+
+
+/** Returns a monotonic timestamp in microseconds, truncated to 32 bits */
+static inline uint32_t get_timestamp(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint32_t)(1000000*(uint64_t)ts.tv_sec + ts.tv_nsec/1000);
+}
+
+/** Sends an RTT probe payload to a peer */
+static void send_probe(fastd_peer_t *peer, uint8_t type, uint32_t seq, uint32_t timestamp) {
+	fastd_buffer_t buffer = fastd_buffer_alloc(RTT_PROBE_LEN, conf.min_encrypt_head_space, conf.min_encrypt_tail_space);
+
+	rtt_probe_t probe = {
+		.type = type,
+		.rsv = 0,
+		.seq = htonl(seq),
+		.timestamp = htonl(timestamp),
+	};
+	memcpy(buffer.data, &probe, RTT_PROBE_LEN);
+
+	conf.protocol->send(peer, buffer);
+}
+
+/** Updates the smoothed loss ratio with the result of a probe */
+static inline void update_loss(fastd_peer_rtt_t *rtt, bool lost) {
+	rtt->loss -= rtt->loss >> LOSS_WEIGHT_SHIFT;
+
+	if (lost)
+		rtt->loss += 65536 >> LOSS_WEIGHT_SHIFT;
+}
+
+/** Updates the RTT estimates with a new sample (in microseconds) */
+static void update_rtt(fastd_peer_rtt_t *rtt, uint32_t sample) {
+	if (!rtt->srtt) {
+		rtt->srtt = sample ?: 1;
+		rtt->rttvar = sample/2;
+		rtt->jitter = 0;
+	}
+	else {
+		uint32_t delta = (sample > rtt->last_rtt) ? sample - rtt->last_rtt : rtt->last_rtt - sample;
+		uint32_t error = (sample > rtt->srtt) ? sample - rtt->srtt : rtt->srtt - sample;
+
+		rtt->jitter = ((uint64_t)15*rtt->jitter + delta)/16;
+		rtt->rttvar = ((uint64_t)3*rtt->rttvar + error)/4;
+		rtt->srtt = (((uint64_t)7*rtt->srtt + sample)/8) ?: 1;
+	}
+
+	rtt->last_rtt = sample;
+}
+
+/**
+   Sends the next RTT probe to a peer
+
+   A probe that hasn't been answered when the next one is sent is counted as lost.
+*/
+void fastd_peer_rtt_send_probe(fastd_peer_t *peer) {
+	fastd_peer_rtt_t *rtt = &peer->rtt;
+
+	if (rtt->pending) {
+		rtt->probes_lost++;
+		update_loss(rtt, true);
+	}
+
+	rtt->seq++;
+	rtt->pending = true;
+	rtt->probes_sent++;
+	rtt->next_probe = ctx.now + 1000*(fastd_timeout_t)conf.rtt_probe_interval;
+
+	pr_debug2("sending RTT probe %u to %P", (unsigned)rtt->seq, peer);
+	send_probe(peer, RTT_PROBE_REQUEST, rtt->seq, get_timestamp());
+}
+
+/** Handles an RTT probe received from a peer, echoing requests and evaluating replies */
+void fastd_peer_rtt_handle_probe(fastd_peer_t *peer, fastd_buffer_t buffer) {
+	rtt_probe_t probe;
+	memcpy(&probe, buffer.data, RTT_PROBE_LEN);
+	fastd_buffer_free(buffer);
+
+	uint32_t seq = ntohl(probe.seq);
+
+	if (probe.type == RTT_PROBE_REQUEST) {
+		send_probe(peer, RTT_PROBE_REPLY, seq, ntohl(probe.timestamp));
+		return;
+	}
+
+	fastd_peer_rtt_t *rtt = &peer->rtt;
+
+	if (!rtt->pending || seq != rtt->seq) {
+		pr_debug2("ignoring unexpected RTT probe reply %u from %P", (unsigned)seq, peer);
+		return;
+	}
+
+	uint32_t sample = get_timestamp() - ntohl(probe.timestamp);
+
+	rtt->pending = false;
+	update_loss(rtt, false);
+	update_rtt(rtt, sample);
+
+	pr_debug2("RTT to %P: %u us (smoothed: %u us, jitter: %u us)", peer, (unsigned)sample, (unsigned)rtt->srtt, (unsigned)rtt->jitter);
+}
@@ -0,0 +1,87 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Round-trip time and loss estimation using in-band probes
+
+   A probe is a short payload packet containing a sequence number and a timestamp, which is echoed
+   by the peer. Probes are shorter than an ethernet header and start with an invalid IP version, so
+   they can't be confused with actual payload in either mode. Peers signal that they echo probes
+   with an empty RTT probe record in their handshakes.
+*/
+
+
+#pragma once
+
+#include "fastd.h"
+
+
+/** The length of an RTT probe payload */
+#define RTT_PROBE_LEN 10
+
+/** The type of an RTT probe (the first byte of its payload) */
+typedef enum fastd_rtt_probe_type {
+	RTT_PROBE_REQUEST = 1,		/**< A probe to be echoed */
+	RTT_PROBE_REPLY = 2,		/**< An echoed probe */
+} fastd_rtt_probe_type_t;
+
+
+/** The round-trip time estimation state of a peer */
+typedef struct fastd_peer_rtt {
+	bool supported;			/**< Specifies if the peer has signalled that it echoes probes */
+	bool pending;			/**< Specifies if the last probe hasn't been answered yet */
+	uint32_t seq;			/**< The sequence number of the last probe */
+	fastd_timeout_t next_probe;	/**< The time the next probe is due */
+
+	uint32_t last_rtt;		/**< The last RTT sample in microseconds */
+	uint32_t srtt;			/**< The smoothed RTT in microseconds (0 if no sample has been taken yet) */
+	uint32_t rttvar;		/**< The RTT variation in microseconds (as defined in RFC 6298) */
+	uint32_t jitter;		/**< The interarrival jitter of the RTT samples in microseconds (as defined in RFC 3550) */
+	uint32_t loss;			/**< The smoothed ratio of unanswered probes in units of 1/65536 */
+
+	uint64_t probes_sent;		/**< The number of probes sent to the peer */
+	uint64_t probes_lost;		/**< The number of probes that have not been answered before the next probe was due */
+} fastd_peer_rtt_t;
+
+
+void fastd_peer_rtt_send_probe(fastd_peer_t *peer);
+void fastd_peer_rtt_handle_probe(fastd_peer_t *peer, fastd_buffer_t buffer);
+
+
+/** Checks if RTT probes are sent to a peer */
+static inline bool fastd_peer_rtt_enabled(const fastd_peer_rtt_t *rtt) {
+	return rtt->supported && conf.rtt_probe_interval;
+}
+
+/** Checks if a decrypted payload packet is an RTT probe */
+static inline bool fastd_peer_rtt_is_probe(const fastd_buffer_t buffer) {
+	if (buffer.len != RTT_PROBE_LEN)
+		return false;
+
+	uint8_t type = *(const uint8_t *)buffer.data;
+	return (type == RTT_PROBE_REQUEST || type == RTT_PROBE_REPLY);
+}
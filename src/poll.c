@@ -51,21 +51,6 @@
 #endif
 
 
-/** Returns the time to the next handshake or -1 */
-static inline int handshake_timeout(void) {
-	if (!ctx.handshake_queue.next)
-		return -1;
-
-	fastd_peer_t *peer = container_of(ctx.handshake_queue.next, fastd_peer_t, handshake_entry);
-
-	int diff_msec = peer->next_handshake - ctx.now;
-	if (diff_msec < 0)
-		return 0;
-	else
-		return diff_msec;
-}
-
-
 #ifdef USE_EPOLL
 
 
@@ -102,6 +87,26 @@ void fastd_poll_init(void) {
 		if (epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.status_fd, &event_status) < 0)
 			exit_errno("epoll_ctl");
 	}
+
+	if (ctx.metrics_fd >= 0) {
+		struct epoll_event event_metrics = {
+			.events = EPOLLIN,
+			.data.ptr = &ctx.metrics_fd,
+		};
+
+		if (epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.metrics_fd, &event_metrics) < 0)
+			exit_errno("epoll_ctl");
+	}
+
+	if (ctx.control_fd >= 0) {
+		struct epoll_event event_control = {
+			.events = EPOLLIN,
+			.data.ptr = &ctx.control_fd,
+		};
+
+		if (epoll_ctl(ctx.epoll_fd, EPOLL_CTL_ADD, ctx.control_fd, &event_control) < 0)
+			exit_errno("epoll_ctl");
+	}
 #endif
 }
 
@@ -150,14 +155,7 @@ void fastd_poll_delete_peer(UNUSED size_t i) {
 
 
 void fastd_poll_handle(void) {
-	int maintenance_timeout = ctx.next_maintenance - ctx.now;
-
-	if (maintenance_timeout < 0)
-		maintenance_timeout = 0;
-
-	int timeout = handshake_timeout();
-	if (timeout < 0 || timeout > maintenance_timeout)
-		timeout = maintenance_timeout;
+	int timeout = fastd_timer_timeout();
 
 	struct epoll_event events[16];
 	int ret = epoll_wait_unblocked(ctx.epoll_fd, events, 16, timeout);
@@ -184,6 +182,14 @@ void fastd_poll_handle(void) {
 			if (events[i].events & EPOLLIN)
 				fastd_status_handle();
 		}
+		else if (events[i].data.ptr == &ctx.metrics_fd) {
+			if (events[i].events & EPOLLIN)
+				fastd_status_handle_metrics();
+		}
+		else if (events[i].data.ptr == &ctx.control_fd) {
+			if (events[i].events & EPOLLIN)
+				fastd_status_handle_control();
+		}
 #endif
 		else {
 			fastd_socket_t *sock = events[i].data.ptr;
@@ -203,8 +209,11 @@ void fastd_poll_handle(void) {
 
 #else
 
+/** The number of file descriptors polled before the sockets (TUN/TAP, async pipe, status, metrics and control sockets) */
+#define POLL_FIXED_FDS 5
+
 void fastd_poll_init(void) {
-	VECTOR_RESIZE(ctx.pollfds, 3 + ctx.n_socks + VECTOR_LEN(ctx.peers));
+	VECTOR_RESIZE(ctx.pollfds, POLL_FIXED_FDS + ctx.n_socks + VECTOR_LEN(ctx.peers));
 
 	VECTOR_INDEX(ctx.pollfds, 0) = (struct pollfd) {
 		.fd = -1,
@@ -228,9 +237,29 @@ void fastd_poll_init(void) {
 		.revents = 0,
 	};
 
+	VECTOR_INDEX(ctx.pollfds, 3) = (struct pollfd) {
+#ifdef WITH_STATUS_SOCKET
+		.fd = ctx.metrics_fd,
+#else
+		.fd = -1,
+#endif
+		.events = POLLIN,
+		.revents = 0,
+	};
+
+	VECTOR_INDEX(ctx.pollfds, 4) = (struct pollfd) {
+#ifdef WITH_STATUS_SOCKET
+		.fd = ctx.control_fd,
+#else
+		.fd = -1,
+#endif
+		.events = POLLIN,
+		.revents = 0,
+	};
+
 	size_t i;
 	for (i = 0; i < ctx.n_socks + VECTOR_LEN(ctx.peers); i++) {
-		VECTOR_INDEX(ctx.pollfds, 3+i) = (struct pollfd) {
+		VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+i) = (struct pollfd) {
 			.fd = -1,
 			.events = POLLIN,
 			.revents = 0,
@@ -248,7 +277,7 @@ void fastd_poll_set_fd_tuntap(void) {
 }
 
 void fastd_poll_set_fd_sock(size_t i) {
-	VECTOR_INDEX(ctx.pollfds, 3+i).fd = ctx.socks[i].fd;
+	VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+i).fd = ctx.socks[i].fd;
 }
 
 void fastd_poll_set_fd_peer(size_t i) {
@@ -258,9 +287,9 @@ void fastd_poll_set_fd_peer(size_t i) {
 	fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
 
 	if (!peer->sock || !fastd_peer_is_socket_dynamic(peer))
-		VECTOR_INDEX(ctx.pollfds, 3+ctx.n_socks+i).fd = -1;
+		VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+ctx.n_socks+i).fd = -1;
 	else
-		VECTOR_INDEX(ctx.pollfds, 3+ctx.n_socks+i).fd = peer->sock->fd;
+		VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+ctx.n_socks+i).fd = peer->sock->fd;
 }
 
 void fastd_poll_add_peer(void) {
@@ -278,23 +307,16 @@ void fastd_poll_add_peer(void) {
 }
 
 void fastd_poll_delete_peer(size_t i) {
-	VECTOR_DELETE(ctx.pollfds, 3+ctx.n_socks+i);
+	VECTOR_DELETE(ctx.pollfds, POLL_FIXED_FDS+ctx.n_socks+i);
 }
 
 
 void fastd_poll_handle(void) {
 	size_t i;
 
-	int maintenance_timeout = ctx.next_maintenance - ctx.now;
-
-	if (maintenance_timeout < 0)
-		maintenance_timeout = 0;
-
-	int timeout = handshake_timeout();
-	if (timeout < 0 || timeout > maintenance_timeout)
-		timeout = maintenance_timeout;
+	int timeout = fastd_timer_timeout();
 
-	if (VECTOR_LEN(ctx.pollfds) != 3 + ctx.n_socks + VECTOR_LEN(ctx.peers))
+	if (VECTOR_LEN(ctx.pollfds) != POLL_FIXED_FDS + ctx.n_socks + VECTOR_LEN(ctx.peers))
 		exit_bug("fd count mismatch");
 
 	sigset_t set, oldset;
@@ -368,14 +390,18 @@ void fastd_poll_handle(void) {
 #ifdef WITH_STATUS_SOCKET
 	if (VECTOR_INDEX(ctx.pollfds, 2).revents & POLLIN)
 		fastd_status_handle();
+	if (VECTOR_INDEX(ctx.pollfds, 3).revents & POLLIN)
+		fastd_status_handle_metrics();
+	if (VECTOR_INDEX(ctx.pollfds, 4).revents & POLLIN)
+		fastd_status_handle_control();
 #endif
 
 	for (i = 0; i < ctx.n_socks; i++) {
-		if (VECTOR_INDEX(ctx.pollfds, 3+i).revents & (POLLERR|POLLHUP|POLLNVAL)) {
+		if (VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+i).revents & (POLLERR|POLLHUP|POLLNVAL)) {
 			fastd_socket_error(&ctx.socks[i]);
-			VECTOR_INDEX(ctx.pollfds, 3+i).fd = -1;
+			VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+i).fd = -1;
 		}
-		else if (VECTOR_INDEX(ctx.pollfds, 3+i).revents & POLLIN) {
+		else if (VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+i).revents & POLLIN) {
 			fastd_receive(&ctx.socks[i]);
 		}
 	}
@@ -383,15 +409,15 @@ void fastd_poll_handle(void) {
 	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
 		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
 
-		if (VECTOR_INDEX(ctx.pollfds, 3+ctx.n_socks+i).revents & (POLLERR|POLLHUP|POLLNVAL)) {
+		if (VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+ctx.n_socks+i).revents & (POLLERR|POLLHUP|POLLNVAL)) {
 			fastd_peer_reset_socket(peer);
 		}
-		else if (VECTOR_INDEX(ctx.pollfds, 3+ctx.n_socks+i).revents & POLLIN) {
+		else if (VECTOR_INDEX(ctx.pollfds, POLL_FIXED_FDS+ctx.n_socks+i).revents & POLLIN) {
 			fastd_receive(peer->sock);
 		}
 	}
 
-	if (VECTOR_LEN(ctx.pollfds) != 3 + ctx.n_socks + VECTOR_LEN(ctx.peers))
+	if (VECTOR_LEN(ctx.pollfds) != POLL_FIXED_FDS + ctx.n_socks + VECTOR_LEN(ctx.peers))
 		exit_bug("fd count mismatch");
 }
 
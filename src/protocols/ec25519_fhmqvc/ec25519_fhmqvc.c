@@ -51,6 +51,7 @@ static inline void check_session_refresh(fastd_peer_t *peer) {
 
 	if (!session->refreshing && session->method->provider->session_want_refresh(session->method_state)) {
 		pr_verbose("refreshing session with %P", peer);
+		fastd_trace_session_refresh(peer);
 		session->handshakes_cleaned = true;
 		session->refreshing = true;
 		fastd_peer_schedule_handshake(peer, 0);
@@ -126,23 +127,29 @@ static inline bool use_old_session(const fastd_protocol_peer_state_t *state) {
 
 /** Handles a payload packet received from a peer */
 static void protocol_handle_recv(fastd_peer_t *peer, fastd_buffer_t buffer) {
-	if (!peer->protocol_state || !check_session(peer))
+	if (!peer->protocol_state || !check_session(peer)) {
+		fastd_stats_drop(peer, DROP_REASON_NO_SESSION);
 		goto fail;
+	}
 
 	fastd_buffer_t recv_buffer;
-	bool ok = false, reordered;
+	bool ok = false;
+	fastd_tristate_t reordered;
 
 	if (is_session_valid(&peer->protocol_state->old_session)) {
-		reordered = false;
-		if (peer->protocol_state->old_session.method->provider->decrypt(peer, peer->protocol_state->old_session.method_state, &recv_buffer, buffer, &reordered))
-			ok = true;
+		reordered = fastd_tristate_false;
+		uint64_t start = fastd_latency_cycles();
+		ok = peer->protocol_state->old_session.method->provider->decrypt(peer, peer->protocol_state->old_session.method_state, &recv_buffer, buffer, &reordered);
+		fastd_latency_decrypt(peer->protocol_state->old_session.method, start);
 	}
 
 	if (!ok) {
-		reordered = false;
-		if (peer->protocol_state->session.method->provider->decrypt(peer, peer->protocol_state->session.method_state, &recv_buffer, buffer, &reordered)) {
-			ok = true;
+		reordered = fastd_tristate_false;
+		uint64_t start = fastd_latency_cycles();
+		ok = peer->protocol_state->session.method->provider->decrypt(peer, peer->protocol_state->session.method_state, &recv_buffer, buffer, &reordered);
+		fastd_latency_decrypt(peer->protocol_state->session.method, start);
 
+		if (ok) {
 			if (peer->protocol_state->old_session.method) {
 				pr_debug("invalidating old session with %P", peer);
 				peer->protocol_state->old_session.method->provider->session_free(peer->protocol_state->old_session.method_state);
@@ -163,14 +170,23 @@ static void protocol_handle_recv(fastd_peer_t *peer, fastd_buffer_t buffer) {
 	}
 
 	if (!ok) {
-		pr_verbose("verification failed for packet received from %P", peer);
+		pr_verbose_ratelimited("verification failed for packet received from %P", peer);
+		fastd_stats_drop(peer, DROP_REASON_DECRYPT);
 		goto fail;
 	}
 
+	/* Replayed packets are dropped before they can keep the peer alive */
+	if (!reordered.set) {
+		fastd_buffer_free(recv_buffer);
+		return;
+	}
+
+	fastd_latency_rx_decrypted();
+	fastd_trace_packet_decrypted(peer, recv_buffer.len, reordered.state);
 	fastd_peer_seen(peer);
 
 	if (recv_buffer.len)
-		fastd_handle_receive(peer, recv_buffer, reordered);
+		fastd_handle_receive(peer, recv_buffer, reordered.state);
 	else
 		fastd_buffer_free(recv_buffer);
 
@@ -185,19 +201,28 @@ static void session_send(fastd_peer_t *peer, fastd_buffer_t buffer, protocol_ses
 	size_t stat_size = buffer.len;
 
 	fastd_buffer_t send_buffer;
-	if (!session->method->provider->encrypt(peer, session->method_state, &send_buffer, buffer)) {
+	uint64_t start = fastd_latency_cycles();
+	bool ok = session->method->provider->encrypt(peer, session->method_state, &send_buffer, buffer);
+	fastd_latency_encrypt(session->method, start);
+
+	if (!ok) {
 		fastd_buffer_free(buffer);
-		pr_error("failed to encrypt packet for %P", peer);
+		pr_error_ratelimited("failed to encrypt packet for %P", peer);
+		fastd_stats_drop(peer, DROP_REASON_ENCRYPT);
 		return;
 	}
 
+	fastd_latency_tx_encrypted();
+	fastd_trace_packet_encrypted(peer, send_buffer.len);
 	fastd_send(peer->sock, &peer->local_address, &peer->address, peer, send_buffer, stat_size);
+	fastd_latency_tx_sent();
 	peer->keepalive_timeout = ctx.now + KEEPALIVE_TIMEOUT;
 }
 
 /** Encrypts and sends a packet to a peer */
 static void protocol_send(fastd_peer_t *peer, fastd_buffer_t buffer) {
 	if (!peer->protocol_state || !fastd_peer_is_established(peer) || !check_session(peer)) {
+		fastd_stats_drop(peer, DROP_REASON_NO_SESSION);
 		fastd_buffer_free(buffer);
 		return;
 	}
@@ -260,4 +285,6 @@ const fastd_protocol_t fastd_protocol_ec25519_fhmqvc = {
 
 	.set_shell_env = fastd_protocol_ec25519_fhmqvc_set_shell_env,
 	.describe_peer = fastd_protocol_ec25519_fhmqvc_describe_peer,
+
+	.get_cache_size = fastd_protocol_ec25519_fhmqvc_get_cache_size,
 };
@@ -33,9 +33,11 @@
 #pragma once
 
 #include "../../fastd.h"
+#include "../../latency.h"
 #include "../../method.h"
 #include "../../peer.h"
 #include "../../sha256.h"
+#include "../../trace.h"
 
 #include <libuecc/ecc.h>
 
@@ -60,6 +62,38 @@ typedef struct keypair {
 	aligned_int256_t public;		/**< The public key */
 } keypair_t;
 
+/** The number of 4-bit windows of a scalar used by the fixed-base table */
+#define BASE_TABLE_WINDOWS 64
+
+/** The number of precomputed multiples per window of the fixed-base table */
+#define BASE_TABLE_ENTRIES 8
+
+/** A point in affine coordinates */
+typedef struct affine_point {
+	ecc_int256_t x;				/**< The x coordinate */
+	ecc_int256_t y;				/**< The y coordinate */
+} affine_point_t;
+
+/**
+   A table of precomputed multiples of the base point
+
+   Entry [i][j] contains the point (j+1) * 16^i * B.
+*/
+typedef struct base_table {
+	affine_point_t entries[BASE_TABLE_WINDOWS][BASE_TABLE_ENTRIES]; /**< The precomputed points */
+} base_table_t;
+
+/** The number of precomputed multiples in a key table */
+#define KEY_TABLE_ENTRIES 8
+
+/** A table of the multiples 1..8 of a peer's public key */
+typedef struct key_table {
+	ecc_25519_work_t multiples[KEY_TABLE_ENTRIES]; /**< The precomputed points */
+} key_table_t;
+
+/** A cached key table of a peer */
+typedef struct key_table_entry key_table_entry_t;
+
 /** The protocol-specific configuration */
 struct fastd_protocol_config {
 	keypair_t key;				/**< The own keypair */
@@ -94,12 +128,20 @@ struct fastd_protocol_peer_state {
 
 	uint64_t last_serial;			/**< The serial number of the ephemeral keypair used for the last session establishment */
 
+	key_table_entry_t *key_table;		/**< The cached table of multiples of the peer's key (or NULL) */
+
 	/* handshake cache */
 	uint64_t last_handshake_serial;		/**< The serial number of the ephemeral keypair used in the last handshake */
 	aligned_int256_t peer_handshake_key;	/**< The peer's ephemeral public key used in the last handshake */
 	aligned_int256_t sigma;			/**< The value of sigma used in the last handshake */
 	fastd_sha256_t shared_handshake_key;	/**< The shared handshake key used in the last handshake */
 	fastd_sha256_t shared_handshake_key_compat; /**< The shared handshake key used in the last handshake (pre-v11 compatiblity protocol) */
+
+	/* session resumption */
+	aligned_int256_t resumption_secret;	/**< The secret derived during the establishment of the newest session, used to resume it */
+	fastd_timeout_t resumption_timeout;	/**< The time after which resumption_secret can't be used anymore */
+	aligned_int256_t resumption_nonce;	/**< The nonce sent in the last resumption request */
+	aligned_int256_t resumption_response_nonce; /**< The nonce sent in the last resumption reply */
 };
 
 
@@ -107,6 +149,8 @@ void fastd_protocol_ec25519_fhmqvc_maintenance(void);
 void fastd_protocol_ec25519_fhmqvc_init_peer_state(fastd_peer_t *peer);
 void fastd_protocol_ec25519_fhmqvc_reset_peer_state(fastd_peer_t *peer);
 void fastd_protocol_ec25519_fhmqvc_free_peer_state(fastd_peer_t *peer);
+const key_table_t * fastd_protocol_ec25519_fhmqvc_get_key_table(fastd_peer_t *peer);
+size_t fastd_protocol_ec25519_fhmqvc_get_cache_size(void);
 
 void fastd_protocol_ec25519_fhmqvc_handshake_init(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer);
 void fastd_protocol_ec25519_fhmqvc_handshake_handle(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const fastd_handshake_t *handshake, const fastd_method_info_t *method);
@@ -119,6 +163,11 @@ void fastd_protocol_ec25519_fhmqvc_send_empty(fastd_peer_t *peer, protocol_sessi
 
 fastd_peer_t * fastd_protocol_ec25519_fhmqvc_find_peer(const fastd_protocol_key_t *key);
 
+void fastd_protocol_ec25519_fhmqvc_base_table_init(base_table_t *table);
+void fastd_protocol_ec25519_fhmqvc_scalarmult_base(ecc_25519_work_t *out, const ecc_int256_t *n, const base_table_t *table);
+void fastd_protocol_ec25519_fhmqvc_key_table_init(key_table_t *table, const ecc_25519_work_t *point);
+void fastd_protocol_ec25519_fhmqvc_key_table_mult(ecc_25519_work_t *out, const ecc_int256_t *n, const key_table_t *table);
+
 void fastd_protocol_ec25519_fhmqvc_generate_key(void);
 void fastd_protocol_ec25519_fhmqvc_show_key(void);
 
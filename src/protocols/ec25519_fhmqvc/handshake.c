@@ -49,6 +49,10 @@
 #endif
 
 
+/** The all-zero salt used to derive the shared handshake keys */
+static const uint32_t zero_salt[FASTD_HMACSHA256_KEY_WORDS] = {};
+
+
 /** Derives a key of arbitraty length from the shared key material after a handshake using the HKDF algorithm */
 static void derive_key(fastd_sha256_t *out, size_t blocks, const uint32_t *salt, const char *method_name,
 		       const aligned_int256_t *A, const aligned_int256_t *B, const aligned_int256_t *X, const aligned_int256_t *Y,
@@ -92,78 +96,179 @@ static inline void supersede_session(fastd_peer_t *peer, const fastd_method_info
 	}
 }
 
-/** Initalizes a new session with a peer using a specified method */
-static inline bool new_session(fastd_peer_t *peer, const fastd_method_info_t *method, bool initiator,
-			       const aligned_int256_t *A, const aligned_int256_t *B, const aligned_int256_t *X, const aligned_int256_t *Y,
-			       const aligned_int256_t *sigma, const uint32_t *salt, uint64_t serial) {
-
-	supersede_session(peer, method);
+/**
+   Derives the session keys and initializes the method session state of a new session
 
+   This is called by the handshake worker threads, so it must not access any state of the main thread.
+   In compat mode, \e salt is NULL.
+*/
+static fastd_method_session_state_t * init_method_session(const fastd_method_info_t *method, bool initiator,
+							  const aligned_int256_t *A, const aligned_int256_t *B, const aligned_int256_t *X, const aligned_int256_t *Y,
+							  const aligned_int256_t *sigma, const uint32_t *salt) {
 	if (salt) {
 		size_t blocks = block_count(method->provider->key_length(method->method), sizeof(fastd_sha256_t));
 		fastd_sha256_t secret[blocks ?: 1];
 		derive_key(secret, blocks, salt, method->name, A, B, X, Y, sigma);
 
-		peer->protocol_state->session.method_state = method->provider->session_init(method->method, (const uint8_t *)secret, initiator);
+		fastd_method_session_state_t *method_state = method->provider->session_init(method->method, (const uint8_t *)secret, initiator);
+		secure_memzero(secret, sizeof(secret));
+
+		return method_state;
 	}
 	else {
+		if (!method->provider->session_init_compat)
+			return NULL;
+
 		fastd_sha256_t hash;
 		fastd_sha256_blocks(&hash, X->u32, Y->u32, A->u32, B->u32, sigma->u32, NULL);
-		peer->protocol_state->session.method_state = method->provider->session_init_compat(method->method, hash.b, HASHBYTES, initiator);
+
+		fastd_method_session_state_t *method_state = method->provider->session_init_compat(method->method, hash.b, HASHBYTES, initiator);
+		secure_memzero(&hash, sizeof(hash));
+
+		return method_state;
 	}
+}
+
+/** Installs an initialized method session state as the new session with a peer */
+static inline bool new_session(fastd_peer_t *peer, const fastd_method_info_t *method, fastd_method_session_state_t *method_state, uint64_t serial) {
+	supersede_session(peer, method);
+
+	peer->protocol_state->session.method_state = method_state;
 
-	if (!peer->protocol_state->session.method_state)
+	if (!method_state)
 		return false;
 
 	peer->protocol_state->session.handshakes_cleaned = false;
 	peer->protocol_state->session.refreshing = false;
 	peer->protocol_state->session.method = method;
-	peer->protocol_state->last_serial = serial;
+
+	if (serial)
+		peer->protocol_state->last_serial = serial;
 
 	return true;
 }
 
-/** Establishes a connection with a peer after a successful handshake */
-static bool establish(fastd_peer_t *peer, const fastd_method_info_t *method, fastd_socket_t *sock,
-		      const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, bool initiator,
-		      const aligned_int256_t *A, const aligned_int256_t *B, const aligned_int256_t *X, const aligned_int256_t *Y,
-		      const aligned_int256_t *sigma, const uint32_t *salt, uint64_t serial) {
-	if (serial <= peer->protocol_state->last_serial) {
+/**
+   A handshake whose key derivation is performed by a worker thread
+
+   The job contains copies of all keys it needs, so the worker doesn't need to access
+   any state of the main thread besides the (constant) protocol configuration.
+
+   For resumption handshakes, the nonces take the place of the ephemeral keys (with a serial of 0)
+   and the resumption secret takes the place of sigma; these jobs are submitted with the shared
+   handshake key derived already.
+*/
+typedef struct handshake_job {
+	fastd_worker_job_t job;			/**< The worker job */
+
+	uint8_t type;				/**< The type of the received handshake */
+	bool initiator;				/**< true if the handshake was initiated by the local side */
+	bool compat;				/**< true if a received reply uses the pre-v11 compatiblity protocol */
+	bool little_endian;			/**< The handshake endianess */
+	bool derive_key;			/**< Specifies if shared_handshake_key is derived */
+	bool derive_key_compat;			/**< Specifies if shared_handshake_key_compat is derived */
+	bool resumption;			/**< true if the job handles a resumption handshake */
+	bool resumable;				/**< Specifies if a resumption secret is derived for the new session */
+	bool rtt_probe;				/**< Specifies if the peer has signalled support for RTT probes */
+
+	uint64_t peer_id;			/**< The ID of the peer the handshake was received from */
+	fastd_socket_t *sock;			/**< The socket the handshake was received on */
+	bool peer_sock;				/**< true if \e sock belongs to the peer (and may be closed before the job is completed) */
+	fastd_peer_address_t local_addr;	/**< The local address the handshake was received on */
+	fastd_peer_address_t remote_addr;	/**< The address the handshake was received from */
+	const fastd_method_info_t *method;	/**< The method of the handshake */
+
+	handshake_key_t handshake_key;		/**< The local ephemeral keypair */
+	aligned_int256_t peer_key;		/**< The peer's public key */
+	key_table_t peer_key_table;		/**< The table of multiples of the peer's public key */
+	aligned_int256_t peer_handshake_key;	/**< The peer's ephemeral public key */
+
+	bool derived;				/**< Set when the shared handshake key has been derived successfully */
+	bool valid;				/**< Set by the worker when the MAC of a received reply is valid */
+	aligned_int256_t sigma;			/**< The derived value of sigma */
+	fastd_sha256_t shared_handshake_key;	/**< The derived shared handshake key */
+	fastd_sha256_t shared_handshake_key_compat; /**< The derived shared handshake key (pre-v11 compatiblity protocol) */
+
+	fastd_method_session_state_t *method_state; /**< The method session state of the new session, initialized by the worker after a valid reply */
+	aligned_int256_t resumption_secret;	/**< The resumption secret of the new session (if \e resumable is set) */
+
+	uint8_t handshake_tag[HASHBYTES];	/**< The handshake tag of a received reply (compat mode) */
+	size_t tlv_mac_offset;			/**< The offset of the TLV MAC in \e tlv_data */
+	size_t tlv_len;				/**< The length of \e tlv_data */
+	uint8_t tlv_data[] __attribute__((aligned(8))); /**< The TLV records of a received reply */
+} handshake_job_t;
+
+/**
+   Establishes a connection with a peer after a successful handshake
+
+   The method session state initialized by the worker thread is taken over by the session; it is freed
+   when the session can't be established.
+
+   For resumed sessions, the serial of the handshake key is 0, as no ephemeral keys are used.
+*/
+static bool establish(handshake_job_t *job, fastd_peer_t *peer) {
+	const fastd_method_info_t *method = job->method;
+	const fastd_peer_address_t *remote_addr = &job->remote_addr;
+	uint64_t serial = job->handshake_key.serial;
+	bool refresh = fastd_peer_is_established(peer);
+
+	fastd_method_session_state_t *method_state = job->method_state;
+	job->method_state = NULL;
+
+	if (serial && serial <= peer->protocol_state->last_serial) {
 		pr_debug("ignoring handshake from %P[%I] because of handshake key reuse", peer, remote_addr);
-		return false;
+		goto fail;
 	}
 
-	if (!salt && !method->provider->session_init_compat) {
+	if (job->compat && !method->provider->session_init_compat) {
 		pr_warn("can't establish compat session with %P[%I] (method without compat support)", peer, remote_addr);
-		return false;
+		goto fail;
 	}
 
 	pr_verbose("%I authorized as %P", remote_addr, peer);
 
-	if (!fastd_peer_claim_address(peer, sock, local_addr, remote_addr, true)) {
+	if (!fastd_peer_claim_address(peer, job->sock, &job->local_addr, remote_addr, true)) {
 		pr_warn("can't establish session with %P[%I] as the address is used by another peer", peer, remote_addr);
 		fastd_peer_reset(peer);
-		return false;
+		goto fail;
 	}
 
-	if (!new_session(peer, method, initiator, A, B, X, Y, sigma, salt, serial)) {
-		pr_error("failed to initialize method session for %P (method `%s'%s)", peer, method->name, salt ? "" : ", compat mode");
+	if (!new_session(peer, method, method_state, serial)) {
+		pr_error("failed to initialize method session for %P (method `%s'%s)", peer, method->name, job->compat ? ", compat mode" : "");
 		fastd_peer_reset(peer);
 		return false;
 	}
 
+	if (job->resumable) {
+		peer->protocol_state->resumption_secret = job->resumption_secret;
+		peer->protocol_state->resumption_timeout = ctx.now + KEY_VALID + 1000 * (fastd_timeout_t)conf.handshake_resumption_window;
+	}
+	else {
+		peer->protocol_state->resumption_timeout = ctx.now;
+	}
+
 	peer->establish_handshake_timeout = ctx.now + MIN_HANDSHAKE_INTERVAL;
+	peer->rtt.supported = job->rtt_probe;
 	fastd_peer_seen(peer);
 	fastd_peer_set_established(peer);
 
-	pr_verbose("new session with %P established using method `%s'%s.", peer, method->name, salt ? "" : " (compat mode)");
+	if (refresh)
+		fastd_status_event(STATUS_EVENT_SESSION_REFRESHED, peer);
 
-	if (initiator)
+	pr_verbose("new session with %P established using method `%s'%s.", peer, method->name, job->compat ? " (compat mode)" : "");
+
+	if (job->initiator)
 		fastd_peer_schedule_handshake_default(peer);
 	else
 		fastd_protocol_ec25519_fhmqvc_send_empty(peer, &peer->protocol_state->session);
 
 	return true;
+
+ fail:
+	if (method_state)
+		method->provider->session_free(method_state);
+
+	return false;
 }
 
 
@@ -180,12 +285,11 @@ static inline bool secure_handshake(const fastd_handshake_t *handshake) {
 
 /** Derives the shares handshake key for computing the MACs used in the handshake */
 static bool make_shared_handshake_key(bool initiator, const keypair_t *handshake_key,
-				      const fastd_protocol_key_t *peer_key, const aligned_int256_t *peer_handshake_key,
+				      const aligned_int256_t *peer_key, const key_table_t *peer_key_table,
+				      const aligned_int256_t *peer_handshake_key,
 				      aligned_int256_t *sigma,
 				      fastd_sha256_t *shared_handshake_key,
 				      fastd_sha256_t *shared_handshake_key_compat) {
-	static const uint32_t zero_salt[FASTD_HMACSHA256_KEY_WORDS] = {};
-
 	const aligned_int256_t *A, *B, *X, *Y;
 	ecc_25519_work_t work, workXY;
 
@@ -197,12 +301,12 @@ static bool make_shared_handshake_key(bool initiator, const keypair_t *handshake
 
 	if (initiator) {
 		A = &conf.protocol_config->key.public;
-		B = &peer_key->key;
+		B = peer_key;
 		X = &handshake_key->public;
 		Y = peer_handshake_key;
 	}
 	else {
-		A = &peer_key->key;
+		A = peer_key;
 		B = &conf.protocol_config->key.public;
 		X = peer_handshake_key;
 		Y = &handshake_key->public;
@@ -224,14 +328,14 @@ static bool make_shared_handshake_key(bool initiator, const keypair_t *handshake
 		ecc_25519_gf_mult(&da, &d, &conf.protocol_config->key.secret);
 		ecc_25519_gf_add(&s, &da, &handshake_key->secret);
 
-		ecc_25519_scalarmult(&work, &e, &peer_key->unpacked);
+		fastd_protocol_ec25519_fhmqvc_key_table_mult(&work, &e, peer_key_table);
 	}
 	else {
 		ecc_int256_t eb;
 		ecc_25519_gf_mult(&eb, &e, &conf.protocol_config->key.secret);
 		ecc_25519_gf_add(&s, &eb, &handshake_key->secret);
 
-		ecc_25519_scalarmult(&work, &d, &peer_key->unpacked);
+		fastd_protocol_ec25519_fhmqvc_key_table_mult(&work, &d, peer_key_table);
 	}
 
 	ecc_25519_add(&work, &workXY, &work);
@@ -263,27 +367,20 @@ static bool make_shared_handshake_key(bool initiator, const keypair_t *handshake
 	return true;
 }
 
-/** Checks if the currently cached shared handshake key is valid and generates a new one otherwise  */
-static bool update_shared_handshake_key(const fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key) {
-	if (peer->protocol_state->last_handshake_serial == handshake_key->serial) {
-		if (secure_memequal(&peer->protocol_state->peer_handshake_key, peer_handshake_key, PUBLICKEYBYTES))
-			return true;
-	}
-
-	bool compat = !conf.secure_handshakes;
-
-	if (!make_shared_handshake_key(false, &handshake_key->key,
-				       peer->key,
-				       peer_handshake_key,
-				       &peer->protocol_state->sigma,
-				       &peer->protocol_state->shared_handshake_key,
-				       compat ? &peer->protocol_state->shared_handshake_key_compat : NULL))
-		return false;
+/** Checks if the cached shared handshake key of a peer was derived from the given ephemeral keys */
+static inline bool has_shared_handshake_key(const fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key) {
+	return (peer->protocol_state->last_handshake_serial == handshake_key->serial
+		&& secure_memequal(&peer->protocol_state->peer_handshake_key, peer_handshake_key, PUBLICKEYBYTES));
+}
 
-	peer->protocol_state->last_handshake_serial = handshake_key->serial;
+/** Stores a newly derived shared handshake key in the handshake cache of a peer */
+static void cache_shared_handshake_key(const fastd_peer_t *peer, uint64_t serial, const aligned_int256_t *peer_handshake_key, const aligned_int256_t *sigma,
+				       const fastd_sha256_t *shared_handshake_key, const fastd_sha256_t *shared_handshake_key_compat) {
+	peer->protocol_state->last_handshake_serial = serial;
 	peer->protocol_state->peer_handshake_key = *peer_handshake_key;
-
-	return true;
+	peer->protocol_state->sigma = *sigma;
+	peer->protocol_state->shared_handshake_key = *shared_handshake_key;
+	peer->protocol_state->shared_handshake_key_compat = *shared_handshake_key_compat;
 }
 
 /** Resets the handshake cache for a peer */
@@ -296,16 +393,25 @@ static void clear_shared_handshake_key(const fastd_peer_t *peer) {
 	memset(&peer->protocol_state->peer_handshake_key, 0, sizeof(peer->protocol_state->peer_handshake_key));
 }
 
-/** Sends a reply to an initial handshake (type 1) */
-static void respond_handshake(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
-			      const aligned_int256_t *peer_handshake_key, const fastd_method_info_t *method, bool little_endian) {
-	pr_debug("responding handshake with %P[%I]...", peer, remote_addr);
-
-	const handshake_key_t *handshake_key = &ctx.protocol_state->handshake_key;
+/** Verifies the TLV MAC (or the handshake tag in compat mode) of a handshake reply; the TLV MAC field is zeroed in the process */
+static bool verify_reply(bool compat, const void *tlv_data, size_t tlv_len, uint8_t *tlv_mac, const uint8_t *handshake_tag,
+			 const fastd_sha256_t *shared_handshake_key, const fastd_sha256_t *shared_handshake_key_compat,
+			 const aligned_int256_t *peer_key, const aligned_int256_t *peer_handshake_key) {
+	if (!compat) {
+		uint8_t mac[HASHBYTES] __attribute__((aligned(8)));
+		memcpy(mac, tlv_mac, HASHBYTES);
+		memset(tlv_mac, 0, HASHBYTES);
 
-	if (!update_shared_handshake_key(peer, handshake_key, peer_handshake_key))
-		return;
+		return fastd_hmacsha256_verify(mac, shared_handshake_key->w, tlv_data, tlv_len);
+	}
+	else {
+		return fastd_hmacsha256_blocks_verify(handshake_tag, shared_handshake_key_compat->w, peer_key->u32, peer_handshake_key->u32, NULL);
+	}
+}
 
+/** Sends a reply to an initial handshake (type 1) using the cached shared handshake key */
+static void send_response(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
+			  const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key, const fastd_method_info_t *method, bool little_endian) {
 	fastd_handshake_buffer_t buffer = fastd_handshake_new_reply(2, little_endian, method, fastd_peer_get_methods(peer), 4*(4+PUBLICKEYBYTES) + 2*(4+HASHBYTES));
 
 	fastd_handshake_add(&buffer, RECORD_SENDER_KEY, PUBLICKEYBYTES, &conf.protocol_config->key.public);
@@ -327,64 +433,389 @@ static void respond_handshake(const fastd_socket_t *sock, const fastd_peer_addre
 	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
 }
 
-/** Sends a reply to a handshake response (type 2) */
-static void finish_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
-			     const fastd_handshake_t *handshake, const fastd_method_info_t *method) {
-	pr_debug("finishing handshake with %P[%I]...", peer, remote_addr);
+/** Establishes a session after a valid handshake response (type 2) and sends the handshake finish (type 3) */
+static void send_finish(handshake_job_t *job, fastd_peer_t *peer) {
+	if (!establish(job, peer))
+		return;
+
+	const handshake_key_t *handshake_key = &job->handshake_key;
+	fastd_handshake_buffer_t buffer = fastd_handshake_new_reply(3, job->little_endian, job->method, NULL, 4*(4+PUBLICKEYBYTES) + 2*(4+HASHBYTES));
 
-	bool compat = !secure_handshake(handshake);
+	fastd_handshake_add(&buffer, RECORD_SENDER_KEY, PUBLICKEYBYTES, &conf.protocol_config->key.public);
+	fastd_handshake_add(&buffer, RECORD_RECIPIENT_KEY, PUBLICKEYBYTES, &peer->key->key);
+	fastd_handshake_add(&buffer, RECORD_SENDER_HANDSHAKE_KEY, PUBLICKEYBYTES, &handshake_key->key.public);
+	fastd_handshake_add(&buffer, RECORD_RECIPIENT_HANDSHAKE_KEY, PUBLICKEYBYTES, &job->peer_handshake_key);
 
-	aligned_int256_t sigma;
-	fastd_sha256_t shared_handshake_key, shared_handshake_key_compat;
-	if (!make_shared_handshake_key(true, &handshake_key->key,
-				       peer->key,
-				       peer_handshake_key,
-				       &sigma,
-				       compat ? NULL : &shared_handshake_key,
-				       compat ? &shared_handshake_key_compat : NULL))
+	if (!job->compat) {
+		fastd_sha256_t hmacbuf;
+		uint8_t *mac = fastd_handshake_add_zero(&buffer, RECORD_TLV_MAC, HASHBYTES);
+		fastd_hmacsha256(&hmacbuf, job->shared_handshake_key.w, fastd_handshake_tlv_data(&buffer.buffer), fastd_handshake_tlv_len(&buffer.buffer));
+		memcpy(mac, hmacbuf.b, HASHBYTES);
+	}
+	else {
+		fastd_sha256_t hmacbuf;
+		fastd_hmacsha256_blocks(&hmacbuf, job->shared_handshake_key_compat.w, conf.protocol_config->key.public.u32, handshake_key->key.public.u32, NULL);
+		fastd_handshake_add(&buffer, RECORD_HANDSHAKE_TAG, HASHBYTES, hmacbuf.b);
+	}
+
+	fastd_send_handshake(job->sock, &job->local_addr, &job->remote_addr, peer, buffer.buffer);
+}
+
+
+/**
+   Checks if a session with a peer can be resumed using a resumption secret derived during an earlier handshake
+
+   Sessions with dynamic peers are never resumed, as they must be verified again after a session has been lost.
+*/
+static inline bool has_resumption_secret(const fastd_peer_t *peer) {
+	return (conf.handshake_resumption_window && !fastd_peer_is_dynamic(peer)
+		&& !fastd_timed_out(peer->protocol_state->resumption_timeout));
+}
+
+/** Computes the identifier of a peer's resumption secret, which is sent with resumption requests */
+static inline void get_resumption_id(fastd_sha256_t *out, const fastd_peer_t *peer) {
+	fastd_sha256_blocks(out, peer->protocol_state->resumption_secret.u32, NULL);
+}
+
+/**
+   Derives the key authenticating the handshake packets of a session resumption
+
+   The resumption secret takes the place of sigma and the nonces take the place of the
+   ephemeral keys, so the session keys can be derived in the same way as after a normal handshake.
+*/
+static void derive_resumption_key(fastd_sha256_t *out, const fastd_peer_t *peer, bool initiator,
+				  const aligned_int256_t *initiator_nonce, const aligned_int256_t *responder_nonce) {
+	const aligned_int256_t *A = initiator ? &conf.protocol_config->key.public : &peer->key->key;
+	const aligned_int256_t *B = initiator ? &peer->key->key : &conf.protocol_config->key.public;
+
+	derive_key(out, 1, zero_salt, "", A, B, initiator_nonce, responder_nonce, &peer->protocol_state->resumption_secret);
+}
+
+/** Adds the TLV MAC to a resumption handshake */
+static void add_resumption_mac(fastd_handshake_buffer_t *buffer, const fastd_sha256_t *resumption_key) {
+	fastd_sha256_t hmacbuf;
+	uint8_t *mac = fastd_handshake_add_zero(buffer, RECORD_TLV_MAC, HASHBYTES);
+	fastd_hmacsha256(&hmacbuf, resumption_key->w, fastd_handshake_tlv_data(&buffer->buffer), fastd_handshake_tlv_len(&buffer->buffer));
+	memcpy(mac, hmacbuf.b, HASHBYTES);
+}
+
+/**
+   Adds the records requesting a session resumption to an initial handshake
+
+   Resumption is only tried when no session with the peer is established, so periodic
+   session refreshes still perform a full key exchange.
+*/
+static void add_resumption_request(fastd_handshake_buffer_t *buffer, fastd_peer_t *peer) {
+	if (fastd_peer_is_established(peer) || !has_resumption_secret(peer))
 		return;
 
-	bool valid;
-	if (!compat) {
-		uint8_t mac[HASHBYTES] __attribute__((aligned(8)));
-		memcpy(mac, handshake->records[RECORD_TLV_MAC].data, HASHBYTES);
-		memset(handshake->records[RECORD_TLV_MAC].data, 0, HASHBYTES);
+	fastd_sha256_t id;
+	get_resumption_id(&id, peer);
+
+	fastd_random_bytes(&peer->protocol_state->resumption_nonce, PUBLICKEYBYTES, false);
+
+	fastd_handshake_add(buffer, RECORD_RESUMPTION_ID, HASHBYTES, id.b);
+	fastd_handshake_add(buffer, RECORD_SENDER_RESUMPTION_NONCE, PUBLICKEYBYTES, &peer->protocol_state->resumption_nonce);
+}
+
+/** Checks if an initial handshake requests the resumption of a session we have a resumption secret for */
+static bool is_resumption_request(const fastd_peer_t *peer, const fastd_handshake_t *handshake) {
+	if (!has_field(handshake, RECORD_RESUMPTION_ID, HASHBYTES) || !has_field(handshake, RECORD_SENDER_RESUMPTION_NONCE, PUBLICKEYBYTES))
+		return false;
+
+	if (!has_resumption_secret(peer))
+		return false;
+
+	fastd_sha256_t id;
+	get_resumption_id(&id, peer);
+
+	return secure_memequal(id.b, handshake->records[RECORD_RESUMPTION_ID].data, HASHBYTES);
+}
+
+/** Answers a resumption request with a resumption reply (type 2) */
+static void respond_resumption(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
+			       const fastd_handshake_t *handshake, const fastd_method_info_t *method) {
+	pr_debug("responding resumption request of %P[%I]...", peer, remote_addr);
+
+	aligned_int256_t initiator_nonce;
+	memcpy(&initiator_nonce, handshake->records[RECORD_SENDER_RESUMPTION_NONCE].data, PUBLICKEYBYTES);
+
+	fastd_random_bytes(&peer->protocol_state->resumption_response_nonce, PUBLICKEYBYTES, false);
+
+	fastd_sha256_t resumption_key;
+	derive_resumption_key(&resumption_key, peer, false, &initiator_nonce, &peer->protocol_state->resumption_response_nonce);
+
+	fastd_handshake_buffer_t buffer = fastd_handshake_new_reply(2, handshake->little_endian, method, fastd_peer_get_methods(peer), 4*(4+PUBLICKEYBYTES) + 4+HASHBYTES);
+
+	fastd_handshake_add(&buffer, RECORD_SENDER_KEY, PUBLICKEYBYTES, &conf.protocol_config->key.public);
+	fastd_handshake_add(&buffer, RECORD_RECIPIENT_KEY, PUBLICKEYBYTES, &peer->key->key);
+	fastd_handshake_add(&buffer, RECORD_SENDER_RESUMPTION_NONCE, PUBLICKEYBYTES, &peer->protocol_state->resumption_response_nonce);
+	fastd_handshake_add(&buffer, RECORD_RECIPIENT_RESUMPTION_NONCE, PUBLICKEYBYTES, &initiator_nonce);
+	add_resumption_mac(&buffer, &resumption_key);
+
+	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
+
+	secure_memzero(&resumption_key, sizeof(resumption_key));
+}
+
+/** Establishes a resumed session after a valid resumption reply (type 2) and sends the handshake finish (type 3) */
+static void finish_resumption(handshake_job_t *job, fastd_peer_t *peer) {
+	if (!establish(job, peer))
+		return;
+
+	fastd_handshake_buffer_t buffer = fastd_handshake_new_reply(3, job->little_endian, job->method, NULL, 4*(4+PUBLICKEYBYTES) + 4+HASHBYTES);
+
+	fastd_handshake_add(&buffer, RECORD_SENDER_KEY, PUBLICKEYBYTES, &conf.protocol_config->key.public);
+	fastd_handshake_add(&buffer, RECORD_RECIPIENT_KEY, PUBLICKEYBYTES, &peer->key->key);
+	fastd_handshake_add(&buffer, RECORD_SENDER_RESUMPTION_NONCE, PUBLICKEYBYTES, &job->handshake_key.key.public);
+	fastd_handshake_add(&buffer, RECORD_RECIPIENT_RESUMPTION_NONCE, PUBLICKEYBYTES, &job->peer_handshake_key);
+	add_resumption_mac(&buffer, &job->shared_handshake_key);
+
+	fastd_send_handshake(job->sock, &job->local_addr, &job->remote_addr, peer, buffer.buffer);
+}
+
+
+/**
+   Derives the session keys and the resumption secret of a new session after a valid reply (called in a worker thread)
 
-		valid = fastd_hmacsha256_verify(mac, shared_handshake_key.w, handshake->tlv_data, handshake->tlv_len);
+   Doing this in the worker keeps the cipher and MAC key schedules of session refreshes out of the main thread;
+   the main thread only needs to install the prepared session state.
+*/
+static void init_job_session(handshake_job_t *job) {
+	const aligned_int256_t *A, *B, *X, *Y;
+
+	if (job->initiator) {
+		A = &job->handshake_key.key.public;
+		B = &job->peer_handshake_key;
+		X = &conf.protocol_config->key.public;
+		Y = &job->peer_key;
 	}
 	else {
-		valid = fastd_hmacsha256_blocks_verify(handshake->records[RECORD_HANDSHAKE_TAG].data, shared_handshake_key_compat.w, peer->key->key.u32, peer_handshake_key->u32, NULL);
+		A = &job->peer_handshake_key;
+		B = &job->handshake_key.key.public;
+		X = &job->peer_key;
+		Y = &conf.protocol_config->key.public;
 	}
 
-	if (!valid) {
-		pr_warn("received invalid protocol handshake response from %P[%I]", peer, remote_addr);
+	const uint32_t *salt = job->compat ? NULL : job->shared_handshake_key.w;
+
+	job->method_state = init_method_session(job->method, job->initiator, A, B, X, Y, &job->sigma, salt);
+
+	if (!salt) {
+		job->resumable = false;
 		return;
 	}
 
-	if (!establish(peer, method, sock, local_addr, remote_addr, true, &handshake_key->key.public, peer_handshake_key, &conf.protocol_config->key.public,
-		       &peer->key->key, &sigma, compat ? NULL : shared_handshake_key.w, handshake_key->serial))
+	if (job->resumable) {
+		fastd_sha256_t resumption_secret;
+		derive_key(&resumption_secret, 1, salt, "resumption", A, B, X, Y, &job->sigma);
+
+		memcpy(&job->resumption_secret, resumption_secret.b, sizeof(job->resumption_secret));
+		secure_memzero(&resumption_secret, sizeof(resumption_secret));
+	}
+}
+
+/** Derives the shared handshake key of a handshake job, verifies the received reply and initializes the new session (called in a worker thread) */
+static void handshake_job_run(fastd_worker_job_t *worker_job) {
+	handshake_job_t *job = container_of(worker_job, handshake_job_t, job);
+
+	if (!job->derived) {
+		if (!make_shared_handshake_key(job->initiator, &job->handshake_key.key,
+					       &job->peer_key, &job->peer_key_table,
+					       &job->peer_handshake_key,
+					       &job->sigma,
+					       job->derive_key ? &job->shared_handshake_key : NULL,
+					       job->derive_key_compat ? &job->shared_handshake_key_compat : NULL))
+			return;
+
+		job->derived = true;
+	}
+
+	if (job->type == 1)
 		return;
 
-	fastd_handshake_buffer_t buffer = fastd_handshake_new_reply(3, handshake->little_endian, method, NULL, 4*(4+PUBLICKEYBYTES) + 2*(4+HASHBYTES));
+	job->valid = verify_reply(job->compat, job->tlv_data, job->tlv_len, job->tlv_data + job->tlv_mac_offset, job->handshake_tag,
+				  &job->shared_handshake_key, &job->shared_handshake_key_compat, &job->peer_key, &job->peer_handshake_key);
 
-	fastd_handshake_add(&buffer, RECORD_SENDER_KEY, PUBLICKEYBYTES, &conf.protocol_config->key.public);
-	fastd_handshake_add(&buffer, RECORD_RECIPIENT_KEY, PUBLICKEYBYTES, &peer->key->key);
-	fastd_handshake_add(&buffer, RECORD_SENDER_HANDSHAKE_KEY, PUBLICKEYBYTES, &handshake_key->key.public);
-	fastd_handshake_add(&buffer, RECORD_RECIPIENT_HANDSHAKE_KEY, PUBLICKEYBYTES, peer_handshake_key);
+	if (job->valid)
+		init_job_session(job);
+}
 
-	if (!compat) {
-		fastd_sha256_t hmacbuf;
-		uint8_t *mac = fastd_handshake_add_zero(&buffer, RECORD_TLV_MAC, HASHBYTES);
-		fastd_hmacsha256(&hmacbuf, shared_handshake_key.w, fastd_handshake_tlv_data(&buffer.buffer), fastd_handshake_tlv_len(&buffer.buffer));
-		memcpy(mac, hmacbuf.b, HASHBYTES);
+/**
+   Checks if the nonce of a resumption job is still unused and consumes it
+
+   This ensures that a replayed resumption reply which was queued before the first one was completed
+   doesn't establish a second session with the same keys.
+*/
+static bool use_resumption_nonce(handshake_job_t *job, fastd_peer_t *peer) {
+	aligned_int256_t *nonce = job->initiator ? &peer->protocol_state->resumption_nonce : &peer->protocol_state->resumption_response_nonce;
+
+	if (!secure_memequal(nonce, &job->handshake_key.key.public, PUBLICKEYBYTES))
+		return false;
+
+	memset(nonce, 0, sizeof(*nonce));
+	return true;
+}
+
+/** Continues handling a handshake after the key derivation */
+static void handle_handshake_job(handshake_job_t *job, fastd_peer_t *peer) {
+	const char *kind = job->resumption ? "resumption" : "protocol";
+
+	if (job->type > 1 && !job->valid) {
+		pr_warn("received invalid %s handshake %s from %P[%I]", kind, job->type == 2 ? "response" : "finish", peer, &job->remote_addr);
+		return;
+	}
+
+	if (job->resumption && !use_resumption_nonce(job, peer)) {
+		pr_debug("ignoring resumption handshake from %P[%I] (nonce already used)", peer, &job->remote_addr);
+		return;
+	}
+
+	switch (job->type) {
+	case 1:
+		cache_shared_handshake_key(peer, job->handshake_key.serial, &job->peer_handshake_key, &job->sigma,
+					   &job->shared_handshake_key, &job->shared_handshake_key_compat);
+		send_response(job->sock, &job->local_addr, &job->remote_addr, peer, &job->handshake_key, &job->peer_handshake_key, job->method, job->little_endian);
+		break;
+
+	case 2:
+		if (job->resumption)
+			finish_resumption(job, peer);
+		else
+			send_finish(job, peer);
+		break;
+
+	case 3:
+		establish(job, peer);
+
+		if (!job->resumption)
+			clear_shared_handshake_key(peer);
+	}
+}
+
+/** Completes a handshake job in the main thread */
+static void handshake_job_complete(fastd_worker_job_t *worker_job) {
+	handshake_job_t *job = container_of(worker_job, handshake_job_t, job);
+
+	if (job->derived) {
+		fastd_peer_t *peer = fastd_peer_find_by_id(job->peer_id);
+
+		if (peer && fastd_peer_is_enabled(peer) && (!job->peer_sock || peer->sock == job->sock))
+			handle_handshake_job(job, peer);
+	}
+
+	if (job->method_state)
+		job->method->provider->session_free(job->method_state);
+
+	secure_memzero(job, sizeof(*job) + job->tlv_len);
+	free(job);
+}
+
+/** Creates a handshake job for a received handshake; for handshake replies (type 2 and 3), \e handshake must be given */
+static handshake_job_t * new_handshake_job(uint8_t type, fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
+					   const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
+					   const fastd_handshake_t *handshake, const fastd_method_info_t *method, bool little_endian) {
+	size_t tlv_len = handshake ? handshake->tlv_len : 0;
+	handshake_job_t *job = fastd_alloc0(sizeof(handshake_job_t) + tlv_len);
+
+	job->job.run = handshake_job_run;
+	job->job.complete = handshake_job_complete;
+
+	job->type = type;
+	job->initiator = (type == 2);
+	job->little_endian = little_endian;
+	job->resumable = (conf.handshake_resumption_window && !fastd_peer_is_dynamic(peer));
+
+	job->peer_id = peer->id;
+	job->sock = sock;
+	job->peer_sock = (sock->peer != NULL);
+	job->local_addr = *local_addr;
+	job->remote_addr = *remote_addr;
+	job->method = method;
+
+	job->handshake_key = *handshake_key;
+	job->peer_key = peer->key->key;
+	job->peer_handshake_key = *peer_handshake_key;
+
+	if (handshake) {
+		job->compat = !secure_handshake(handshake);
+		job->rtt_probe = (handshake->records[RECORD_RTT_PROBE].data != NULL);
+
+		if (job->compat)
+			memcpy(job->handshake_tag, handshake->records[RECORD_HANDSHAKE_TAG].data, HASHBYTES);
+		else
+			job->tlv_mac_offset = handshake->records[RECORD_TLV_MAC].data - (const uint8_t *)handshake->tlv_data;
+
+		job->tlv_len = tlv_len;
+		memcpy(job->tlv_data, handshake->tlv_data, tlv_len);
+	}
+
+	return job;
+}
+
+/** Hands a handshake job to the worker threads */
+static void queue_handshake_job(handshake_job_t *job, fastd_peer_t *peer) {
+	if (!fastd_worker_submit(&job->job)) {
+		pr_debug("ignoring handshake from %P[%I] (too many pending handshakes)", peer, &job->remote_addr);
+
+		secure_memzero(job, sizeof(*job) + job->tlv_len);
+		free(job);
+	}
+}
+
+/**
+   Hands the key derivation for a received handshake to the worker threads
+
+   For handshake replies (type 2 and 3), \e handshake must be given, so the reply can be verified by the worker as well.
+   When the shared handshake key for a handshake finish (type 3) is cached already, the worker only verifies the
+   reply and initializes the new session.
+*/
+static void submit_handshake_job(uint8_t type, fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
+				 const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
+				 const fastd_handshake_t *handshake, const fastd_method_info_t *method, bool little_endian) {
+	handshake_job_t *job = new_handshake_job(type, sock, local_addr, remote_addr, peer, handshake_key, peer_handshake_key, handshake, method, little_endian);
+
+	if (type == 3 && has_shared_handshake_key(peer, handshake_key, peer_handshake_key)) {
+		job->derived = true;
+		job->sigma = peer->protocol_state->sigma;
+		job->shared_handshake_key = peer->protocol_state->shared_handshake_key;
+		job->shared_handshake_key_compat = peer->protocol_state->shared_handshake_key_compat;
 	}
 	else {
-		fastd_sha256_t hmacbuf;
-		fastd_hmacsha256_blocks(&hmacbuf, shared_handshake_key_compat.w, conf.protocol_config->key.public.u32, handshake_key->key.public.u32, NULL);
-		fastd_handshake_add(&buffer, RECORD_HANDSHAKE_TAG, HASHBYTES, hmacbuf.b);
+		job->peer_key_table = *fastd_protocol_ec25519_fhmqvc_get_key_table(peer);
 	}
 
-	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
+	if (job->initiator) {
+		job->derive_key = !job->compat;
+		job->derive_key_compat = job->compat;
+	}
+	else {
+		job->derive_key = true;
+		job->derive_key_compat = !conf.secure_handshakes;
+	}
+
+	queue_handshake_job(job, peer);
+}
+
+/** Handles an initial handshake (type 1) by sending a reply */
+static void respond_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer,
+			      const aligned_int256_t *peer_handshake_key, const fastd_method_info_t *method, bool little_endian) {
+	pr_debug("responding handshake with %P[%I]...", peer, remote_addr);
+
+	const handshake_key_t *handshake_key = &ctx.protocol_state->handshake_key;
+
+	if (has_shared_handshake_key(peer, handshake_key, peer_handshake_key))
+		send_response(sock, local_addr, remote_addr, peer, handshake_key, peer_handshake_key, method, little_endian);
+	else
+		submit_handshake_job(1, sock, local_addr, remote_addr, peer, handshake_key, peer_handshake_key, NULL, method, little_endian);
+}
+
+/** Handles a reply to an initial handshake (type 2) */
+static void finish_handshake(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, const handshake_key_t *handshake_key, const aligned_int256_t *peer_handshake_key,
+			     const fastd_handshake_t *handshake, const fastd_method_info_t *method) {
+	pr_debug("finishing handshake with %P[%I]...", peer, remote_addr);
+
+	submit_handshake_job(2, sock, local_addr, remote_addr, peer, handshake_key, peer_handshake_key, handshake, method, handshake->little_endian);
 }
 
 /** Handles a reply to a handshake response (type 3) */
@@ -393,34 +824,75 @@ static void handle_finish_handshake(fastd_socket_t *sock, const fastd_peer_addre
 				    const fastd_handshake_t *handshake, const fastd_method_info_t *method) {
 	pr_debug("handling handshake finish with %P[%I]...", peer, remote_addr);
 
-	bool compat = !secure_handshake(handshake);
+	submit_handshake_job(3, sock, local_addr, remote_addr, peer, handshake_key, peer_handshake_key, handshake, method, handshake->little_endian);
+}
 
-	if (!update_shared_handshake_key(peer, handshake_key, peer_handshake_key))
-		return;
+/**
+   Handles a reply to a resumption request (type 2) or a resumption reply (type 3)
 
-	bool valid;
-	if (!compat) {
-		uint8_t mac[HASHBYTES];
-		memcpy(mac, handshake->records[RECORD_TLV_MAC].data, HASHBYTES);
-		memset(handshake->records[RECORD_TLV_MAC].data, 0, HASHBYTES);
+   The replies are authenticated using a key derived from the resumption secret and both nonces;
+   the recipient nonce must match the nonce sent in the last request or reply, so replayed packets are rejected.
+*/
+static void handle_resumption_reply(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr,
+				    fastd_peer_t *peer, const fastd_handshake_t *handshake, const fastd_method_info_t *method) {
+	if (!secure_handshake(handshake)
+	    || !has_field(handshake, RECORD_SENDER_RESUMPTION_NONCE, PUBLICKEYBYTES)
+	    || !has_field(handshake, RECORD_RECIPIENT_RESUMPTION_NONCE, PUBLICKEYBYTES)) {
+		pr_debug("received invalid resumption handshake from %P[%I]", peer, remote_addr);
+		return;
+	}
 
-		valid = fastd_hmacsha256_verify(mac, peer->protocol_state->shared_handshake_key.w, handshake->tlv_data, handshake->tlv_len);
+	if (!has_resumption_secret(peer)) {
+		pr_debug("received resumption handshake from %P[%I] without resumption secret", peer, remote_addr);
+		return;
 	}
-	else {
-		valid = fastd_hmacsha256_blocks_verify(handshake->records[RECORD_HANDSHAKE_TAG].data, peer->protocol_state->shared_handshake_key_compat.w, peer->key->key.u32, peer_handshake_key->u32, NULL);
+
+	const aligned_int256_t *nonce;
+
+	switch (handshake->type) {
+	case 2:
+		nonce = &peer->protocol_state->resumption_nonce;
+		break;
+
+	case 3:
+		nonce = &peer->protocol_state->resumption_response_nonce;
+		break;
+
+	default:
+		pr_debug("received resumption handshake with unknown type %u from %P[%I]", handshake->type, peer, remote_addr);
+		return;
 	}
 
-	if (!valid) {
-		pr_warn("received invalid protocol handshake finish from %P[%I]", peer, remote_addr);
+	if (!secure_memequal(nonce, handshake->records[RECORD_RECIPIENT_RESUMPTION_NONCE].data, PUBLICKEYBYTES)) {
+		pr_debug("received resumption handshake with unexpected nonce from %P[%I]", peer, remote_addr);
 		return;
 	}
 
-	establish(peer, method, sock, local_addr, remote_addr, false, peer_handshake_key, &handshake_key->key.public, &peer->key->key,
-		  &conf.protocol_config->key.public, &peer->protocol_state->sigma, compat ? NULL : peer->protocol_state->shared_handshake_key.w, handshake_key->serial);
+	bool initiator = (handshake->type == 2);
+
+	if (initiator)
+		pr_verbose("received resumption reply from %P[%I]%s%s", peer, remote_addr, handshake->peer_version ? " using fastd " : "", handshake->peer_version ?: "");
+	else
+		pr_debug("received resumption finish from %P[%I]%s%s", peer, remote_addr, handshake->peer_version ? " using fastd " : "", handshake->peer_version ?: "");
+
+	handshake_key_t nonce_key = { .serial = 0 };
+	nonce_key.key.public = *nonce;
+
+	aligned_int256_t peer_nonce;
+	memcpy(&peer_nonce, handshake->records[RECORD_SENDER_RESUMPTION_NONCE].data, PUBLICKEYBYTES);
+
+	handshake_job_t *job = new_handshake_job(handshake->type, sock, local_addr, remote_addr, peer, &nonce_key, &peer_nonce, handshake, method, handshake->little_endian);
+
+	job->resumption = true;
+	job->derived = true;
+	job->sigma = peer->protocol_state->resumption_secret;
+	derive_resumption_key(&job->shared_handshake_key, peer, initiator,
+			      initiator ? nonce : &peer_nonce, initiator ? &peer_nonce : nonce);
 
-	clear_shared_handshake_key(peer);
+	queue_handshake_job(job, peer);
 }
 
+
 /** Searches the peer a public key belongs to, optionally restricting matches to a specific sender address */
 static fastd_peer_t * find_key(const uint8_t key[PUBLICKEYBYTES], const fastd_peer_address_t *address) {
 	errno = 0;
@@ -488,12 +960,14 @@ static fastd_peer_t * match_sender_key(const fastd_socket_t *sock, const fastd_p
 void fastd_protocol_ec25519_fhmqvc_handshake_init(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer) {
 	fastd_protocol_ec25519_fhmqvc_maintenance();
 
-	fastd_handshake_buffer_t buffer = fastd_handshake_new_init(3*(4+PUBLICKEYBYTES) /* sender key, recipient key, handshake key */);
+	fastd_handshake_buffer_t buffer = fastd_handshake_new_init(remote_addr, peer, 3*(4+PUBLICKEYBYTES) /* sender key, recipient key, handshake key */
+								  + 4+HASHBYTES + 4+PUBLICKEYBYTES /* resumption ID and nonce */);
 
 	fastd_handshake_add(&buffer, RECORD_SENDER_KEY, PUBLICKEYBYTES, &conf.protocol_config->key.public);
 
 	if (peer) {
 		fastd_handshake_add(&buffer, RECORD_RECIPIENT_KEY, PUBLICKEYBYTES, &peer->key->key);
+		add_resumption_request(&buffer, peer);
 
 		pr_verbose("sending handshake to %P[%I]...", peer, remote_addr);
 	}
@@ -503,7 +977,8 @@ void fastd_protocol_ec25519_fhmqvc_handshake_init(fastd_socket_t *sock, const fa
 
 	fastd_handshake_add(&buffer, RECORD_SENDER_HANDSHAKE_KEY, PUBLICKEYBYTES, &ctx.protocol_state->handshake_key.key.public);
 
-	if (!peer || !fastd_peer_is_established(peer))
+	/* A handshake repeated with a cookie has already run the on-connect command */
+	if (!peer || (!fastd_peer_is_established(peer) && !peer->handshake_cookie_retried))
 		fastd_peer_exec_shell_command(&conf.on_connect, peer, (local_addr && local_addr->sa.sa_family) ? local_addr : sock->bound_addr, remote_addr);
 
 	fastd_send_handshake(sock, local_addr, remote_addr, peer, buffer.buffer);
@@ -559,7 +1034,7 @@ static fastd_peer_t * add_dynamic(fastd_socket_t *sock, const fastd_peer_address
 		return NULL;
 	}
 
-	fastd_peer_t *peer = fastd_new0(fastd_peer_t);
+	fastd_peer_t *peer = fastd_peer_new();
 	peer->group = conf.peer_group;
 	peer->config_state = CONFIG_DYNAMIC;
 
@@ -593,7 +1068,7 @@ static bool handle_dynamic(fastd_socket_t *sock, const fastd_peer_address_t *loc
 		return false;
 
 	if (!verified.state) {
-		pr_debug("ignoring handshake from %P[%I] (verification failed)", peer, remote_addr);
+		pr_debug_ratelimited("ignoring handshake from %P[%I] (verification failed)", peer, remote_addr);
 		fastd_peer_delete(peer);
 		return false;
 	}
@@ -654,11 +1129,6 @@ void fastd_protocol_ec25519_fhmqvc_handshake_handle(fastd_socket_t *sock, const
 		}
 	}
 
-	if (!has_field(handshake, RECORD_SENDER_HANDSHAKE_KEY, PUBLICKEYBYTES)) {
-		pr_debug("received handshake without sender handshake key from %P[%I]", peer, remote_addr);
-		return;
-	}
-
 	if (!fastd_peer_may_connect(peer)) {
 		pr_debug("ignoring handshake from %P[%I] because of local constraints", peer, remote_addr);
 		return;
@@ -676,6 +1146,16 @@ void fastd_protocol_ec25519_fhmqvc_handshake_handle(fastd_socket_t *sock, const
 		}
 	}
 
+	if (handshake->type > 1 && handshake->records[RECORD_RECIPIENT_RESUMPTION_NONCE].data) {
+		handle_resumption_reply(sock, local_addr, remote_addr, peer, handshake, method);
+		return;
+	}
+
+	if (!has_field(handshake, RECORD_SENDER_HANDSHAKE_KEY, PUBLICKEYBYTES)) {
+		pr_debug("received handshake without sender handshake key from %P[%I]", peer, remote_addr);
+		return;
+	}
+
 #ifdef WITH_DYNAMIC_PEERS
 	if (fastd_peer_is_dynamic(peer)) {
 		if (!handle_dynamic(sock, local_addr, remote_addr, peer, handshake, method))
@@ -697,7 +1177,12 @@ void fastd_protocol_ec25519_fhmqvc_handshake_handle(fastd_socket_t *sock, const
 
 		peer->last_handshake_response_timeout = ctx.now + MIN_HANDSHAKE_INTERVAL;
 		peer->last_handshake_response_address = *remote_addr;
-		respond_handshake(sock, local_addr, remote_addr, peer, &peer_handshake_key, method, handshake->little_endian);
+
+		if (is_resumption_request(peer, handshake))
+			respond_resumption(sock, local_addr, remote_addr, peer, handshake, method);
+		else
+			respond_handshake(sock, local_addr, remote_addr, peer, &peer_handshake_key, method, handshake->little_endian);
+
 		return;
 	}
 
@@ -56,6 +56,9 @@ typedef struct handshake_key {
 	keypair_t key;				/**< The actual keypair */
 } handshake_key_t;
 
+/** The number of ephemeral keypairs generated in advance */
+#define HANDSHAKE_KEY_POOL_SIZE 2
+
 /**
    The protocol-specific global state
 
@@ -64,6 +67,16 @@ typedef struct handshake_key {
 struct fastd_protocol_state {
 	handshake_key_t prev_handshake_key;	/**< The previously generated handshake keypair */
 	handshake_key_t handshake_key;		/**< The newest handshake keypair */
+
+	base_table_t base_table;		/**< The precomputed table for the generation of ephemeral keys */
+
+	fastd_dlist_head_t key_tables;		/**< The cached key tables of the peers, most recently used first */
+	fastd_dlist_head_t *key_tables_lru;	/**< The least recently used entry of key_tables or NULL */
+	size_t n_key_tables;			/**< The number of cached key tables */
+
+	keypair_t key_pool[HANDSHAKE_KEY_POOL_SIZE]; /**< Ephemeral keypairs generated in advance by the worker threads */
+	size_t key_pool_len;			/**< The number of keypairs in key_pool */
+	size_t key_pool_pending;		/**< The number of keypairs currently being generated */
 };
 
 
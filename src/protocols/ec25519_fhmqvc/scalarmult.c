@@ -0,0 +1,191 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   ec25519-fhmqvc protocol: scalar multiplication using precomputed tables
+
+   The generation of ephemeral keys multiplies the base point with a random scalar. Using a precomputed
+   table of multiples of the base point for each 4-bit window of the scalar (with signed digits, so only
+   8 multiples per window are needed), the multiplication is reduced to 64 point additions without any doublings.
+   The table entries are selected in constant time.
+
+   For the multiplication of the peers' public keys with the values \e d and \e e in the
+   handshake, a smaller table of multiples of the key is used with a fixed-window method.
+*/
+
+
+#include "ec25519_fhmqvc.h"
+#include "../../crypto.h"
+
+
+/** Stores the affine coordinates of a point */
+static void store_affine(affine_point_t *out, const ecc_25519_work_t *in) {
+	ecc_25519_store_xy(&out->x, &out->y, in);
+}
+
+/** Computes the base table */
+void fastd_protocol_ec25519_fhmqvc_base_table_init(base_table_t *table) {
+	/* Get the base point used by ecc_25519_scalarmult_base() */
+	static const ecc_int256_t one = {{1}};
+
+	ecc_25519_work_t base;
+	ecc_25519_scalarmult_base(&base, &one);
+
+	size_t i, j;
+	for (i = 0; i < BASE_TABLE_WINDOWS; i++) {
+		ecc_25519_work_t work = base;
+
+		for (j = 0; j < BASE_TABLE_ENTRIES; j++) {
+			store_affine(&table->entries[i][j], &work);
+			ecc_25519_add(&work, &work, &base);
+		}
+
+		for (j = 0; j < 4; j++)
+			ecc_25519_double(&base, &base);
+	}
+}
+
+/** Copies \e in to \e out if \e mask is 0xff; does nothing if it is 0 (in constant time) */
+static inline void cmov_bytes(uint8_t *out, const uint8_t *in, size_t len, uint8_t mask) {
+	size_t i;
+	for (i = 0; i < len; i++)
+		out[i] ^= mask & (out[i] ^ in[i]);
+}
+
+/**
+   Selects the point \e digit * 16^\e window * B from the base table in constant time
+
+   \e digit must be in the range [-8, 8].
+*/
+static void select_point(ecc_25519_work_t *out, const base_table_t *table, size_t window, int8_t digit) {
+	uint8_t negative = (uint8_t)digit >> 7;
+	uint8_t magnitude = digit - 2*(-negative & digit);
+
+	/* The neutral element (0, 1) */
+	affine_point_t point = { .y = {{1}} };
+
+	size_t j;
+	for (j = 0; j < BASE_TABLE_ENTRIES; j++) {
+		uint8_t mask = -(uint8_t)((((uint32_t)(magnitude ^ (j+1))) - 1) >> 31);
+		cmov_bytes((uint8_t *)&point, (const uint8_t *)&table->entries[window][j], sizeof(point), mask);
+	}
+
+	ecc_25519_load_xy(out, &point.x, &point.y);
+
+	ecc_25519_work_t neg;
+	ecc_25519_negate(&neg, out);
+	cmov_bytes((uint8_t *)out, (const uint8_t *)&neg, sizeof(neg), -negative);
+}
+
+/**
+   Multiplies the base point with a scalar using a base table
+
+   The result is the same as the one of ecc_25519_scalarmult_base(); \e n must be less than 2^255
+   (which is always the case for sanitized secret keys).
+*/
+void fastd_protocol_ec25519_fhmqvc_scalarmult_base(ecc_25519_work_t *out, const ecc_int256_t *n, const base_table_t *table) {
+	int8_t digits[BASE_TABLE_WINDOWS];
+
+	size_t i;
+	for (i = 0; i < BASE_TABLE_WINDOWS/2; i++) {
+		digits[2*i] = n->p[i] & 15;
+		digits[2*i+1] = n->p[i] >> 4;
+	}
+
+	/* Recode the digits to the range [-8, 7] (the last one to [-8, 8]) */
+	int8_t carry = 0;
+	for (i = 0; i < BASE_TABLE_WINDOWS-1; i++) {
+		digits[i] += carry;
+		carry = (digits[i] + 8) >> 4;
+		digits[i] -= 16*carry;
+	}
+	digits[BASE_TABLE_WINDOWS-1] += carry;
+
+	*out = ecc_25519_work_identity;
+
+	for (i = 0; i < BASE_TABLE_WINDOWS; i++) {
+		ecc_25519_work_t point;
+		select_point(&point, table, i, digits[i]);
+		ecc_25519_add(out, out, &point);
+	}
+
+	secure_memzero(digits, sizeof(digits));
+}
+
+
+/** Computes a key table for a point */
+void fastd_protocol_ec25519_fhmqvc_key_table_init(key_table_t *table, const ecc_25519_work_t *point) {
+	table->multiples[0] = *point;
+
+	size_t i;
+	for (i = 1; i < KEY_TABLE_ENTRIES; i++)
+		ecc_25519_add(&table->multiples[i], &table->multiples[i-1], point);
+}
+
+/**
+   Multiplies a point with a scalar using a key table
+
+   Scalars are processed in signed 4-bit windows, so only 128 doublings and up to 33
+   additions are needed. \e n must be less than 2^128 (like the values \e d and \e e of the handshake).
+
+   As the scalars \e d and \e e are derived from public values only, this function does not run in constant time.
+*/
+void fastd_protocol_ec25519_fhmqvc_key_table_mult(ecc_25519_work_t *out, const ecc_int256_t *n, const key_table_t *table) {
+	int8_t digits[33];
+
+	size_t i;
+	for (i = 0; i < 16; i++) {
+		digits[2*i] = n->p[i] & 15;
+		digits[2*i+1] = n->p[i] >> 4;
+	}
+
+	/* Recode the digits to the range [-8, 7] */
+	int8_t carry = 0;
+	for (i = 0; i < 32; i++) {
+		digits[i] += carry;
+		carry = (digits[i] + 8) >> 4;
+		digits[i] -= 16*carry;
+	}
+	digits[32] = carry;
+
+	*out = ecc_25519_work_identity;
+
+	for (i = 33; i > 0; i--) {
+		int8_t digit = digits[i-1];
+
+		if (i < 33) {
+			size_t j;
+			for (j = 0; j < 4; j++)
+				ecc_25519_double(out, out);
+		}
+
+		if (digit > 0)
+			ecc_25519_add(out, out, &table->multiples[digit-1]);
+		else if (digit < 0)
+			ecc_25519_sub(out, out, &table->multiples[-digit-1]);
+	}
+}
@@ -34,10 +34,27 @@
 #include "../../crypto.h"
 
 
+/** A cached key table of a peer */
+struct key_table_entry {
+	fastd_dlist_head_t lru;			/**< The entry in the LRU list of key tables */
+	fastd_protocol_peer_state_t *owner;	/**< The state of the peer the table belongs to */
+	key_table_t table;			/**< The key table */
+};
+
+
+/** A job generating an ephemeral keypair in a worker thread */
+typedef struct handshake_key_job {
+	fastd_worker_job_t job;			/**< The worker job */
+	bool done;				/**< Set when the keypair has been generated */
+	keypair_t key;				/**< The generated keypair */
+} handshake_key_job_t;
+
+
 /** Allocates the protocol-specific state */
 static void init_protocol_state(void) {
 	if (!ctx.protocol_state) {
 		ctx.protocol_state = fastd_new0(fastd_protocol_state_t);
+		fastd_protocol_ec25519_fhmqvc_base_table_init(&ctx.protocol_state->base_table);
 
 		ctx.protocol_state->prev_handshake_key.preferred_till = ctx.now;
 		ctx.protocol_state->handshake_key.preferred_till = ctx.now;
@@ -50,30 +67,102 @@ static void new_handshake_key(keypair_t *key) {
 	ecc_25519_gf_sanitize_secret(&key->secret, &key->secret);
 
 	ecc_25519_work_t work;
-	ecc_25519_scalarmult_base(&work, &key->secret);
+	fastd_protocol_ec25519_fhmqvc_scalarmult_base(&work, &key->secret, &ctx.protocol_state->base_table);
 	ecc_25519_store_packed(&key->public.int256, &work);
 
 	if (!divide_key(&key->secret))
 		exit_bug("generated invalid ephemeral key");
 }
 
+/** Generates an ephemeral keypair (the run callback of a handshake_key_job_t) */
+static void handshake_key_job_run(fastd_worker_job_t *worker_job) {
+	handshake_key_job_t *job = container_of(worker_job, handshake_key_job_t, job);
+
+	new_handshake_key(&job->key);
+	job->done = true;
+}
+
+/** Adds a generated keypair to the pool (the complete callback of a handshake_key_job_t) */
+static void handshake_key_job_complete(fastd_worker_job_t *worker_job) {
+	handshake_key_job_t *job = container_of(worker_job, handshake_key_job_t, job);
+	fastd_protocol_state_t *state = ctx.protocol_state;
+
+	state->key_pool_pending--;
+
+	if (job->done && state->key_pool_len < HANDSHAKE_KEY_POOL_SIZE)
+		state->key_pool[state->key_pool_len++] = job->key;
+
+	secure_memzero(job, sizeof(*job));
+	free(job);
+}
+
+/**
+   Starts the generation of new ephemeral keypairs until the pool is (or will be) full
+
+   Keypairs are only generated in advance by worker threads; without workers, the pool
+   stays empty and each keypair is generated when it is needed.
+*/
+static void refill_key_pool(void) {
+	fastd_protocol_state_t *state = ctx.protocol_state;
+
+	if (!ctx.worker_pool.n_threads)
+		return;
+
+	while (state->key_pool_len + state->key_pool_pending < HANDSHAKE_KEY_POOL_SIZE) {
+		handshake_key_job_t *job = fastd_new0(handshake_key_job_t);
+		job->job.run = handshake_key_job_run;
+		job->job.complete = handshake_key_job_complete;
+
+		state->key_pool_pending++;
+
+		if (!fastd_worker_submit(&job->job)) {
+			state->key_pool_pending--;
+			free(job);
+			return;
+		}
+	}
+}
+
+/**
+   Sets the keypair to use for new handshakes
+
+   A keypair generated in advance is used if available; if the pool is empty (always the case
+   when there are no worker threads), a new one is generated synchronously.
+*/
+static void take_handshake_key(keypair_t *key) {
+	fastd_protocol_state_t *state = ctx.protocol_state;
+
+	if (state->key_pool_len) {
+		keypair_t *pooled = &state->key_pool[--state->key_pool_len];
+
+		*key = *pooled;
+		secure_memzero(pooled, sizeof(*pooled));
+	}
+	else {
+		pr_debug("no pre-generated handshake key available");
+		new_handshake_key(key);
+	}
+
+	refill_key_pool();
+}
+
 /**
    Performs maintenance tasks on the protocol state
 
-   If there is currently no preferred ephemeral keypair, a new one
-   will be generated.
+   If there is currently no preferred ephemeral keypair, the next one
+   is taken from the pool of keypairs generated in advance.
 */
 void fastd_protocol_ec25519_fhmqvc_maintenance(void) {
 	init_protocol_state();
 
 	if (!is_handshake_key_preferred(&ctx.protocol_state->handshake_key)) {
-		pr_debug("generating new handshake key");
+		pr_debug("switching to new handshake key");
 
 		ctx.protocol_state->prev_handshake_key = ctx.protocol_state->handshake_key;
 
 		ctx.protocol_state->handshake_key.serial++;
 
-		new_handshake_key(&ctx.protocol_state->handshake_key.key);
+		take_handshake_key(&ctx.protocol_state->handshake_key.key);
 
 		ctx.protocol_state->handshake_key.preferred_till = ctx.now + 15000;
 		ctx.protocol_state->handshake_key.valid_till = ctx.now + 30000;
@@ -91,6 +180,72 @@ void fastd_protocol_ec25519_fhmqvc_init_peer_state(fastd_peer_t *peer) {
 	peer->protocol_state->last_serial = ctx.protocol_state->handshake_key.serial;
 }
 
+/** Removes a key table from the LRU list */
+static void key_table_unlink(key_table_entry_t *entry) {
+	fastd_protocol_state_t *state = ctx.protocol_state;
+
+	if (state->key_tables_lru == &entry->lru)
+		state->key_tables_lru = (entry->lru.prev != &state->key_tables) ? entry->lru.prev : NULL;
+
+	fastd_dlist_remove(&entry->lru);
+}
+
+/** Adds a key table to the front of the LRU list */
+static void key_table_link(key_table_entry_t *entry) {
+	fastd_protocol_state_t *state = ctx.protocol_state;
+
+	fastd_dlist_insert(&state->key_tables, &entry->lru);
+
+	if (!entry->lru.next)
+		state->key_tables_lru = &entry->lru;
+}
+
+/** Removes a key table from the cache and frees it */
+static void free_key_table(key_table_entry_t *entry) {
+	key_table_unlink(entry);
+	ctx.protocol_state->n_key_tables--;
+
+	entry->owner->key_table = NULL;
+	free(entry);
+}
+
+/**
+   Returns the table of multiples of a peer's key
+
+   The table is computed when it is needed for the first time. The least recently used
+   tables are dropped when the cache exceeds KEY_TABLE_CACHE_SIZE.
+*/
+const key_table_t * fastd_protocol_ec25519_fhmqvc_get_key_table(fastd_peer_t *peer) {
+	fastd_protocol_state_t *state = ctx.protocol_state;
+	key_table_entry_t *entry = peer->protocol_state->key_table;
+
+	if (entry) {
+		key_table_unlink(entry);
+	}
+	else {
+		while (state->n_key_tables && (state->n_key_tables+1) * sizeof(key_table_entry_t) > KEY_TABLE_CACHE_SIZE)
+			free_key_table(container_of(state->key_tables_lru, key_table_entry_t, lru));
+
+		entry = fastd_new0(key_table_entry_t);
+		entry->owner = peer->protocol_state;
+		fastd_protocol_ec25519_fhmqvc_key_table_init(&entry->table, &peer->key->unpacked);
+
+		peer->protocol_state->key_table = entry;
+		state->n_key_tables++;
+	}
+
+	key_table_link(entry);
+	return &entry->table;
+}
+
+/** Returns the memory used by the cached key tables */
+size_t fastd_protocol_ec25519_fhmqvc_get_cache_size(void) {
+	if (!ctx.protocol_state)
+		return 0;
+
+	return ctx.protocol_state->n_key_tables * sizeof(key_table_entry_t);
+}
+
 /** Resets a the state of a session, freeing method-specific state */
 static void reset_session(protocol_session_t *session) {
 	if (session->method)
@@ -113,6 +268,9 @@ void fastd_protocol_ec25519_fhmqvc_free_peer_state(fastd_peer_t *peer) {
 		reset_session(&peer->protocol_state->old_session);
 		reset_session(&peer->protocol_state->session);
 
+		if (peer->protocol_state->key_table)
+			free_key_table(peer->protocol_state->key_table);
+
 		free(peer->protocol_state);
 	}
 }
@@ -27,21 +27,91 @@
    \file
 
    Utilities for random data
+
+   Non-secure random data is taken from a ChaCha20 keystream which is seeded from the kernel
+   and buffered per thread, so ephemeral keys, nonces and jitter values don't need any syscalls.
+   After each refill of the buffer, the first bytes of the new keystream replace the key, so
+   data that has been returned already can't be reconstructed from the state ("fast key erasure").
 */
 
 
 #include "fastd.h"
+#include "crypto.h"
 
 #include <sys/stat.h>
 
+#ifdef HAVE_GETRANDOM
+#include <sys/random.h>
+#endif
+
+
+/** The number of ChaCha20 blocks generated per refill of the keystream buffer */
+#define RANDOM_BUFFER_BLOCKS 16
+
+/** The size of a ChaCha20 block in bytes */
+#define CHACHA_BLOCKBYTES 64
+
+/** The size of a ChaCha20 key in bytes */
+#define CHACHA_KEYBYTES 32
+
+/** The number of buffer refills after which the generator is seeded from the kernel again */
+#define RANDOM_RESEED_INTERVAL 1024
+
+
+/** The per-thread state of the random number generator */
+typedef struct fastd_random_state {
+	unsigned generation;		/**< The value of fork_generation when the state was seeded */
+	unsigned refills;		/**< The number of refills since the state was seeded */
+	uint32_t key[CHACHA_KEYBYTES/4];	/**< The current ChaCha20 key */
+
+	size_t available;		/**< The number of unused bytes at the end of \e buffer */
+	uint8_t buffer[RANDOM_BUFFER_BLOCKS*CHACHA_BLOCKBYTES] __attribute__((aligned(16))); /**< The buffered keystream */
+} fastd_random_state_t;
+
+
+/** The random number generator state of the current thread */
+static __thread fastd_random_state_t random_state;
 
 /**
-   Provides a given amount of cryptographic random data
+   Incremented in the child process after each fork
+
+   A thread state with an older generation is seeded again, so parent and child never return the same data.
 */
-void fastd_random_bytes(void *buffer, size_t len, bool secure) {
-	int fd;
+static volatile unsigned fork_generation = 1;
+
+/** Ensures the fork handler is only registered once */
+static pthread_once_t fork_handler_once = PTHREAD_ONCE_INIT;
+
+
+/** Reads random data from the kernel */
+static void get_kernel_random(void *buffer, size_t len, bool secure) {
+#ifdef HAVE_GETRANDOM
 	size_t read_bytes = 0;
 
+	while (read_bytes < len) {
+		ssize_t ret = getrandom(((char *)buffer)+read_bytes, len-read_bytes, secure ? GRND_RANDOM : 0);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			/* Fall back to the random devices on kernels without getrandom() */
+			if (errno == ENOSYS && read_bytes == 0)
+				break;
+
+			exit_errno("getrandom");
+		}
+
+		read_bytes += ret;
+	}
+
+	if (read_bytes == len)
+		return;
+#endif
+
+	int fd;
+	size_t dev_read_bytes = 0;
+
 	if (secure)
 		fd = open("/dev/random", O_RDONLY);
 	else
@@ -50,14 +120,135 @@ void fastd_random_bytes(void *buffer, size_t len, bool secure) {
 	if (fd < 0)
 		exit_errno("unable to open random device");
 
-	while (read_bytes < len) {
-		ssize_t ret = read(fd, ((char *)buffer)+read_bytes, len-read_bytes);
+	while (dev_read_bytes < len) {
+		ssize_t ret = read(fd, ((char *)buffer)+dev_read_bytes, len-dev_read_bytes);
 
 		if (ret < 0)
 			exit_errno("unable to read from random device");
 
-		read_bytes += ret;
+		dev_read_bytes += ret;
 	}
 
 	close(fd);
 }
+
+
+/** Rotates a 32-bit value left */
+static inline uint32_t rotl32(uint32_t v, int c) {
+	return (v << c) | (v >> (32-c));
+}
+
+/** A ChaCha quarter round */
+#define QUARTERROUND(a, b, c, d) do {		\
+	a += b; d = rotl32(d ^ a, 16);			\
+	c += d; b = rotl32(b ^ c, 12);			\
+	a += b; d = rotl32(d ^ a, 8);			\
+	c += d; b = rotl32(b ^ c, 7);			\
+} while (0)
+
+/** Computes a single ChaCha20 keystream block with an all-zero nonce */
+static void chacha20_block(uint32_t out[CHACHA_BLOCKBYTES/4], const uint32_t key[CHACHA_KEYBYTES/4], uint64_t counter) {
+	uint32_t in[16] = {
+		0x61707865, 0x3320646e, 0x79622d32, 0x6b206574,
+		key[0], key[1], key[2], key[3],
+		key[4], key[5], key[6], key[7],
+		(uint32_t)counter, (uint32_t)(counter >> 32), 0, 0,
+	};
+	uint32_t x[16];
+	size_t i;
+
+	memcpy(x, in, sizeof(x));
+
+	for (i = 0; i < 10; i++) {
+		QUARTERROUND(x[0], x[4], x[8], x[12]);
+		QUARTERROUND(x[1], x[5], x[9], x[13]);
+		QUARTERROUND(x[2], x[6], x[10], x[14]);
+		QUARTERROUND(x[3], x[7], x[11], x[15]);
+
+		QUARTERROUND(x[0], x[5], x[10], x[15]);
+		QUARTERROUND(x[1], x[6], x[11], x[12]);
+		QUARTERROUND(x[2], x[7], x[8], x[13]);
+		QUARTERROUND(x[3], x[4], x[9], x[14]);
+	}
+
+	for (i = 0; i < 16; i++)
+		out[i] = x[i] + in[i];
+
+	secure_memzero(x, sizeof(x));
+	secure_memzero(in, sizeof(in));
+}
+
+
+/** Marks the random number generator states of all threads as stale after a fork (called in the child process) */
+static void random_fork_child(void) {
+	fork_generation++;
+}
+
+/** Registers random_fork_child() */
+static void random_register_fork_handler(void) {
+	if ((errno = pthread_atfork(NULL, NULL, random_fork_child)) != 0)
+		exit_errno("pthread_atfork");
+}
+
+/** Seeds the random number generator of the current thread from the kernel */
+static void random_seed(fastd_random_state_t *state) {
+	pthread_once(&fork_handler_once, random_register_fork_handler);
+
+	get_kernel_random(state->key, sizeof(state->key), false);
+
+	secure_memzero(state->buffer, sizeof(state->buffer));
+	state->available = 0;
+	state->refills = 0;
+	state->generation = fork_generation;
+}
+
+/** Fills the keystream buffer, replacing the key with the first bytes of the new keystream */
+static void random_refill(fastd_random_state_t *state) {
+	if (state->generation != fork_generation || state->refills >= RANDOM_RESEED_INTERVAL)
+		random_seed(state);
+
+	size_t i;
+	for (i = 0; i < RANDOM_BUFFER_BLOCKS; i++)
+		chacha20_block((uint32_t *)(state->buffer + i*CHACHA_BLOCKBYTES), state->key, i);
+
+	memcpy(state->key, state->buffer, CHACHA_KEYBYTES);
+	secure_memzero(state->buffer, CHACHA_KEYBYTES);
+
+	state->available = sizeof(state->buffer) - CHACHA_KEYBYTES;
+	state->refills++;
+}
+
+
+/**
+   Provides a given amount of cryptographic random data
+
+   If \e secure is set, the data is read from the kernel's blocking pool directly (this is used for
+   long-term keys); otherwise, the buffered keystream of the calling thread is used.
+*/
+void fastd_random_bytes(void *buffer, size_t len, bool secure) {
+	if (secure) {
+		get_kernel_random(buffer, len, true);
+		return;
+	}
+
+	fastd_random_state_t *state = &random_state;
+	uint8_t *out = buffer;
+
+	if (state->generation != fork_generation)
+		state->available = 0;
+
+	while (len) {
+		if (!state->available)
+			random_refill(state);
+
+		size_t n = min_size_t(len, state->available);
+		uint8_t *data = state->buffer + sizeof(state->buffer) - state->available;
+
+		memcpy(out, data, n);
+		secure_memzero(data, n);
+
+		out += n;
+		len -= n;
+		state->available -= n;
+	}
+}
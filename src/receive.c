@@ -31,9 +31,12 @@
 
 
 #include "fastd.h"
+#include "capture.h"
 #include "handshake.h"
+#include "latency.h"
 #include "peer.h"
 #include "peer_hashtable.h"
+#include "trace.h"
 
 #include <sys/uio.h>
 
@@ -86,41 +89,10 @@ static inline void handle_socket_control(struct msghdr *message, const fastd_soc
 	}
 }
 
-/**
-   Checks if a handshake should be sent after an unexpected payload packet has been received
-
-   backoff_unknown() tries to avoid flooding hosts with handshakes.
-*/
-static bool backoff_unknown(const fastd_peer_address_t *addr) {
-	size_t i;
-	for (i = 0; i < array_size(ctx.unknown_handshakes); i++) {
-		const fastd_handshake_timeout_t *t = &ctx.unknown_handshakes[(ctx.unknown_handshake_pos + i) % array_size(ctx.unknown_handshakes)];
-
-		if (fastd_timed_out(t->timeout))
-			break;
-
-		if (fastd_peer_address_equal(addr, &t->address)) {
-			pr_debug2("sent a handshake to unknown address %I a short time ago, not sending again", addr);
-			return true;
-		}
-	}
-
-	if (ctx.unknown_handshake_pos == 0)
-		ctx.unknown_handshake_pos = array_size(ctx.unknown_handshakes)-1;
-	else
-		ctx.unknown_handshake_pos--;
-
-	fastd_handshake_timeout_t *t = &ctx.unknown_handshakes[ctx.unknown_handshake_pos];
-
-	t->address = *addr;
-	t->timeout = ctx.now + MIN_HANDSHAKE_INTERVAL;
-
-	return false;
-}
-
 /** Handles a packet received from a known peer address */
 static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer) {
 	if (!fastd_peer_may_connect(peer)) {
+		fastd_stats_drop(peer, DROP_REASON_NO_SESSION);
 		fastd_buffer_free(buffer);
 		return;
 	}
@@ -131,10 +103,11 @@ static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd
 	switch (*packet_type) {
 	case PACKET_DATA:
 		if (!fastd_peer_is_established(peer) || !fastd_peer_address_equal(&peer->local_address, local_addr)) {
+			fastd_stats_drop(peer, DROP_REASON_NO_SESSION);
 			fastd_buffer_free(buffer);
 
-			if (!backoff_unknown(remote_addr)) {
-				pr_debug("unexpectedly received payload data from %P[%I]", peer, remote_addr);
+			if (fastd_handshake_limit_take(remote_addr)) {
+				pr_debug_ratelimited("unexpectedly received payload data from %P[%I]", peer, remote_addr);
 				conf.protocol->handshake_init(sock, local_addr, remote_addr, NULL);
 			}
 			return;
@@ -145,6 +118,11 @@ static inline void handle_socket_receive_known(fastd_socket_t *sock, const fastd
 
 	case PACKET_HANDSHAKE:
 		fastd_handshake_handle(sock, local_addr, remote_addr, peer, buffer);
+		break;
+
+	default:
+		fastd_stats_drop(peer, DROP_REASON_INVALID_TYPE);
+		fastd_buffer_free(buffer);
 	}
 }
 
@@ -160,16 +138,22 @@ static inline void handle_socket_receive_unknown(fastd_socket_t *sock, const fas
 
 	switch (*packet_type) {
 	case PACKET_DATA:
+		fastd_stats_drop(NULL, DROP_REASON_UNKNOWN_PEER);
 		fastd_buffer_free(buffer);
 
-		if (!backoff_unknown(remote_addr)) {
-			pr_debug("unexpectedly received payload data from unknown address %I", remote_addr);
+		if (fastd_handshake_limit_take(remote_addr)) {
+			pr_debug_ratelimited("unexpectedly received payload data from unknown address %I", remote_addr);
 			conf.protocol->handshake_init(sock, local_addr, remote_addr, NULL);
 		}
 		break;
 
 	case PACKET_HANDSHAKE:
 		fastd_handshake_handle(sock, local_addr, remote_addr, NULL, buffer);
+		break;
+
+	default:
+		fastd_stats_drop(NULL, DROP_REASON_INVALID_TYPE);
+		fastd_buffer_free(buffer);
 	}
 }
 
@@ -179,6 +163,7 @@ static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_
 
 	if (sock->peer) {
 		if (!fastd_peer_address_equal(&sock->peer->address, remote_addr)) {
+			fastd_stats_drop(NULL, DROP_REASON_UNKNOWN_PEER);
 			fastd_buffer_free(buffer);
 			return;
 		}
@@ -189,6 +174,9 @@ static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_
 		peer = fastd_peer_hashtable_lookup(remote_addr);
 	}
 
+	fastd_trace_packet_received(peer, buffer.len, *(const uint8_t *)buffer.data);
+	fastd_capture_outer_rx(sock, local_addr, remote_addr, peer, buffer);
+
 	if (peer) {
 		handle_socket_receive_known(sock, local_addr, remote_addr, peer, buffer);
 	}
@@ -196,7 +184,8 @@ static inline void handle_socket_receive(fastd_socket_t *sock, const fastd_peer_
 		handle_socket_receive_unknown(sock, local_addr, remote_addr, buffer);
 	}
 	else  {
-		pr_debug("received packet from unknown peer %I", remote_addr);
+		pr_debug_ratelimited("received packet from unknown peer %I", remote_addr);
+		fastd_stats_drop(NULL, DROP_REASON_UNKNOWN_PEER);
 		fastd_buffer_free(buffer);
 	}
 }
@@ -222,7 +211,7 @@ void fastd_receive(fastd_socket_t *sock) {
 	ssize_t len = recvmsg(sock->fd, &message, 0);
 	if (len <= 0) {
 		if (len < 0)
-			pr_warn_errno("recvmsg");
+			pr_warn_errno_ratelimited("recvmsg");
 
 		fastd_buffer_free(buffer);
 		return;
@@ -234,7 +223,7 @@ void fastd_receive(fastd_socket_t *sock) {
 
 #ifdef USE_PKTINFO
 	if (!local_addr.sa.sa_family) {
-		pr_error("received packet without packet info");
+		pr_error_ratelimited("received packet without packet info");
 		fastd_buffer_free(buffer);
 		return;
 	}
@@ -242,14 +231,22 @@ void fastd_receive(fastd_socket_t *sock) {
 
 	fastd_peer_address_simplify(&recvaddr);
 
+	fastd_latency_rx_start();
 	handle_socket_receive(sock, &local_addr, &recvaddr, buffer);
+	fastd_latency_rx_end();
 }
 
 /** Handles a received and decrypted payload packet */
 void fastd_handle_receive(fastd_peer_t *peer, fastd_buffer_t buffer, bool reordered) {
+	if (fastd_peer_rtt_is_probe(buffer)) {
+		fastd_peer_rtt_handle_probe(peer, buffer);
+		return;
+	}
+
 	if (conf.mode == MODE_TAP) {
 		if (buffer.len < ETH_HLEN) {
-			pr_debug("received truncated packet");
+			pr_debug_ratelimited("received truncated packet");
+			fastd_stats_drop(peer, DROP_REASON_TRUNCATED);
 			fastd_buffer_free(buffer);
 			return;
 		}
@@ -259,13 +256,25 @@ void fastd_handle_receive(fastd_peer_t *peer, fastd_buffer_t buffer, bool reorde
 		if (fastd_eth_addr_is_unicast(src_addr))
 			fastd_peer_eth_addr_add(peer, src_addr);
 	}
+	else {
+		uint8_t version = *((const uint8_t *)buffer.data) >> 4;
+
+		if (version != 4 && version != 6) {
+			pr_debug_ratelimited("received packet with unknown IP version %u from %P", version, peer);
+			fastd_stats_drop(peer, DROP_REASON_INVALID_IP);
+			fastd_buffer_free(buffer);
+			return;
+		}
+	}
 
 	fastd_stats_add(peer, STAT_RX, buffer.len);
 
 	if (reordered)
 		fastd_stats_add(peer, STAT_RX_REORDERED, buffer.len);
 
+	fastd_capture_inner(peer, false, buffer);
 	fastd_tuntap_write(buffer);
+	fastd_latency_rx_written();
 
 	if (conf.mode == MODE_TAP && conf.forward) {
 		fastd_send_data(buffer, peer);
@@ -35,7 +35,9 @@
 
 
 #include "fastd.h"
+#include "capture.h"
 #include "peer.h"
+#include "trace.h"
 
 #include <sys/uio.h>
 
@@ -131,10 +133,12 @@ static void send_type(const fastd_socket_t *sock, const fastd_peer_address_t *lo
 	if (!msg.msg_controllen)
 		msg.msg_control = NULL;
 
+	fastd_capture_outer_tx(sock, local_addr, remote_addr, peer, &packet_type, buffer);
+
 	int ret = sendmsg(sock->fd, &msg, 0);
 
 	if (ret < 0 && errno == EINVAL && msg.msg_controllen) {
-		pr_debug2("sendmsg failed, trying again without pktinfo");
+		pr_debug2_ratelimited("sendmsg failed, trying again without pktinfo");
 
 		if (peer && !fastd_peer_handshake_scheduled(peer))
 			fastd_peer_schedule_handshake_default(peer);
@@ -145,25 +149,27 @@ static void send_type(const fastd_socket_t *sock, const fastd_peer_address_t *lo
 		ret = sendmsg(sock->fd, &msg, 0);
 	}
 
+	fastd_trace_packet_sent(peer, buffer.len, packet_type, (ret < 0) ? errno : 0);
+
 	if (ret < 0) {
 		switch (errno) {
 		case EAGAIN:
 #if EAGAIN != EWOULDBLOCK
 		case EWOULDBLOCK:
 #endif
-			pr_debug2_errno("sendmsg");
+			pr_debug2_errno_ratelimited("sendmsg");
 			fastd_stats_add(peer, STAT_TX_DROPPED, stat_size);
 			break;
 
 		case ENETDOWN:
 		case ENETUNREACH:
 		case EHOSTUNREACH:
-			pr_debug_errno("sendmsg");
+			pr_debug_errno_ratelimited("sendmsg");
 			fastd_stats_add(peer, STAT_TX_ERROR, stat_size);
 			break;
 
 		default:
-			pr_warn_errno("sendmsg");
+			pr_warn_errno_ratelimited("sendmsg");
 			fastd_stats_add(peer, STAT_TX_ERROR, stat_size);
 		}
 	}
@@ -181,9 +187,17 @@ void fastd_send(const fastd_socket_t *sock, const fastd_peer_address_t *local_ad
 
 /** Sends a handshake packet */
 void fastd_send_handshake(const fastd_socket_t *sock, const fastd_peer_address_t *local_addr, const fastd_peer_address_t *remote_addr, fastd_peer_t *peer, fastd_buffer_t buffer) {
+	ctx.handshakes_sent++;
+	fastd_trace_handshake_sent(peer, buffer.len);
 	send_type(sock, local_addr, remote_addr, peer, PACKET_HANDSHAKE, buffer, 0);
 }
 
+/** Encrypts and sends a payload packet to a single peer */
+static inline void send_data_peer(fastd_peer_t *dest, fastd_buffer_t buffer) {
+	fastd_capture_inner(dest, true, buffer);
+	conf.protocol->send(dest, buffer);
+}
+
 /** Encrypts and sends a payload packet to all peers */
 static inline void send_all(fastd_buffer_t buffer, fastd_peer_t *source) {
 	size_t i;
@@ -194,11 +208,11 @@ static inline void send_all(fastd_buffer_t buffer, fastd_peer_t *source) {
 
 		/* optimization, primarily for TUN mode: don't duplicate the buffer for the last (or only) peer */
 		if (i == VECTOR_LEN(ctx.peers)-1) {
-			conf.protocol->send(dest, buffer);
+			send_data_peer(dest, buffer);
 			return;
 		}
 
-		conf.protocol->send(dest, fastd_buffer_dup(buffer, conf.min_encrypt_head_space, conf.min_encrypt_tail_space));
+		send_data_peer(dest, fastd_buffer_dup(buffer, conf.min_encrypt_head_space, conf.min_encrypt_tail_space));
 	}
 
 	fastd_buffer_free(buffer);
@@ -210,7 +224,8 @@ static inline bool send_data_tap_single(fastd_buffer_t buffer, fastd_peer_t *sou
 		return false;
 
 	if (buffer.len < ETH_HLEN) {
-		pr_debug("truncated ethernet packet");
+		pr_debug_ratelimited("truncated ethernet packet");
+		fastd_stats_drop(NULL, DROP_REASON_TRUNCATED);
 		fastd_buffer_free(buffer);
 		return true;
 	}
@@ -237,7 +252,7 @@ static inline bool send_data_tap_single(fastd_buffer_t buffer, fastd_peer_t *sou
 		return true;
 	}
 
-	conf.protocol->send(dest, buffer);
+	send_data_peer(dest, buffer);
 	return true;
 }
 
@@ -32,6 +32,7 @@
 
 #include "sha256.h"
 #include "crypto.h"
+#include "log.h"
 
 #include <stdarg.h>
 #include <string.h>
@@ -71,9 +72,8 @@ static inline void copy_words(uint32_t w[8], const uint32_t *in, ssize_t *left)
 	}
 }
 
-/** Hashes a list of input blocks */
-static void sha256_list(uint32_t out[FASTD_SHA256_HASH_WORDS], const uint32_t *const *in, size_t len) {
-	static const uint32_t k[64] = {
+/** The SHA256 round constants */
+const uint32_t fastd_sha256_k[64] = {
 		0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
 		0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
 		0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
@@ -82,8 +82,107 @@ static void sha256_list(uint32_t out[FASTD_SHA256_HASH_WORDS], const uint32_t *c
 		0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
 		0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
 		0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/** The portable implementation of the SHA256 compression function */
+static void sha256_compress_generic(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t in[2*FASTD_SHA256_BLOCK_WORDS]) {
+	uint32_t w[64], v[8];
+	size_t i;
+
+	memcpy(w, in, 16*sizeof(uint32_t));
+
+	for (i = 16; i < 64; i++) {
+		uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	memcpy(v, h, sizeof(v));
+
+	for (i = 0; i < 64; i++) {
+		uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
+		uint32_t ch = (v[4] & v[5]) ^ ((~v[4]) & v[6]);
+		uint32_t temp1 = v[7] + s1 + ch + fastd_sha256_k[i] + w[i];
+		uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
+		uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
+		uint32_t temp2 = s0 + maj;
+
+		v[7] = v[6];
+		v[6] = v[5];
+		v[5] = v[4];
+		v[4] = v[3] + temp1;
+		v[3] = v[2];
+		v[2] = v[1];
+		v[1] = v[0];
+		v[0] = temp1 + temp2;
+	}
+
+	for (i = 0; i < 8; i++)
+		h[i] += v[i];
+}
+
+/**
+   The SHA256 compression function used
+
+   This is set by fastd_sha256_init() before any other threads are started and not modified afterwards.
+*/
+static fastd_sha256_compress_t sha256_compress = sha256_compress_generic;
+
+
+/** Checks a compression function against the SHA256 hash of "abc" from FIPS 180-2 */
+static bool sha256_self_test(fastd_sha256_compress_t compress) {
+	static const uint32_t in[2*FASTD_SHA256_BLOCK_WORDS] = {
+		0x61626380, 0, 0, 0, 0, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0x00000018
+	};
+	static const uint32_t expected[FASTD_SHA256_HASH_WORDS] = {
+		0xba7816bf, 0x8f01cfea, 0x414140de, 0x5dae2223, 0xb00361a3, 0x96177a9c, 0xb410ff61, 0xf20015ad
 	};
 
+	uint32_t h[FASTD_SHA256_HASH_WORDS] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	compress(h, in);
+
+	return !memcmp(h, expected, sizeof(h));
+}
+
+/** Selects an accelerated compression function if one is built and supported by the CPU */
+static void sha256_select(const char *name, bool (*available)(void), fastd_sha256_compress_t compress) {
+	if (sha256_compress != sha256_compress_generic || !available())
+		return;
+
+	if (!sha256_self_test(compress)) {
+		pr_warn("the %s SHA256 implementation failed its self-test, not using it", name);
+		return;
+	}
+
+	pr_debug("using %s SHA256 implementation", name);
+	sha256_compress = compress;
+}
+
+/**
+   Chooses the SHA256 compression function to use
+
+   Must be called before any other threads are started.
+*/
+void fastd_sha256_init(void) {
+	if (!sha256_self_test(sha256_compress_generic))
+		exit_bug("SHA256 self-test failed");
+
+#ifdef WITH_SHA256_SHANI
+	sha256_select("SHA-NI", fastd_sha256_shani_available, fastd_sha256_compress_shani);
+#endif
+
+#ifdef WITH_SHA256_ARMV8
+	sha256_select("ARMv8", fastd_sha256_armv8_available, fastd_sha256_compress_armv8);
+#endif
+}
+
+
+/** Hashes a list of input blocks */
+static void sha256_list(uint32_t out[FASTD_SHA256_HASH_WORDS], const uint32_t *const *in, size_t len) {
 	uint32_t h[8] = {
 		0x6a09e667,
 		0xbb67ae85,
@@ -98,7 +197,7 @@ static void sha256_list(uint32_t out[FASTD_SHA256_HASH_WORDS], const uint32_t *c
 	size_t i;
 
 	while (left >= -8) {
-		uint32_t w[64], v[8];
+		uint32_t w[16];
 
 		copy_words(w, *(in++), &left);
 		copy_words(w+8, *(in++), &left);
@@ -106,34 +205,7 @@ static void sha256_list(uint32_t out[FASTD_SHA256_HASH_WORDS], const uint32_t *c
 		if (left < -8)
 			w[15] = len << 3;
 
-		for (i = 16; i < 64; i++) {
-			uint32_t s0 = rotr(w[i-15], 7) ^ rotr(w[i-15], 18) ^ (w[i-15] >> 3);
-			uint32_t s1 = rotr(w[i-2], 17) ^ rotr(w[i-2], 19) ^ (w[i-2] >> 10);
-			w[i] = w[i-16] + s0 + w[i-7] + s1;
-		}
-
-		memcpy(v, h, sizeof(v));
-
-		for (i = 0; i < 64; i++) {
-			uint32_t s1 = rotr(v[4], 6) ^ rotr(v[4], 11) ^ rotr(v[4], 25);
-			uint32_t ch = (v[4] & v[5]) ^ ((~v[4]) & v[6]);
-			uint32_t temp1 = v[7] + s1 + ch + k[i] + w[i];
-			uint32_t s0 = rotr(v[0], 2) ^ rotr(v[0], 13) ^ rotr(v[0], 22);
-			uint32_t maj = (v[0] & v[1]) ^ (v[0] & v[2]) ^ (v[1] & v[2]);
-			uint32_t temp2 = s0 + maj;
-
-			v[7] = v[6];
-			v[6] = v[5];
-			v[5] = v[4];
-			v[4] = v[3] + temp1;
-			v[3] = v[2];
-			v[2] = v[1];
-			v[1] = v[0];
-			v[0] = temp1 + temp2;
-		}
-
-		for (i = 0; i < 8; i++)
-			h[i] += v[i];
+		sha256_compress(h, w);
 	}
 
 	for (i = 0; i < 8; i++)
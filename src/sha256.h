@@ -62,6 +62,26 @@ typedef union fastd_sha256 {
 } fastd_sha256_t;
 
 
+/**
+   A SHA256 compression function
+
+   Processes a single 512bit block of input words (in CPU byte order) and updates the hash state \e h
+*/
+typedef void (*fastd_sha256_compress_t)(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t w[2*FASTD_SHA256_BLOCK_WORDS]);
+
+
+extern const uint32_t fastd_sha256_k[64];
+
+
+void fastd_sha256_init(void);
+
+bool fastd_sha256_shani_available(void);
+void fastd_sha256_compress_shani(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t w[2*FASTD_SHA256_BLOCK_WORDS]);
+
+bool fastd_sha256_armv8_available(void);
+void fastd_sha256_compress_armv8(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t w[2*FASTD_SHA256_BLOCK_WORDS]);
+
+
 void fastd_sha256_blocks(fastd_sha256_t *out, ...);
 void fastd_sha256(fastd_sha256_t *out, const uint32_t *in, size_t len);
 
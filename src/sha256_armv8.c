@@ -0,0 +1,75 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   SHA256 compression function using the ARMv8 cryptography extensions
+*/
+
+
+#include "sha256.h"
+
+#include <arm_neon.h>
+#include <sys/auxv.h>
+
+#ifndef HWCAP_SHA2
+/** The SHA2 bit in the AT_HWCAP auxiliary vector entry on AArch64 Linux */
+#define HWCAP_SHA2 (1 << 6)
+#endif
+
+
+/** Checks if the CPU supports the SHA256 instructions */
+bool fastd_sha256_armv8_available(void) {
+	return (getauxval(AT_HWCAP) & HWCAP_SHA2);
+}
+
+/** Processes a single input block using the SHA256H, SHA256H2, SHA256SU0 and SHA256SU1 instructions */
+void fastd_sha256_compress_armv8(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t w[2*FASTD_SHA256_BLOCK_WORDS]) {
+	uint32x4_t state0 = vld1q_u32(&h[0]);
+	uint32x4_t state1 = vld1q_u32(&h[4]);
+
+	const uint32x4_t abcd = state0, efgh = state1;
+
+	uint32x4_t m[4];
+	size_t i;
+
+	for (i = 0; i < 16; i++) {
+		uint32x4_t *cur = &m[i%4];
+
+		if (i < 4)
+			*cur = vld1q_u32(&w[4*i]);
+		else
+			*cur = vsha256su1q_u32(vsha256su0q_u32(*cur, m[(i-3)%4]), m[(i-2)%4], m[(i-1)%4]);
+
+		const uint32x4_t msg = vaddq_u32(*cur, vld1q_u32(&fastd_sha256_k[4*i]));
+		const uint32x4_t tmp = state0;
+		state0 = vsha256hq_u32(state0, state1, msg);
+		state1 = vsha256h2q_u32(state1, tmp, msg);
+	}
+
+	vst1q_u32(&h[0], vaddq_u32(state0, abcd));
+	vst1q_u32(&h[4], vaddq_u32(state1, efgh));
+}
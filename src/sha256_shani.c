@@ -0,0 +1,89 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   SHA256 compression function using the x86 SHA extensions
+*/
+
+
+#include "sha256.h"
+#include "cpuid.h"
+
+#include <immintrin.h>
+
+
+/** Checks if the CPU supports the SHA extensions */
+bool fastd_sha256_shani_available(void) {
+	static const uint64_t cpu_flags = CPUID_SSSE3 | CPUID_SSE41;
+
+	return ((fastd_cpuid() & cpu_flags) == cpu_flags && (fastd_cpuid_ext() & CPUID_EXT_SHA));
+}
+
+/** Processes a single input block using the SHA256RNDS2, SHA256MSG1 and SHA256MSG2 instructions */
+void fastd_sha256_compress_shani(uint32_t h[FASTD_SHA256_HASH_WORDS], const uint32_t w[2*FASTD_SHA256_BLOCK_WORDS]) {
+	/* The SHA instructions keep the state as ABEF and CDGH */
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[0]), 0xb1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&h[4]), 0x1b);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0);
+
+	const __m128i abef = state0, cdgh = state1;
+
+	__m128i m[4];
+	size_t i;
+
+	for (i = 0; i < 16; i++) {
+		__m128i *cur = &m[i%4];
+
+		if (i < 4) {
+			*cur = _mm_loadu_si128((const __m128i *)&w[4*i]);
+		}
+		else {
+			const __m128i prev = m[(i-1)%4];
+
+			*cur = _mm_sha256msg1_epu32(*cur, m[(i-3)%4]);
+			*cur = _mm_add_epi32(*cur, _mm_alignr_epi8(prev, m[(i-2)%4], 4));
+			*cur = _mm_sha256msg2_epu32(*cur, prev);
+		}
+
+		__m128i msg = _mm_add_epi32(*cur, _mm_loadu_si128((const __m128i *)&fastd_sha256_k[4*i]));
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+		msg = _mm_shuffle_epi32(msg, 0x0e);
+		state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+	}
+
+	state0 = _mm_add_epi32(state0, abef);
+	state1 = _mm_add_epi32(state1, cdgh);
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);
+	state1 = _mm_shuffle_epi32(state1, 0xb1);
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0);
+	state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+	_mm_storeu_si128((__m128i *)&h[0], state0);
+	_mm_storeu_si128((__m128i *)&h[4], state1);
+}
@@ -35,213 +35,857 @@
 
 #ifdef WITH_STATUS_SOCKET
 
+#include "async.h"
+#include "capture.h"
+#include "latency.h"
 #include "method.h"
 #include "peer.h"
 
-#include <json.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <sys/un.h>
 
 
-/** Argument for dump_thread */
-typedef struct dump_thread_arg {
-	int fd;				/**< The file descriptor of an accepted socket connection */
-	struct json_object *json;	/**< The JSON object to write to the status socket */
-} dump_thread_arg_t;
+/**
+   A snapshot of a peer's status
 
+   The snapshot is taken in the main thread and serialized by the dump thread, so it must not
+   reference any state that may change in the meantime. Method names belong to the configuration
+   and stay valid.
+*/
+typedef struct status_peer {
+	uint64_t id;				/**< The peer's ID */
+	char key[65];				/**< The peer's description (its public key) */
+	char *name;				/**< A copy of the peer's name or NULL */
+	fastd_peer_address_t address;		/**< The peer's current address */
+
+	bool established;			/**< Specifies if a connection with the peer is established */
+	int64_t established_time;		/**< The time the connection has been established for in milliseconds */
+	const char *method;			/**< The name of the method of the current session or NULL */
+	fastd_stats_t stats;			/**< The peer's traffic statistics */
+	fastd_peer_rtt_t rtt;			/**< The peer's round-trip time estimates */
+
+	size_t eth_addrs_offset;		/**< The index of the peer's first MAC address in the \e eth_addrs vector of the snapshot */
+	size_t n_eth_addrs;			/**< The number of MAC addresses of the peer */
+} status_peer_t;
+
+/** A snapshot of fastd's status, serialized by dump_thread */
+typedef struct status_snapshot {
+	int fd;					/**< The file descriptor of an accepted socket connection */
+	bool metrics;				/**< Specifies if the snapshot is written in OpenMetrics format instead of JSON */
+
+	bool tap;				/**< Specifies if MAC addresses are included */
+	int64_t uptime;				/**< fastd's uptime in milliseconds */
+	fastd_stats_t stats;			/**< The global traffic statistics */
+	uint64_t handshakes_sent;		/**< The number of handshakes to unknown addresses allowed by the rate limit */
+	uint64_t handshakes_dropped[HANDSHAKE_LIMIT_MAX]; /**< The number of handshakes to unknown addresses suppressed by the rate limit */
+	size_t key_cache_size;			/**< The size of the protocol's key cache */
+	uint64_t handshake_packets[2];		/**< The number of handshake packets received and sent */
+	uint64_t handshake_queue_dropped;	/**< The number of handshakes dropped because the worker queue was full */
+	uint64_t log_dropped;			/**< The number of log messages dropped because the logging thread couldn't keep up */
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	fastd_latency_histogram_t latency[LATENCY_MAX]; /**< The data path latency histograms */
+	fastd_latency_method_t *latency_methods; /**< The encryption function timings, indexed like conf.methods */
+#endif
 
-/** Thread to write the status JSON to the status socket */
-static void * dump_thread(void *p) {
-	dump_thread_arg_t *arg = p;
+	VECTOR(status_peer_t) peers;		/**< The snapshots of all enabled peers */
+	VECTOR(fastd_eth_addr_t) eth_addrs;	/**< The MAC addresses of all peers */
+} status_snapshot_t;
 
-	const char *str = json_object_to_json_string(arg->json);
-	size_t left = strlen(str);
 
-	while (left > 0) {
-		ssize_t written = write(arg->fd, str, left);
-		if (written < 0) {
-			pr_error_errno("can't dump status: write");
+/** The maximum length of a command on the control socket */
+#define CONTROL_MAX_LINE 256
+
+/** The time a client may take to send its command on the control socket (in milliseconds) */
+#define CONTROL_TIMEOUT 10000
+
+/** The maximum number of clients subscribed to the event stream at the same time */
+#define SUBSCRIBERS_MAX 16
+
+/** The maximum number of events queued for a subscriber */
+#define SUBSCRIBER_QUEUE_MAX 1024
+
+/** The interval queued events are written to the subscribers in (in milliseconds) */
+#define SUBSCRIBER_POLL_INTERVAL 50
+
+
+/** The state of an event subscription */
+typedef enum subscriber_state {
+	SUBSCRIBER_REQUESTED,			/**< The subscription has been passed to the main thread */
+	SUBSCRIBER_ACTIVE,			/**< Events are queued for the subscriber */
+	SUBSCRIBER_REFUSED,			/**< The main thread has refused the subscription */
+	SUBSCRIBER_CLOSING,			/**< The client has closed the connection */
+	SUBSCRIBER_CLOSED,			/**< The main thread doesn't reference the subscriber anymore */
+} subscriber_state_t;
+
+/** The identity of a peer in a statistics sample */
+typedef struct subscriber_identity {
+	char *name;				/**< The peer's name (or NULL) */
+	char key[65];				/**< The peer's key (or an empty string) */
+} subscriber_identity_t;
+
+/** The traffic statistics of a peer in a statistics sample */
+typedef struct subscriber_peer {
+	uint64_t id;				/**< The peer's ID */
+	fastd_stats_t stats;			/**< The peer's statistics */
+	subscriber_identity_t *identity;	/**< The peer's identity (NULL if the peer was part of the previous sample) */
+} subscriber_peer_t;
+
+/** The statistics taken by the main thread for a statistics event */
+typedef struct subscriber_sample {
+	fastd_timeout_t time;			/**< The time the sample was taken */
+	fastd_stats_t stats;			/**< The global statistics */
+	VECTOR(subscriber_peer_t) peers;	/**< The statistics of the established peers, ordered by ID */
+} subscriber_sample_t;
+
+/**
+   A client subscribed to the event stream of the control socket
+
+   Events are formatted by the main thread and queued for the subscriber's connection thread,
+   which writes them to the client. For the statistics events, the main thread only takes samples
+   of the counters; they are compared and formatted by the connection thread.
+*/
+struct fastd_subscriber {
+	pthread_mutex_t mutex;			/**< Protects \e state, \e queue, \e dropped and \e sample */
+	pthread_cond_t cond;			/**< Signals changes of \e state */
+	subscriber_state_t state;		/**< The state of the subscription */
+	VECTOR(char *) queue;			/**< The events that haven't been written yet */
+	uint64_t dropped;			/**< The number of events dropped because the queue was full */
+	subscriber_sample_t *sample;		/**< The statistics sample that hasn't been reported yet */
+
+	int fd;					/**< The client connection */
+	int interval;				/**< The interval of the statistics events in milliseconds (or 0) */
+
+	fastd_timer_t timer;			/**< The timer for the statistics events (used by the main thread) */
+	VECTOR(uint64_t) sampled;		/**< The IDs of the peers in the last sample taken, ordered (used by the main thread) */
+
+	subscriber_sample_t *last;		/**< The sample of the last statistics event (used by the connection thread) */
+	char *buf;				/**< The buffer the statistics events are formatted in (used by the connection thread) */
+	size_t buf_size;			/**< The size of \e buf */
+};
+
+/** The names of the peer events */
+static const char *const event_names[STATUS_EVENT_MAX] = {
+	[STATUS_EVENT_ESTABLISHED] = "established",
+	[STATUS_EVENT_DISESTABLISHED] = "disestablished",
+	[STATUS_EVENT_SESSION_REFRESHED] = "session_refreshed",
+	[STATUS_EVENT_ADDRESS_CHANGED] = "address_changed",
+};
+
+
+/** Writes a string as a JSON string literal */
+static void write_string(FILE *f, const char *str) {
+	if (!str) {
+		fputs("null", f);
+		return;
+	}
+
+	putc('"', f);
+
+	const unsigned char *c;
+	for (c = (const unsigned char *)str; *c; c++) {
+		switch (*c) {
+		case '"':
+		case '\\':
+			putc('\\', f);
+			putc(*c, f);
 			break;
-		}
 
-		left -= written;
-		str += written;
+		default:
+			if (*c < 0x20)
+				fprintf(f, "\\u%04x", *c);
+			else
+				putc(*c, f);
+		}
 	}
 
-	close(arg->fd);
-	json_object_put(arg->json);
-	free(arg);
+	putc('"', f);
+}
 
-	return NULL;
+/** The names of the drop reasons */
+static const char *const drop_reasons[DROP_REASON_MAX] = {
+	[DROP_REASON_UNKNOWN_PEER] = "unknown_peer",
+	[DROP_REASON_INVALID_TYPE] = "invalid_type",
+	[DROP_REASON_NO_SESSION] = "no_session",
+	[DROP_REASON_DECRYPT] = "decrypt",
+	[DROP_REASON_DUPLICATE] = "duplicate",
+	[DROP_REASON_TOO_OLD] = "too_old",
+	[DROP_REASON_TRUNCATED] = "truncated",
+	[DROP_REASON_INVALID_IP] = "invalid_ip",
+	[DROP_REASON_ENCRYPT] = "encrypt",
+};
+
+
+/** Writes a single traffic stat as a JSON object */
+static void write_stat(FILE *f, const char *name, const fastd_stats_t *stats, fastd_stat_type_t type) {
+	fprintf(f, "\"%s\": { \"packets\": %" PRIu64 ", \"bytes\": %" PRIu64 " }", name, stats->counters[type].packets, stats->counters[type].bytes);
 }
 
+/** Writes a fastd_stats_t as a JSON object */
+static void write_stats(FILE *f, const fastd_stats_t *stats) {
+	fputs("{ ", f);
+	write_stat(f, "rx", stats, STAT_RX);
+	fputs(", ", f);
+	write_stat(f, "rx_reordered", stats, STAT_RX_REORDERED);
+	fputs(", ", f);
+	write_stat(f, "tx", stats, STAT_TX);
+	fputs(", ", f);
+	write_stat(f, "tx_dropped", stats, STAT_TX_DROPPED);
+	fputs(", ", f);
+	write_stat(f, "tx_error", stats, STAT_TX_ERROR);
+	fputs(", \"dropped\": { ", f);
 
-/** Dumps a single traffic stat as a JSON object */
-static json_object * dump_stat(const fastd_stats_t *stats, fastd_stat_type_t type) {
-	struct json_object *ret = json_object_new_object();
+	size_t i;
+	for (i = 0; i < DROP_REASON_MAX; i++)
+		fprintf(f, "%s\"%s\": %" PRIu64, i ? ", " : "", drop_reasons[i], stats->dropped[i]);
 
-	json_object_object_add(ret, "packets", json_object_new_int64(stats->packets[type]));
-	json_object_object_add(ret, "bytes", json_object_new_int64(stats->bytes[type]));
+	fputs(" } }", f);
+}
 
-	return ret;
+/** Writes the statistics of the rate limit for handshakes to unknown addresses as a JSON object */
+static void write_handshake_limit(FILE *f, const status_snapshot_t *snapshot) {
+	fprintf(f, "{ \"sent\": %" PRIu64 ", \"dropped_address\": %" PRIu64 ", \"dropped_prefix\": %" PRIu64 ", \"dropped_global\": %" PRIu64 " }",
+		snapshot->handshakes_sent,
+		snapshot->handshakes_dropped[HANDSHAKE_LIMIT_ADDRESS],
+		snapshot->handshakes_dropped[HANDSHAKE_LIMIT_PREFIX],
+		snapshot->handshakes_dropped[HANDSHAKE_LIMIT_GLOBAL]);
 }
 
-/** Dumps a fastd_stats_t as a JSON object */
-static json_object * dump_stats(const fastd_stats_t *stats) {
-	struct json_object *statistics = json_object_new_object();
+#ifdef WITH_LATENCY_HISTOGRAMS
+
+/** The names of the latency histograms */
+static const char *const latency_stages[LATENCY_MAX] = {
+	[LATENCY_TX_ENCRYPT] = "tx_encrypt",
+	[LATENCY_TX_SEND] = "tx_send",
+	[LATENCY_TX_TOTAL] = "tx_total",
+	[LATENCY_RX_DECRYPT] = "rx_decrypt",
+	[LATENCY_RX_WRITE] = "rx_write",
+	[LATENCY_RX_TOTAL] = "rx_total",
+};
+
+/**
+   Writes the data path latency histograms and method timings as a JSON object
+
+   Bucket \e i of each histogram counts the samples of at most 2^i nanoseconds.
+*/
+static void write_latency(FILE *f, const status_snapshot_t *snapshot) {
+	fputs("{ ", f);
+
+	size_t i, j;
+	for (i = 0; i < LATENCY_MAX; i++) {
+		const fastd_latency_histogram_t *histogram = &snapshot->latency[i];
+
+		fprintf(f, "\"%s\": { \"count\": %" PRIu64 ", \"sum\": %" PRIu64 ", \"buckets\": [ ",
+			latency_stages[i], histogram->count, histogram->sum);
 
-	json_object_object_add(statistics, "rx", dump_stat(stats, STAT_RX));
-	json_object_object_add(statistics, "rx_reordered", dump_stat(stats, STAT_RX_REORDERED));
+		for (j = 0; j < LATENCY_BUCKETS; j++)
+			fprintf(f, "%s%" PRIu64, j ? ", " : "", histogram->buckets[j]);
+
+		fputs(" ] }, ", f);
+	}
 
-	json_object_object_add(statistics, "tx", dump_stat(stats, STAT_TX));
-	json_object_object_add(statistics, "tx_dropped", dump_stat(stats, STAT_TX_DROPPED));
-	json_object_object_add(statistics, "tx_error", dump_stat(stats, STAT_TX_ERROR));
+	fputs("\"methods\": { ", f);
 
-	return statistics;
+	for (i = 0; conf.methods[i].name; i++) {
+		const fastd_latency_method_t *method = &snapshot->latency_methods[i];
+
+		if (i)
+			fputs(", ", f);
+
+		write_string(f, conf.methods[i].name);
+		fprintf(f, ": { \"encrypt\": { \"calls\": %" PRIu64 ", \"cycles\": %" PRIu64 " }, \"decrypt\": { \"calls\": %" PRIu64 ", \"cycles\": %" PRIu64 " } }",
+			method->encrypt_calls, method->encrypt_cycles, method->decrypt_calls, method->decrypt_cycles);
+	}
+
+	fputs(" } }", f);
 }
 
+#endif
 
-/** Dumps a peer's status as a JSON object */
-static json_object * dump_peer(const fastd_peer_t *peer) {
-	struct json_object *ret = json_object_new_object();
+/** Writes a time in microseconds as a JSON value, or null if it is unknown */
+static void write_usec(FILE *f, uint32_t usec, bool known) {
+	if (known)
+		fprintf(f, "%u", (unsigned)usec);
+	else
+		fputs("null", f);
+}
 
+/** Writes a peer's round-trip time estimates as a JSON object */
+static void write_rtt(FILE *f, const fastd_peer_rtt_t *rtt) {
+	fputs("{ \"srtt\": ", f);
+	write_usec(f, rtt->srtt, rtt->srtt);
+	fputs(", \"rttvar\": ", f);
+	write_usec(f, rtt->rttvar, rtt->srtt);
+	fputs(", \"jitter\": ", f);
+	write_usec(f, rtt->jitter, rtt->srtt);
+	fprintf(f, ", \"loss\": %.4f, \"probes_sent\": %" PRIu64 ", \"probes_lost\": %" PRIu64 " }",
+		rtt->loss/65536.0, rtt->probes_sent, rtt->probes_lost);
+}
+
+/** Writes a peer's status as a JSON object */
+static void write_peer(FILE *f, const status_snapshot_t *snapshot, const status_peer_t *peer) {
 	/* '[' + IPv6 addresss + '%' + interface + ']:' + port + NUL */
 	char addr_buf[1 + INET6_ADDRSTRLEN + 2 + IFNAMSIZ + 1 + 5 + 1];
 	fastd_snprint_peer_address(addr_buf, sizeof(addr_buf), &peer->address, NULL, false, false);
 
-	json_object_object_add(ret, "name", peer->name ? json_object_new_string(peer->name) : NULL);
-	json_object_object_add(ret, "address", json_object_new_string(addr_buf));
+	fprintf(f, "{ \"id\": %" PRIu64 ", \"name\": ", peer->id);
+	write_string(f, peer->name);
+	fputs(", \"address\": ", f);
+	write_string(f, addr_buf);
+	fputs(", \"connection\": ", f);
 
-	struct json_object *connection = NULL;
+	if (!peer->established) {
+		fputs("null }", f);
+		return;
+	}
 
-	if (fastd_peer_is_established(peer)) {
-		connection = json_object_new_object();
+	fprintf(f, "{ \"established\": %" PRId64 ", \"method\": ", peer->established_time);
+	write_string(f, peer->method);
+	fputs(", \"statistics\": ", f);
+	write_stats(f, &peer->stats);
+	fputs(", \"rtt\": ", f);
+	write_rtt(f, &peer->rtt);
 
-		json_object_object_add(connection, "established", json_object_new_int64(ctx.now - peer->established));
+	if (snapshot->tap) {
+		fputs(", \"mac_addresses\": [ ", f);
 
-		struct json_object *method = NULL;
+		size_t i;
+		for (i = 0; i < peer->n_eth_addrs; i++) {
+			const uint8_t *d = VECTOR_INDEX(snapshot->eth_addrs, peer->eth_addrs_offset + i).data;
 
-		const fastd_method_info_t *method_info = conf.protocol->get_current_method(peer);
+			fprintf(f, "%s\"%02x:%02x:%02x:%02x:%02x:%02x\"", i ? ", " : "",
+				d[0], d[1], d[2], d[3], d[4], d[5]);
+		}
 
-		if (method_info)
-			method = json_object_new_string(method_info->name);
+		fputs(" ]", f);
+	}
 
-		json_object_object_add(connection, "method", method);
+	fputs(" } }", f);
+}
 
-		json_object_object_add(connection, "statistics", dump_stats(&peer->stats));
+/** Writes a status snapshot as a JSON object */
+static void write_status(FILE *f, const status_snapshot_t *snapshot) {
+	fprintf(f, "{ \"uptime\": %" PRId64 ", \"statistics\": ", snapshot->uptime);
+	write_stats(f, &snapshot->stats);
+	fputs(", \"unknown_handshakes\": ", f);
+	write_handshake_limit(f, snapshot);
+	fprintf(f, ", \"key_cache_size\": %zu, \"log_dropped\": %" PRIu64 ", ", snapshot->key_cache_size, snapshot->log_dropped);
+#ifdef WITH_LATENCY_HISTOGRAMS
+	fputs("\"latency\": ", f);
+	write_latency(f, snapshot);
+	fputs(", ", f);
+#endif
+	fputs("\"peers\": { ", f);
 
-		if (conf.mode == MODE_TAP) {
-			struct json_object *mac_addresses = json_object_new_array();
-			json_object_object_add(connection, "mac_addresses", mac_addresses);
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(snapshot->peers); i++) {
+		const status_peer_t *peer = &VECTOR_INDEX(snapshot->peers, i);
 
-			size_t i;
-			for (i = 0; i < VECTOR_LEN(ctx.eth_addrs); i++) {
-				fastd_peer_eth_addr_t *addr = &VECTOR_INDEX(ctx.eth_addrs, i);
+		if (i)
+			fputs(", ", f);
 
-				if (addr->peer != peer)
-					continue;
+		write_string(f, peer->key);
+		fputs(": ", f);
+		write_peer(f, snapshot, peer);
+	}
 
-				const uint8_t *d = addr->addr.data;
+	fputs(" } }", f);
+}
 
-				char eth_addr_buf[18];
-				snprintf(eth_addr_buf, sizeof(eth_addr_buf),
-					 "%02x:%02x:%02x:%02x:%02x:%02x",
-					 d[0], d[1], d[2], d[3], d[4], d[5]);
+/** Writes a string as an OpenMetrics label value */
+static void write_label_value(FILE *f, const char *str) {
+	putc('"', f);
 
-				json_object_array_add(mac_addresses, json_object_new_string(eth_addr_buf));
-			}
+	for (; *str; str++) {
+		switch (*str) {
+		case '"':
+		case '\\':
+			putc('\\', f);
+			putc(*str, f);
+			break;
+
+		case '\n':
+			fputs("\\n", f);
+			break;
+
+		default:
+			putc(*str, f);
+		}
+	}
+
+	putc('"', f);
+}
+
+/** Writes the header of an OpenMetrics metric family */
+static void write_metric_family(FILE *f, const char *name, const char *type, const char *help) {
+	fprintf(f, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/** Writes the traffic counters of a fastd_stats_t as samples of the fastd(_peer)_packets and fastd(_peer)_bytes families */
+static void write_metrics_stats(FILE *f, const char *family, const char *labels, const fastd_stats_t *stats, bool bytes) {
+	static const struct {
+		fastd_stat_type_t type;
+		const char *name;
+	} types[STAT_MAX] = {
+		{ STAT_RX, "rx" },
+		{ STAT_RX_REORDERED, "rx_reordered" },
+		{ STAT_TX, "tx" },
+		{ STAT_TX_DROPPED, "tx_dropped" },
+		{ STAT_TX_ERROR, "tx_error" },
+	};
+
+	size_t i;
+	for (i = 0; i < STAT_MAX; i++) {
+		const fastd_stat_counter_t *counter = &stats->counters[types[i].type];
+		fprintf(f, "%s_total{%s%stype=\"%s\"} %" PRIu64 "\n", family, labels, *labels ? "," : "", types[i].name, bytes ? counter->bytes : counter->packets);
+	}
+}
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+
+/** Writes the data path latency histograms and method timings in OpenMetrics format */
+static void write_metrics_latency(FILE *f, const status_snapshot_t *snapshot) {
+	size_t i, j;
+
+	write_metric_family(f, "fastd_latency_seconds", "histogram", "Latency of the stages of the data path");
+
+	for (i = 0; i < LATENCY_MAX; i++) {
+		const fastd_latency_histogram_t *histogram = &snapshot->latency[i];
+		uint64_t count = 0;
+
+		for (j = 0; j < LATENCY_BUCKETS-1; j++) {
+			count += histogram->buckets[j];
+			fprintf(f, "fastd_latency_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %" PRIu64 "\n",
+				latency_stages[i], (double)(UINT64_C(1) << j) / 1e9, count);
 		}
+
+		fprintf(f, "fastd_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %" PRIu64 "\n", latency_stages[i], histogram->count);
+		fprintf(f, "fastd_latency_seconds_count{stage=\"%s\"} %" PRIu64 "\n", latency_stages[i], histogram->count);
+		fprintf(f, "fastd_latency_seconds_sum{stage=\"%s\"} %" PRIu64 ".%09u\n", latency_stages[i],
+			histogram->sum/1000000000, (unsigned)(histogram->sum%1000000000));
+	}
+
+	write_metric_family(f, "fastd_method_calls", "counter", "Calls of the encryption functions of a method");
+
+	for (i = 0; conf.methods[i].name; i++) {
+		fputs("fastd_method_calls_total{method=", f);
+		write_label_value(f, conf.methods[i].name);
+		fprintf(f, ",operation=\"encrypt\"} %" PRIu64 "\n", snapshot->latency_methods[i].encrypt_calls);
+		fputs("fastd_method_calls_total{method=", f);
+		write_label_value(f, conf.methods[i].name);
+		fprintf(f, ",operation=\"decrypt\"} %" PRIu64 "\n", snapshot->latency_methods[i].decrypt_calls);
+	}
+
+	write_metric_family(f, "fastd_method_cycles", "counter", "Timestamp counter ticks spent in the encryption functions of a method");
+
+	for (i = 0; conf.methods[i].name; i++) {
+		fputs("fastd_method_cycles_total{method=", f);
+		write_label_value(f, conf.methods[i].name);
+		fprintf(f, ",operation=\"encrypt\"} %" PRIu64 "\n", snapshot->latency_methods[i].encrypt_cycles);
+		fputs("fastd_method_cycles_total{method=", f);
+		write_label_value(f, conf.methods[i].name);
+		fprintf(f, ",operation=\"decrypt\"} %" PRIu64 "\n", snapshot->latency_methods[i].decrypt_cycles);
 	}
+}
 
-	json_object_object_add(ret, "connection", connection);
+#endif
 
+/** Writes the drop counters of a fastd_stats_t as samples of the fastd(_peer)_dropped_packets family */
+static void write_metrics_drops(FILE *f, const char *family, const char *labels, const fastd_stats_t *stats) {
+	size_t i;
+	for (i = 0; i < DROP_REASON_MAX; i++)
+		fprintf(f, "%s_total{%s%sreason=\"%s\"} %" PRIu64 "\n", family, labels, *labels ? "," : "", drop_reasons[i], stats->dropped[i]);
+}
+
+/**
+   Formats the labels identifying a peer
+
+   The labels are formatted once per peer and reused for all of its samples.
+*/
+static char * format_peer_labels(const status_peer_t *peer) {
+	size_t name_len = peer->name ? strlen(peer->name) : 0;
+
+	/* Each character of the name takes at most two bytes after escaping */
+	char *ret = fastd_alloc(sizeof("peer=\"\",name=\"\"") + sizeof(peer->key) + 2*name_len);
+	char *p = ret + sprintf(ret, "peer=\"%s\"", peer->key);
+
+	if (peer->name) {
+		p += sprintf(p, ",name=\"");
+
+		const char *c;
+		for (c = peer->name; *c; c++) {
+			switch (*c) {
+			case '"':
+			case '\\':
+				*p++ = '\\';
+				*p++ = *c;
+				break;
+
+			case '\n':
+				*p++ = '\\';
+				*p++ = 'n';
+				break;
+
+			default:
+				*p++ = *c;
+			}
+		}
+
+		*p++ = '"';
+	}
+
+	*p = 0;
 	return ret;
 }
 
-/** Dumps fastd's status to a connected socket */
-static void dump_status(int fd) {
-	struct json_object *json = json_object_new_object();
+/** Writes a status snapshot in OpenMetrics text format */
+static void write_metrics(FILE *f, const status_snapshot_t *snapshot) {
+	size_t i, n_established = 0;
+	for (i = 0; i < VECTOR_LEN(snapshot->peers); i++) {
+		if (VECTOR_INDEX(snapshot->peers, i).established)
+			n_established++;
+	}
+
+	write_metric_family(f, "fastd_uptime_seconds", "gauge", "Time since fastd was started");
+	fprintf(f, "fastd_uptime_seconds %" PRId64 ".%03u\n", snapshot->uptime/1000, (unsigned)(snapshot->uptime%1000));
+
+	write_metric_family(f, "fastd_packets", "counter", "Packets handled by fastd");
+	write_metrics_stats(f, "fastd_packets", "", &snapshot->stats, false);
+	write_metric_family(f, "fastd_bytes", "counter", "Payload bytes handled by fastd");
+	write_metrics_stats(f, "fastd_bytes", "", &snapshot->stats, true);
+	write_metric_family(f, "fastd_dropped_packets", "counter", "Packets dropped by fastd, by reason");
+	write_metrics_drops(f, "fastd_dropped_packets", "", &snapshot->stats);
 
-	json_object_object_add(json, "uptime", json_object_new_int64(ctx.now - ctx.started));
+	write_metric_family(f, "fastd_handshake_packets", "counter", "Handshake packets handled by fastd");
+	fprintf(f, "fastd_handshake_packets_total{type=\"rx\"} %" PRIu64 "\n", snapshot->handshake_packets[0]);
+	fprintf(f, "fastd_handshake_packets_total{type=\"tx\"} %" PRIu64 "\n", snapshot->handshake_packets[1]);
 
-	json_object_object_add(json, "statistics", dump_stats(&ctx.stats));
+	write_metric_family(f, "fastd_handshake_queue_dropped", "counter", "Received handshakes dropped because the worker queue was full");
+	fprintf(f, "fastd_handshake_queue_dropped_total %" PRIu64 "\n", snapshot->handshake_queue_dropped);
 
-	struct json_object *peers = json_object_new_object();
-	json_object_object_add(json, "peers", peers);
+	write_metric_family(f, "fastd_unknown_handshakes", "counter", "Handshakes to unknown addresses, by rate limit result");
+	fprintf(f, "fastd_unknown_handshakes_total{result=\"sent\"} %" PRIu64 "\n", snapshot->handshakes_sent);
+	fprintf(f, "fastd_unknown_handshakes_total{result=\"dropped_address\"} %" PRIu64 "\n", snapshot->handshakes_dropped[HANDSHAKE_LIMIT_ADDRESS]);
+	fprintf(f, "fastd_unknown_handshakes_total{result=\"dropped_prefix\"} %" PRIu64 "\n", snapshot->handshakes_dropped[HANDSHAKE_LIMIT_PREFIX]);
+	fprintf(f, "fastd_unknown_handshakes_total{result=\"dropped_global\"} %" PRIu64 "\n", snapshot->handshakes_dropped[HANDSHAKE_LIMIT_GLOBAL]);
 
+	write_metric_family(f, "fastd_log_dropped_messages", "counter", "Log messages dropped because the logging thread couldn't keep up");
+	fprintf(f, "fastd_log_dropped_messages_total %" PRIu64 "\n", snapshot->log_dropped);
+
+	write_metric_family(f, "fastd_key_cache_size", "gauge", "Size of the protocol's key cache");
+	fprintf(f, "fastd_key_cache_size %zu\n", snapshot->key_cache_size);
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	write_metrics_latency(f, snapshot);
+#endif
+
+	write_metric_family(f, "fastd_peers", "gauge", "Number of enabled peers");
+	fprintf(f, "fastd_peers %zu\n", VECTOR_LEN(snapshot->peers));
+	write_metric_family(f, "fastd_peers_established", "gauge", "Number of peers with an established connection");
+	fprintf(f, "fastd_peers_established %zu\n", n_established);
+
+	/* The samples of a metric family must be grouped, so the per-peer families are written one after another */
+	static const char *const families[] = {
+		"fastd_peer_established",
+		"fastd_peer_session_age_seconds",
+		"fastd_peer_method",
+		"fastd_peer_packets",
+		"fastd_peer_bytes",
+		"fastd_peer_dropped_packets",
+		"fastd_peer_rtt_seconds",
+		"fastd_peer_rtt_jitter_seconds",
+		"fastd_peer_rtt_loss_ratio",
+	};
+	static const char *const family_types[] = {
+		"gauge", "gauge", "info", "counter", "counter", "counter", "gauge", "gauge", "gauge",
+	};
+	static const char *const family_help[] = {
+		"Specifies if a connection with the peer is established",
+		"Time since the connection with the peer has been established",
+		"Method of the current session with the peer",
+		"Packets exchanged with the peer during the current connection",
+		"Payload bytes exchanged with the peer during the current connection",
+		"Packets from or to the peer dropped during the current connection, by reason",
+		"Smoothed round-trip time to the peer",
+		"Jitter of the round-trip time to the peer",
+		"Smoothed ratio of unanswered round-trip time probes",
+	};
+
+	char **labels = fastd_new_array(VECTOR_LEN(snapshot->peers), char *);
+
+	for (i = 0; i < VECTOR_LEN(snapshot->peers); i++)
+		labels[i] = format_peer_labels(&VECTOR_INDEX(snapshot->peers, i));
+
+	size_t family;
+	for (family = 0; family < array_size(families); family++) {
+		write_metric_family(f, families[family], family_types[family], family_help[family]);
+
+		for (i = 0; i < VECTOR_LEN(snapshot->peers); i++) {
+			const status_peer_t *peer = &VECTOR_INDEX(snapshot->peers, i);
+
+			switch (family) {
+			case 0:
+				fprintf(f, "fastd_peer_established{%s} %u\n", labels[i], peer->established ? 1 : 0);
+				break;
+
+			case 1:
+				if (peer->established)
+					fprintf(f, "fastd_peer_session_age_seconds{%s} %" PRId64 ".%03u\n", labels[i],
+						peer->established_time/1000, (unsigned)(peer->established_time%1000));
+				break;
+
+			case 2:
+				if (peer->method) {
+					fprintf(f, "fastd_peer_method_info{%s,method=", labels[i]);
+					write_label_value(f, peer->method);
+					fputs("} 1\n", f);
+				}
+				break;
+
+			case 3:
+			case 4:
+				if (peer->established)
+					write_metrics_stats(f, families[family], labels[i], &peer->stats, family == 4);
+				break;
+
+			case 5:
+				if (peer->established)
+					write_metrics_drops(f, families[family], labels[i], &peer->stats);
+				break;
+
+			case 6:
+			case 7:
+				if (peer->established && peer->rtt.srtt) {
+					uint32_t usec = (family == 6) ? peer->rtt.srtt : peer->rtt.jitter;
+					fprintf(f, "%s{%s} %u.%06u\n", families[family], labels[i],
+						(unsigned)(usec/1000000), (unsigned)(usec%1000000));
+				}
+				break;
+
+			case 8:
+				if (peer->established && peer->rtt.srtt)
+					fprintf(f, "fastd_peer_rtt_loss_ratio{%s} %.4f\n", labels[i], peer->rtt.loss/65536.0);
+			}
+		}
+	}
+
+	for (i = 0; i < VECTOR_LEN(snapshot->peers); i++)
+		free(labels[i]);
+	free(labels);
+
+	fputs("# EOF\n", f);
+}
+
+/** Frees a status snapshot */
+static void free_snapshot(status_snapshot_t *snapshot) {
 	size_t i;
-	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
-		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
+	for (i = 0; i < VECTOR_LEN(snapshot->peers); i++)
+		free(VECTOR_INDEX(snapshot->peers, i).name);
+
+	VECTOR_FREE(snapshot->peers);
+	VECTOR_FREE(snapshot->eth_addrs);
+#ifdef WITH_LATENCY_HISTOGRAMS
+	free(snapshot->latency_methods);
+#endif
+	free(snapshot);
+}
 
-		if (!fastd_peer_is_enabled(peer))
-			continue;
 
-		char buf[65];
-		if (conf.protocol->describe_peer(peer, buf, sizeof(buf)))
-			json_object_object_add(peers, buf, dump_peer(peer));
+/** Compares two MAC addresses */
+static int eth_addr_cmp(const void *a, const void *b) {
+	return memcmp(a, b, sizeof(fastd_eth_addr_t));
+}
+
+/** Sorts the MAC addresses of each peer of a snapshot, as they are indexed in no particular order */
+static void sort_eth_addrs(status_snapshot_t *snapshot) {
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(snapshot->peers); i++) {
+		const status_peer_t *peer = &VECTOR_INDEX(snapshot->peers, i);
+
+		if (peer->n_eth_addrs > 1)
+			qsort(&VECTOR_INDEX(snapshot->eth_addrs, peer->eth_addrs_offset), peer->n_eth_addrs, sizeof(fastd_eth_addr_t), eth_addr_cmp);
 	}
+}
 
 
-	dump_thread_arg_t *arg = fastd_new(dump_thread_arg_t);
+/** Thread serializing a status snapshot to the status socket */
+static void * dump_thread(void *p) {
+	status_snapshot_t *snapshot = p;
 
-	arg->json = json;
-	arg->fd = fd;
+	FILE *f = fdopen(snapshot->fd, "w");
+	if (f) {
+		if (snapshot->metrics) {
+			write_metrics(f, snapshot);
+		}
+		else {
+			sort_eth_addrs(snapshot);
+			write_status(f, snapshot);
+		}
 
-	pthread_t thread;
-	if ((errno = pthread_create(&thread, &ctx.detached_thread, dump_thread, arg)) != 0) {
-		pr_error_errno("unable to create status dump thread");
+		if (fflush(f) || ferror(f))
+			pr_error_errno("can't dump status: write");
 
-		close(arg->fd);
-		json_object_put(arg->json);
-		free(arg);
+		fclose(f);
+	}
+	else {
+		pr_error_errno("can't dump status: fdopen");
+		close(snapshot->fd);
 	}
+
+	free_snapshot(snapshot);
+
+	return NULL;
 }
 
-/** Initialized the status socket */
-void fastd_status_init(void) {
-	if (!conf.status_socket) {
-		ctx.status_fd = -1;
+
+/** Takes a snapshot of a peer's status */
+static void snapshot_peer(status_snapshot_t *snapshot, const fastd_peer_t *peer) {
+	status_peer_t entry = {};
+
+	if (!conf.protocol->describe_peer(peer, entry.key, sizeof(entry.key)))
 		return;
-	}
 
-#ifdef USE_USER
-	uid_t uid = geteuid();
-	gid_t gid = getegid();
+	entry.id = peer->id;
+	entry.name = fastd_strdup(peer->name);
+	entry.address = peer->address;
 
-	if (conf.user || conf.group) {
-		if (setegid(conf.gid) < 0)
-			pr_debug_errno("setegid");
-		if (seteuid(conf.uid) < 0)
-			pr_debug_errno("seteuid");
+	if (fastd_peer_is_established(peer)) {
+		entry.established = true;
+		entry.established_time = ctx.now - peer->established;
+		entry.stats = peer->stats;
+		entry.rtt = peer->rtt;
+
+		const fastd_method_info_t *method_info = conf.protocol->get_current_method(peer);
+		if (method_info)
+			entry.method = method_info->name;
+
+		if (conf.mode == MODE_TAP) {
+			entry.eth_addrs_offset = VECTOR_LEN(snapshot->eth_addrs);
+			entry.n_eth_addrs = VECTOR_LEN(peer->eth_addrs);
+
+			size_t i;
+			for (i = 0; i < entry.n_eth_addrs; i++)
+				VECTOR_ADD(snapshot->eth_addrs, VECTOR_INDEX(peer->eth_addrs, i)->addr);
+		}
 	}
+
+	VECTOR_ADD(snapshot->peers, entry);
+}
+
+/**
+   Dumps fastd's status to a connected socket
+
+   Only a flat snapshot of the status is taken in the main thread; the MAC addresses are
+   taken from the per-peer index, and the JSON output is generated by a separate thread.
+*/
+static void dump_status(int fd, bool metrics) {
+	status_snapshot_t *snapshot = fastd_new0(status_snapshot_t);
+
+	snapshot->fd = fd;
+	snapshot->metrics = metrics;
+	snapshot->tap = (conf.mode == MODE_TAP);
+	snapshot->uptime = ctx.now - ctx.started;
+	snapshot->stats = ctx.stats;
+	snapshot->handshakes_sent = ctx.handshake_limit.sent;
+	memcpy(snapshot->handshakes_dropped, ctx.handshake_limit.dropped, sizeof(snapshot->handshakes_dropped));
+	snapshot->key_cache_size = conf.protocol->get_cache_size();
+	snapshot->handshake_packets[0] = ctx.handshakes_received;
+	snapshot->handshake_packets[1] = ctx.handshakes_sent;
+	snapshot->handshake_queue_dropped = ctx.worker_pool.dropped;
+	snapshot->log_dropped = fastd_log_async_dropped();
+
+	size_t i;
+
+#ifdef WITH_LATENCY_HISTOGRAMS
+	memcpy(snapshot->latency, ctx.latency->histograms, sizeof(snapshot->latency));
+
+	size_t n_methods = 0;
+	while (conf.methods[n_methods].name)
+		n_methods++;
+
+	snapshot->latency_methods = fastd_new_array(n_methods, fastd_latency_method_t);
+	memcpy(snapshot->latency_methods, ctx.latency->methods, n_methods * sizeof(fastd_latency_method_t));
 #endif
 
-	ctx.status_fd = socket(AF_UNIX, SOCK_STREAM, 0);
-	if (ctx.status_fd < 0)
+	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
+		fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
+
+		if (fastd_peer_is_enabled(peer))
+			snapshot_peer(snapshot, peer);
+	}
+
+	pthread_t thread;
+	if ((errno = pthread_create(&thread, &ctx.detached_thread, dump_thread, snapshot)) != 0) {
+		pr_error_errno("unable to create status dump thread");
+
+		close(snapshot->fd);
+		free_snapshot(snapshot);
+	}
+}
+
+/** Creates a listening unix socket */
+static int open_socket(const char *path, const char *name) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
 		exit_errno("fastd_status_init: socket");
 
 
-	size_t len = offsetof(struct sockaddr_un, sun_path) + strlen(conf.status_socket) + 1;
+	size_t len = offsetof(struct sockaddr_un, sun_path) + strlen(path) + 1;
 	uint8_t buf[len];
 	memset(buf, 0, len);
 
 	struct sockaddr_un *sa = (void*)buf;
 
 	sa->sun_family = AF_UNIX;
-	strcpy(sa->sun_path, conf.status_socket);
+	strcpy(sa->sun_path, path);
 
-	if (bind(ctx.status_fd, (struct sockaddr*)sa, len)) {
+	if (bind(fd, (struct sockaddr*)sa, len)) {
 		switch (errno) {
 		case EADDRINUSE:
-			exit_error("unable to create status socket: the path `%s' already exists", conf.status_socket);
+			exit_error("unable to create %s socket: the path `%s' already exists", name, path);
 
 		default:
-			exit_errno("unable to create status socket");
+			exit_error("unable to create %s socket: %s", name, strerror(errno));
 		}
 	}
 
-	if (listen(ctx.status_fd, 4))
+	if (listen(fd, 4))
 		exit_errno("fastd_status_init: listen");
 
+	return fd;
+}
+
+/** Initialized the status, metrics and control sockets */
+void fastd_status_init(void) {
+	ctx.status_fd = -1;
+	ctx.metrics_fd = -1;
+	ctx.control_fd = -1;
+
+	if (!conf.status_socket && !conf.metrics_socket && !conf.control_socket)
+		return;
+
+#ifdef USE_USER
+	uid_t uid = geteuid();
+	gid_t gid = getegid();
+
+	if (conf.user || conf.group) {
+		if (setegid(conf.gid) < 0)
+			pr_debug_errno("setegid");
+		if (seteuid(conf.uid) < 0)
+			pr_debug_errno("seteuid");
+	}
+#endif
+
+	if (conf.status_socket)
+		ctx.status_fd = open_socket(conf.status_socket, "status");
+
+	if (conf.metrics_socket)
+		ctx.metrics_fd = open_socket(conf.metrics_socket, "metrics");
+
+	if (conf.control_socket)
+		ctx.control_fd = open_socket(conf.control_socket, "control");
+
 
 #ifdef USE_USER
 	if (seteuid(uid) < 0)
@@ -251,28 +895,622 @@ void fastd_status_init(void) {
 #endif
 }
 
-/** Closes the status socket */
-void fastd_status_close(void) {
-	if (!conf.status_socket)
+/** Closes a socket created by open_socket() */
+static void close_socket(int fd, const char *path) {
+	if (!path)
 		return;
 
-	if (close(ctx.status_fd))
+	if (close(fd))
 		pr_warn_errno("fastd_status_cleanup: close");
 
-	if (unlink(conf.status_socket))
+	if (unlink(path))
 		pr_warn_errno("fastd_status_cleanup: unlink");
 }
 
+/** Closes the status, metrics and control sockets */
+void fastd_status_close(void) {
+	close_socket(ctx.status_fd, conf.status_socket);
+	close_socket(ctx.metrics_fd, conf.metrics_socket);
+	close_socket(ctx.control_fd, conf.control_socket);
+}
+
+/** Accepts a connection on the status or metrics socket */
+static void handle_connection(int listen_fd, bool metrics) {
+	int fd = accept(listen_fd, NULL, NULL);
+
+	if (fd < 0) {
+		pr_warn_errno("fastd_status_handle: accept");
+		return;
+	}
+
+	dump_status(fd, metrics);
+}
+
 /** Handles a single connection on the status socket */
 void fastd_status_handle(void) {
-	int fd = accept(ctx.status_fd, NULL, NULL);
+	handle_connection(ctx.status_fd, false);
+}
+
+/** Handles a single connection on the metrics socket */
+void fastd_status_handle_metrics(void) {
+	handle_connection(ctx.metrics_fd, true);
+}
+
+
+/**
+   Subtracts statistics
+
+   Counters that have decreased have been reset in the meantime (as the statistics of a peer are
+   reset when its connection is disestablished), so their current value is taken.
+*/
+static bool stats_delta(fastd_stats_t *delta, const fastd_stats_t *stats, const fastd_stats_t *prev) {
+	static const fastd_stats_t zero = {};
+	const uint64_t *cur = (const uint64_t *)stats, *old = (const uint64_t *)prev;
+	uint64_t *ret = (uint64_t *)delta;
+
+	size_t i;
+	for (i = 0; i < sizeof(fastd_stats_t)/sizeof(uint64_t); i++)
+		ret[i] = (cur[i] >= old[i]) ? cur[i] - old[i] : cur[i];
+
+	return memcmp(delta, &zero, sizeof(zero)) != 0;
+}
+
+/** Writes the beginning of an event object */
+static void write_event_begin(FILE *f, const char *event) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+
+	fputs("{ \"event\": ", f);
+	write_string(f, event);
+	fprintf(f, ", \"time\": %" PRId64, 1000*(int64_t)ts.tv_sec + ts.tv_nsec/1000000);
+}
+
+/** Writes the identity of a peer as a JSON object */
+static void write_event_identity(FILE *f, uint64_t id, const char *name, const char *key) {
+	fprintf(f, "{ \"id\": %" PRIu64 ", \"name\": ", id);
+	write_string(f, name);
+	fputs(", \"key\": ", f);
+	write_string(f, key);
+	fputs(" }", f);
+}
+
+/** Writes the identity of a peer as a JSON object */
+static void write_event_peer(FILE *f, const fastd_peer_t *peer) {
+	char key[65];
+	write_event_identity(f, peer->id, peer->name, conf.protocol->describe_peer(peer, key, sizeof(key)) ? key : NULL);
+}
+
+/** Queues an event line for a subscriber, taking ownership of the line */
+static void queue_event(fastd_subscriber_t *subscriber, char *line) {
+	pthread_mutex_lock(&subscriber->mutex);
+
+	if (VECTOR_LEN(subscriber->queue) < SUBSCRIBER_QUEUE_MAX) {
+		VECTOR_ADD(subscriber->queue, line);
+		line = NULL;
+	}
+	else {
+		subscriber->dropped++;
+	}
+
+	pthread_mutex_unlock(&subscriber->mutex);
+
+	free(line);
+}
+
+/** Reports a peer event to all subscribers (called in the main thread) */
+void fastd_status_emit_event(fastd_status_event_t event, const fastd_peer_t *peer) {
+	char *line;
+	size_t len;
+	FILE *f = open_memstream(&line, &len);
+	if (!f) {
+		pr_error_errno("fastd_status_emit_event: open_memstream");
+		return;
+	}
+
+	/* '[' + IPv6 addresss + '%' + interface + ']:' + port + NUL */
+	char addr_buf[1 + INET6_ADDRSTRLEN + 2 + IFNAMSIZ + 1 + 5 + 1];
+	fastd_snprint_peer_address(addr_buf, sizeof(addr_buf), &peer->address, NULL, false, false);
+
+	const fastd_method_info_t *method_info = NULL;
+	if (fastd_peer_is_established(peer))
+		method_info = conf.protocol->get_current_method(peer);
+
+	write_event_begin(f, event_names[event]);
+	fputs(", \"peer\": ", f);
+	write_event_peer(f, peer);
+	fputs(", \"address\": ", f);
+	write_string(f, addr_buf);
+	fputs(", \"method\": ", f);
+	write_string(f, method_info ? method_info->name : NULL);
+	fputs(" }\n", f);
+
+	fclose(f);
+
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(ctx.subscribers); i++)
+		queue_event(VECTOR_INDEX(ctx.subscribers, i), fastd_strdup(line));
+
+	free(line);
+}
+
+/**
+   Takes a sample of the statistics of all established peers (ctx.peers is ordered by ID)
+
+   Only the identities of the peers that weren't part of the previous sample are copied.
+*/
+static subscriber_sample_t * take_sample(fastd_subscriber_t *subscriber) {
+	subscriber_sample_t *sample = fastd_new0(subscriber_sample_t);
+	sample->time = ctx.now;
+	sample->stats = ctx.stats;
+
+	size_t i, j = 0;
+	for (i = 0; i < VECTOR_LEN(ctx.peers); i++) {
+		const fastd_peer_t *peer = VECTOR_INDEX(ctx.peers, i);
+		if (!fastd_peer_is_established(peer))
+			continue;
+
+		while (j < VECTOR_LEN(subscriber->sampled) && VECTOR_INDEX(subscriber->sampled, j) < peer->id)
+			j++;
+
+		subscriber_identity_t *identity = NULL;
+		if (j == VECTOR_LEN(subscriber->sampled) || VECTOR_INDEX(subscriber->sampled, j) != peer->id) {
+			identity = fastd_new(subscriber_identity_t);
+			identity->name = fastd_strdup(peer->name);
+			if (!conf.protocol->describe_peer(peer, identity->key, sizeof(identity->key)))
+				identity->key[0] = 0;
+		}
+
+		VECTOR_ADD(sample->peers, ((subscriber_peer_t){ .id = peer->id, .stats = peer->stats, .identity = identity }));
+	}
+
+	VECTOR_RESIZE(subscriber->sampled, VECTOR_LEN(sample->peers));
+	for (i = 0; i < VECTOR_LEN(sample->peers); i++)
+		VECTOR_INDEX(subscriber->sampled, i) = VECTOR_INDEX(sample->peers, i).id;
+
+	return sample;
+}
+
+/**
+   Passes a statistics sample to a subscriber's connection thread
+
+   When the previous sample hasn't been reported yet, no new sample is taken, so the next event
+   covers both intervals.
+*/
+static void sample_statistics(fastd_timer_t *timer) {
+	fastd_subscriber_t *subscriber = container_of(timer, fastd_subscriber_t, timer);
+	fastd_timer_schedule(&subscriber->timer, ctx.now + subscriber->interval);
+
+	pthread_mutex_lock(&subscriber->mutex);
+	bool pending = subscriber->sample;
+	pthread_mutex_unlock(&subscriber->mutex);
+
+	if (pending)
+		return;
+
+	subscriber_sample_t *sample = take_sample(subscriber);
+
+	pthread_mutex_lock(&subscriber->mutex);
+	subscriber->sample = sample;
+	pthread_mutex_unlock(&subscriber->mutex);
+}
+
+/**
+   Adds a requested subscriber or removes a closed one (called in the main thread)
+
+   Each state change is passed to the main thread exactly once, so the subscriber can't have been
+   freed yet. States that don't need to be handled are ignored.
+*/
+void fastd_status_handle_subscription(fastd_subscriber_t *subscriber) {
+	pthread_mutex_lock(&subscriber->mutex);
+
+	switch (subscriber->state) {
+	case SUBSCRIBER_REQUESTED:
+		if (VECTOR_LEN(ctx.subscribers) >= SUBSCRIBERS_MAX) {
+			subscriber->state = SUBSCRIBER_REFUSED;
+			break;
+		}
+
+		VECTOR_ADD(ctx.subscribers, subscriber);
+		subscriber->state = SUBSCRIBER_ACTIVE;
+
+		fastd_timer_init(&subscriber->timer, sample_statistics);
+		if (subscriber->interval) {
+			subscriber->sample = take_sample(subscriber);
+			fastd_timer_schedule(&subscriber->timer, ctx.now + subscriber->interval);
+		}
+		break;
+
+	case SUBSCRIBER_CLOSING: {
+		size_t i;
+		for (i = 0; i < VECTOR_LEN(ctx.subscribers); i++) {
+			if (VECTOR_INDEX(ctx.subscribers, i) == subscriber) {
+				VECTOR_DELETE(ctx.subscribers, i);
+				break;
+			}
+		}
+
+		fastd_timer_cancel(&subscriber->timer);
+		subscriber->state = SUBSCRIBER_CLOSED;
+		break;
+	}
+
+	default:
+		break;
+	}
+
+	pthread_cond_broadcast(&subscriber->cond);
+	pthread_mutex_unlock(&subscriber->mutex);
+}
+
+/** Passes a subscriber to the main thread, retrying until the notification could be queued */
+static void notify_subscriber(fastd_subscriber_t *subscriber) {
+	while (!fastd_async_enqueue(ASYNC_TYPE_SUBSCRIPTION, &subscriber, sizeof(subscriber)))
+		sleep(1);
+}
+
+/** Waits until the main thread has handled the given state of a subscription */
+static subscriber_state_t wait_subscriber_state(fastd_subscriber_t *subscriber, subscriber_state_t state) {
+	pthread_mutex_lock(&subscriber->mutex);
+
+	while (subscriber->state == state)
+		pthread_cond_wait(&subscriber->cond, &subscriber->mutex);
+
+	state = subscriber->state;
+	pthread_mutex_unlock(&subscriber->mutex);
+
+	return state;
+}
+
+/** Writes a buffer to a client, returns false on errors */
+static bool write_all(int fd, const char *buf, size_t len) {
+	while (len) {
+		ssize_t ret = write(fd, buf, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+
+			pr_debug_errno("event subscription: write");
+			return false;
+		}
+
+		buf += ret;
+		len -= ret;
+	}
+
+	return true;
+}
+
+/** Frees a statistics sample */
+static void free_sample(subscriber_sample_t *sample) {
+	if (!sample)
+		return;
+
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(sample->peers); i++) {
+		subscriber_identity_t *identity = VECTOR_INDEX(sample->peers, i).identity;
+		if (!identity)
+			continue;
+
+		free(identity->name);
+		free(identity);
+	}
+
+	VECTOR_FREE(sample->peers);
+	free(sample);
+}
+
+/**
+   Formats a statistics event comparing two samples
+
+   Only the peers whose statistics have changed are included; returns false when nothing has
+   changed at all.
+*/
+static bool format_statistics(FILE *f, const subscriber_sample_t *last, const subscriber_sample_t *sample) {
+	fastd_stats_t delta;
+	bool changed = stats_delta(&delta, &sample->stats, &last->stats);
+
+	write_event_begin(f, "statistics");
+	fprintf(f, ", \"interval\": %" PRId64 ", \"statistics\": ", sample->time - last->time);
+	write_stats(f, &delta);
+	fputs(", \"peers\": [", f);
+
+	size_t i, j = 0, n = 0;
+	for (i = 0; i < VECTOR_LEN(sample->peers); i++) {
+		const subscriber_peer_t *peer = &VECTOR_INDEX(sample->peers, i);
+
+		static const fastd_stats_t zero = {};
+		const fastd_stats_t *prev = &zero;
+
+		while (j < VECTOR_LEN(last->peers) && VECTOR_INDEX(last->peers, j).id < peer->id)
+			j++;
+		if (j < VECTOR_LEN(last->peers) && VECTOR_INDEX(last->peers, j).id == peer->id)
+			prev = &VECTOR_INDEX(last->peers, j).stats;
+
+		if (!stats_delta(&delta, &peer->stats, prev))
+			continue;
+
+		fputs(n++ ? ", " : " ", f);
+		fputs("{ \"peer\": ", f);
+		write_event_identity(f, peer->id, peer->identity->name, peer->identity->key[0] ? peer->identity->key : NULL);
+		fputs(", \"statistics\": ", f);
+		write_stats(f, &delta);
+		fputs(" }", f);
+	}
+
+	fputs(n ? " ] }\n" : "] }\n", f);
+
+	return changed || n;
+}
+
+/**
+   Writes a statistics event for a new sample to a subscriber, returns false on errors
+
+   The event is formatted in the subscriber's buffer, which is grown until the event fits and
+   reused for the following events.
+*/
+static bool write_statistics(fastd_subscriber_t *subscriber, subscriber_sample_t *sample) {
+	subscriber_sample_t *last = subscriber->last;
+	subscriber->last = sample;
+
+	if (!last)
+		return true;
+
+	/* Take over the identities of the peers that were already part of the last sample */
+	size_t i, j = 0;
+	for (i = 0; i < VECTOR_LEN(sample->peers); i++) {
+		subscriber_peer_t *peer = &VECTOR_INDEX(sample->peers, i);
+		if (peer->identity)
+			continue;
+
+		while (j < VECTOR_LEN(last->peers) && VECTOR_INDEX(last->peers, j).id < peer->id)
+			j++;
+		if (j == VECTOR_LEN(last->peers) || VECTOR_INDEX(last->peers, j).id != peer->id)
+			exit_bug("write_statistics: unknown peer");
+
+		peer->identity = VECTOR_INDEX(last->peers, j).identity;
+		VECTOR_INDEX(last->peers, j).identity = NULL;
+	}
+
+	bool ok = true;
+
+	while (true) {
+		if (!subscriber->buf_size) {
+			subscriber->buf_size = 4096;
+			subscriber->buf = fastd_alloc(subscriber->buf_size);
+		}
+
+		FILE *f = fmemopen(subscriber->buf, subscriber->buf_size, "w");
+		if (!f) {
+			pr_error_errno("write_statistics: fmemopen");
+			break;
+		}
+
+		bool changed = format_statistics(f, last, sample);
+		bool full = fflush(f) || ferror(f);
+		size_t len = ftell(f);
+		fclose(f);
+
+		if (full) {
+			subscriber->buf_size *= 2;
+			subscriber->buf = fastd_realloc(subscriber->buf, subscriber->buf_size);
+			continue;
+		}
+
+		if (changed)
+			ok = write_all(subscriber->fd, subscriber->buf, len);
+
+		break;
+	}
+
+	free_sample(last);
+
+	return ok;
+}
+
+/** Writes the queued events to a subscriber, returns false on errors */
+static bool write_events(fastd_subscriber_t *subscriber) {
+	pthread_mutex_lock(&subscriber->mutex);
+
+	__typeof__(subscriber->queue) queue = subscriber->queue;
+	subscriber->queue = (__typeof__(subscriber->queue)){};
+
+	uint64_t dropped = subscriber->dropped;
+	subscriber->dropped = 0;
+
+	subscriber_sample_t *sample = subscriber->sample;
+	subscriber->sample = NULL;
+
+	pthread_mutex_unlock(&subscriber->mutex);
+
+	bool ok = true;
+
+	if (dropped) {
+		char buf[64];
+		snprintf(buf, sizeof(buf), "{ \"event\": \"dropped\", \"count\": %" PRIu64 " }\n", dropped);
+		ok = write_all(subscriber->fd, buf, strlen(buf));
+	}
+
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(queue); i++) {
+		char *line = VECTOR_INDEX(queue, i);
+
+		if (ok)
+			ok = write_all(subscriber->fd, line, strlen(line));
+
+		free(line);
+	}
+
+	VECTOR_FREE(queue);
+
+	if (sample) {
+		if (ok)
+			ok = write_statistics(subscriber, sample);
+		else
+			free_sample(sample);
+	}
+
+	return ok;
+}
+
+/** Frees a subscriber */
+static void free_subscriber(fastd_subscriber_t *subscriber) {
+	size_t i;
+	for (i = 0; i < VECTOR_LEN(subscriber->queue); i++)
+		free(VECTOR_INDEX(subscriber->queue, i));
+
+	VECTOR_FREE(subscriber->queue);
+	VECTOR_FREE(subscriber->sampled);
+
+	free_sample(subscriber->sample);
+	free_sample(subscriber->last);
+	free(subscriber->buf);
+
+	pthread_cond_destroy(&subscriber->cond);
+	pthread_mutex_destroy(&subscriber->mutex);
+
+	free(subscriber);
+}
+
+/**
+   Handles the subscribe command of a control socket connection (called in the connection's thread)
+
+   Returns when the client has closed the connection.
+*/
+static void run_subscription(int fd, char *args) {
+	int interval = 0;
+	char *saveptr, *token = strtok_r(args, " \t\r\n", &saveptr);
+
+	if (token) {
+		char *arg = strtok_r(NULL, " \t\r\n", &saveptr), *endptr = NULL;
+		unsigned long value = arg ? strtoul(arg, &endptr, 10) : 0;
+
+		if (strcmp(token, "interval") || !arg || !*arg || *endptr || value < 1 || value > 3600 || strtok_r(NULL, " \t\r\n", &saveptr)) {
+			dprintf(fd, "error: invalid argument\n");
+			return;
+		}
+
+		interval = 1000*value;
+	}
+
+	fastd_subscriber_t *subscriber = fastd_new0(fastd_subscriber_t);
+	pthread_mutex_init(&subscriber->mutex, NULL);
+	pthread_cond_init(&subscriber->cond, NULL);
+	subscriber->fd = fd;
+	subscriber->interval = interval;
+	subscriber->state = SUBSCRIBER_REQUESTED;
+
+	if (!fastd_async_enqueue(ASYNC_TYPE_SUBSCRIPTION, &subscriber, sizeof(subscriber))) {
+		dprintf(fd, "error: unable to subscribe\n");
+		free_subscriber(subscriber);
+		return;
+	}
+
+	if (wait_subscriber_state(subscriber, SUBSCRIBER_REQUESTED) == SUBSCRIBER_REFUSED) {
+		dprintf(fd, "error: too many subscribers\n");
+		free_subscriber(subscriber);
+		return;
+	}
+
+	while (!fastd_status_client_closed(fd, SUBSCRIBER_POLL_INTERVAL) && write_events(subscriber)) {}
+
+	pthread_mutex_lock(&subscriber->mutex);
+	subscriber->state = SUBSCRIBER_CLOSING;
+	pthread_mutex_unlock(&subscriber->mutex);
+
+	notify_subscriber(subscriber);
+	wait_subscriber_state(subscriber, SUBSCRIBER_CLOSING);
+
+	free_subscriber(subscriber);
+}
+
+/**
+   Reads the command line of a control socket connection
+
+   Returns false if the client doesn't send a complete line within CONTROL_TIMEOUT milliseconds.
+*/
+static bool read_command(int fd, char *buf, size_t len) {
+	size_t pos = 0;
+
+	while (pos < len-1) {
+		struct pollfd pollfd = {
+			.fd = fd,
+			.events = POLLIN,
+		};
+
+		if (poll(&pollfd, 1, CONTROL_TIMEOUT) <= 0)
+			return false;
+
+		ssize_t ret = read(fd, buf+pos, 1);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+
+		if (buf[pos] == '\n')
+			break;
+
+		pos++;
+	}
+
+	buf[pos] = 0;
+	return true;
+}
+
+/** Checks if the client of a control socket connection has closed it, waiting for at most \a timeout milliseconds */
+bool fastd_status_client_closed(int fd, int timeout) {
+	struct pollfd pollfd = {
+		.fd = fd,
+		.events = POLLIN,
+	};
+
+	if (poll(&pollfd, 1, timeout) <= 0)
+		return false;
+
+	if (pollfd.revents & (POLLERR|POLLHUP|POLLNVAL))
+		return true;
+
+	char buf[64];
+	ssize_t ret = read(fd, buf, sizeof(buf));
+	return (ret == 0 || (ret < 0 && errno != EINTR && errno != EAGAIN));
+}
+
+/** Thread handling a connection on the control socket */
+static void * control_thread(void *p) {
+	int fd = (intptr_t)p;
+	char line[CONTROL_MAX_LINE];
+
+	if (read_command(fd, line, sizeof(line))) {
+		char *args = line + strcspn(line, " \t\r");
+		if (*args)
+			*args++ = 0;
+
+		if (!strcmp(line, "capture"))
+			fastd_capture_run(fd, args);
+		else if (!strcmp(line, "subscribe"))
+			run_subscription(fd, args);
+		else
+			dprintf(fd, "error: unknown command\n");
+	}
+
+	close(fd);
+
+	return NULL;
+}
+
+/** Handles a single connection on the control socket */
+void fastd_status_handle_control(void) {
+	int fd = accept(ctx.control_fd, NULL, NULL);
 
 	if (fd < 0) {
-		pr_warn_errno("fastd_status_handle: accept");
+		pr_warn_errno("fastd_status_handle_control: accept");
 		return;
 	}
 
-	dump_status(fd);
+	pthread_t thread;
+	if ((errno = pthread_create(&thread, &ctx.detached_thread, control_thread, (void *)(intptr_t)fd)) != 0) {
+		pr_error_errno("unable to create control thread");
+		close(fd);
+	}
 }
 
 #endif
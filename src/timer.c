@@ -0,0 +1,223 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Hierarchical timer wheel
+
+   Each level of the wheel has FASTD_TIMER_WHEEL_SIZE slots. A timer is stored on
+   the lowest level on which its timeout shares all higher-order bits with the
+   wheel's current time, in the slot selected by the bits of this level. When the
+   wheel's time reaches the start of a slot on a higher level, the slot's timers
+   are cascaded to the lower levels; the timers in the current slot of the lowest
+   level are due.
+
+   Scheduling and cancelling a timer are O(1); finding the next deadline is
+   O(FASTD_TIMER_WHEEL_LEVELS) using the slot bitmaps.
+*/
+
+
+#include "timer.h"
+#include "fastd.h"
+
+#include <limits.h>
+
+
+/** A bitmask selecting the slot bits of a level */
+#define SLOT_MASK (FASTD_TIMER_WHEEL_SIZE - 1)
+
+
+/** Returns the number of bits to shift a timeout by to get the slot index on a given level */
+static inline unsigned level_shift(size_t level) {
+	return level * FASTD_TIMER_WHEEL_BITS;
+}
+
+/** Returns the slot index of a timeout on a given level */
+static inline size_t timeout_slot(fastd_timeout_t timeout, size_t level) {
+	return (timeout >> level_shift(level)) & SLOT_MASK;
+}
+
+/** Returns the level a timer due at \e timeout is stored on (FASTD_TIMER_WHEEL_LEVELS for the overflow list) */
+static inline size_t timeout_level(fastd_timeout_t timeout) {
+	size_t level;
+	for (level = 0; level < FASTD_TIMER_WHEEL_LEVELS; level++) {
+		unsigned shift = level_shift(level+1);
+
+		if ((timeout >> shift) == (ctx.timer_wheel.time >> shift))
+			break;
+	}
+
+	return level;
+}
+
+/** Inserts a timer into the wheel */
+static void timer_insert(fastd_timer_t *timer) {
+	fastd_timer_wheel_t *wheel = &ctx.timer_wheel;
+
+	fastd_timeout_t timeout = timer->timeout;
+	if (timeout < wheel->time)
+		timeout = wheel->time;
+
+	size_t level = timeout_level(timeout);
+	if (level == FASTD_TIMER_WHEEL_LEVELS) {
+		fastd_dlist_insert(&wheel->overflow, &timer->entry);
+		return;
+	}
+
+	size_t slot = timeout_slot(timeout, level);
+	fastd_dlist_insert(&wheel->slots[level][slot], &timer->entry);
+	wheel->occupied[level] |= UINT64_C(1) << slot;
+}
+
+/** Re-inserts all timers of a list after the wheel's time has been advanced */
+static void cascade(fastd_dlist_head_t *list) {
+	fastd_dlist_head_t timers = *list;
+	list->next = NULL;
+
+	if (timers.next)
+		timers.next->prev = &timers;
+
+	while (timers.next) {
+		fastd_timer_t *timer = container_of(timers.next, fastd_timer_t, entry);
+		fastd_dlist_remove(&timer->entry);
+		timer_insert(timer);
+	}
+}
+
+/**
+   Returns the next tick at which the wheel has work to do, or -1 if there are no timers
+
+   This is either the timeout of the next due timer, or the start of the next slot on
+   a higher level that needs to be cascaded (which is never later than the timeouts of
+   the timers in the slot).
+*/
+static fastd_timeout_t next_event(void) {
+	fastd_timer_wheel_t *wheel = &ctx.timer_wheel;
+
+	/* Slots on lower levels always come before occupied slots on higher levels */
+	size_t level;
+	for (level = 0; level < FASTD_TIMER_WHEEL_LEVELS; level++) {
+		size_t slot = timeout_slot(wheel->time, level);
+		uint64_t mask = wheel->occupied[level] & (~UINT64_C(0) << slot);
+
+		while (mask) {
+			size_t i = __builtin_ctzll(mask);
+
+			if (wheel->slots[level][i].next) {
+				unsigned shift = level_shift(level+1);
+				return ((wheel->time >> shift) << shift) | ((fastd_timeout_t)i << level_shift(level));
+			}
+
+			mask &= ~(UINT64_C(1) << i);
+			wheel->occupied[level] &= ~(UINT64_C(1) << i);
+		}
+	}
+
+	if (wheel->overflow.next) {
+		unsigned shift = level_shift(FASTD_TIMER_WHEEL_LEVELS);
+		return ((wheel->time >> shift) + 1) << shift;
+	}
+
+	return -1;
+}
+
+
+/** Initializes the timer wheel; must be called after the time has been initialized */
+void fastd_timer_wheel_init(void) {
+	ctx.timer_wheel.time = ctx.now;
+}
+
+/**
+   Schedules a timer to be due at the given time (an already scheduled timer is rescheduled)
+
+   Timers that are scheduled from a timer callback for a time that is already due are
+   deferred to the next tick, so a callback rescheduling its timer into the past can't
+   keep fastd_timer_handle() busy indefinitely.
+*/
+void fastd_timer_schedule(fastd_timer_t *timer, fastd_timeout_t timeout) {
+	fastd_timer_cancel(timer);
+
+	if (ctx.timer_wheel.handling && timeout <= ctx.now)
+		timeout = ctx.now+1;
+
+	timer->timeout = timeout;
+	timer_insert(timer);
+}
+
+/** Returns the number of milliseconds until the next timer is due or -1 if there are no timers */
+int fastd_timer_timeout(void) {
+	fastd_timeout_t next = next_event();
+	if (next < 0)
+		return -1;
+
+	fastd_timeout_t diff_msec = next - ctx.now;
+	if (diff_msec < 0)
+		return 0;
+	else if (diff_msec > INT_MAX)
+		return INT_MAX;
+	else
+		return diff_msec;
+}
+
+/** Runs the callbacks of all timers that are due */
+void fastd_timer_handle(void) {
+	fastd_timer_wheel_t *wheel = &ctx.timer_wheel;
+
+	while (true) {
+		fastd_timeout_t next = next_event();
+		if (next < 0 || next > ctx.now)
+			break;
+
+		wheel->time = next;
+
+		if (!(next & ((UINT64_C(1) << level_shift(FASTD_TIMER_WHEEL_LEVELS)) - 1)))
+			cascade(&wheel->overflow);
+
+		size_t level;
+		for (level = FASTD_TIMER_WHEEL_LEVELS-1; level > 0; level--) {
+			if (next & ((UINT64_C(1) << level_shift(level)) - 1))
+				continue;
+
+			size_t slot = timeout_slot(next, level);
+			wheel->occupied[level] &= ~(UINT64_C(1) << slot);
+			cascade(&wheel->slots[level][slot]);
+		}
+
+		fastd_dlist_head_t *list = &wheel->slots[0][timeout_slot(next, 0)];
+		wheel->handling = true;
+		while (list->next) {
+			fastd_timer_t *timer = container_of(list->next, fastd_timer_t, entry);
+			fastd_dlist_remove(&timer->entry);
+			timer->cb(timer);
+		}
+		wheel->handling = false;
+
+		wheel->time = next+1;
+	}
+
+	if (wheel->time <= ctx.now)
+		wheel->time = ctx.now+1;
+}
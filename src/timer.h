@@ -0,0 +1,100 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Hierarchical timer wheel
+
+   All time-driven work of fastd (handshakes, keepalives, peer and MAC address timeouts, ...)
+   is scheduled using fastd_timer_t objects, which can be scheduled and cancelled in constant time.
+*/
+
+
+#pragma once
+
+#include "dlist.h"
+#include "types.h"
+
+#include <stdint.h>
+
+
+/** The number of bits of a timeout that select the slot on each level of the timer wheel */
+#define FASTD_TIMER_WHEEL_BITS 6
+
+/** The number of slots on each level of the timer wheel */
+#define FASTD_TIMER_WHEEL_SIZE (1 << FASTD_TIMER_WHEEL_BITS)
+
+/**
+   The number of levels of the timer wheel
+
+   With a resolution of 1ms, the wheel covers 2^24ms (about 4.6 hours) ahead of the current time;
+   later timers are kept in an overflow list.
+*/
+#define FASTD_TIMER_WHEEL_LEVELS 4
+
+
+/** A timer callback */
+typedef void (*fastd_timer_cb_t)(fastd_timer_t *timer);
+
+/** A timer */
+struct fastd_timer {
+	fastd_dlist_head_t entry;		/**< The timer's entry in its wheel slot */
+	fastd_timeout_t timeout;		/**< The time the timer is due */
+	fastd_timer_cb_t cb;			/**< The function to call when the timer is due */
+};
+
+/** A hierarchical timer wheel */
+struct fastd_timer_wheel {
+	fastd_timeout_t time;			/**< The next millisecond tick that hasn't been processed yet */
+	bool handling;				/**< Specifies if timer callbacks are currently being run */
+
+	uint64_t occupied[FASTD_TIMER_WHEEL_LEVELS]; /**< Bitmaps of the slots that may contain timers (bits are cleared lazily) */
+	fastd_dlist_head_t slots[FASTD_TIMER_WHEEL_LEVELS][FASTD_TIMER_WHEEL_SIZE]; /**< The timer lists of each level */
+	fastd_dlist_head_t overflow;		/**< Timers that are due after the range covered by the wheel */
+};
+
+
+void fastd_timer_wheel_init(void);
+void fastd_timer_schedule(fastd_timer_t *timer, fastd_timeout_t timeout);
+int fastd_timer_timeout(void);
+void fastd_timer_handle(void);
+
+
+/** Initializes a timer with the given callback */
+static inline void fastd_timer_init(fastd_timer_t *timer, fastd_timer_cb_t cb) {
+	timer->entry.prev = timer->entry.next = NULL;
+	timer->cb = cb;
+}
+
+/** Checks if a timer is currently scheduled */
+static inline bool fastd_timer_scheduled(fastd_timer_t *timer) {
+	return fastd_dlist_linked(&timer->entry);
+}
+
+/** Cancels a timer (if it is scheduled) */
+static inline void fastd_timer_cancel(fastd_timer_t *timer) {
+	fastd_dlist_remove(&timer->entry);
+}
@@ -0,0 +1,145 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   USDT tracepoints
+
+   When fastd is built with WITH_USDT, statically defined tracepoints (provider \e fastd) are placed at the
+   main events of the data path and the handshake, which can be attached to with tools like bpftrace or
+   SystemTap. The first argument of all peer-related probes is the peer's ID (or -1 if the peer is unknown).
+   An unused tracepoint is a single nop instruction. Without WITH_USDT, all functions of this header are empty.
+*/
+
+
+#pragma once
+
+#include "peer.h"
+
+#ifdef WITH_USDT
+#include <sys/sdt.h>
+#endif
+
+
+#ifdef WITH_USDT
+
+/** Returns the ID of a peer as passed to the tracepoints */
+static inline int64_t fastd_trace_peer_id(const fastd_peer_t *peer) {
+	return peer ? (int64_t)peer->id : -1;
+}
+
+
+/** Tracepoint \e packet_received(peer, len, type): A packet has been received on a socket */
+static inline void fastd_trace_packet_received(const fastd_peer_t *peer, size_t len, uint8_t type) {
+	DTRACE_PROBE3(fastd, packet_received, fastd_trace_peer_id(peer), len, type);
+}
+
+/** Tracepoint \e packet_decrypted(peer, len, reordered): A payload packet has been decrypted and authenticated */
+static inline void fastd_trace_packet_decrypted(const fastd_peer_t *peer, size_t len, bool reordered) {
+	DTRACE_PROBE3(fastd, packet_decrypted, fastd_trace_peer_id(peer), len, reordered);
+}
+
+/** Tracepoint \e packet_encrypted(peer, len): A payload packet has been encrypted (\a len is the encrypted length) */
+static inline void fastd_trace_packet_encrypted(const fastd_peer_t *peer, size_t len) {
+	DTRACE_PROBE2(fastd, packet_encrypted, fastd_trace_peer_id(peer), len);
+}
+
+/** Tracepoint \e packet_sent(peer, len, type, error): A packet has been passed to sendmsg() (\a error is 0 or an errno value) */
+static inline void fastd_trace_packet_sent(const fastd_peer_t *peer, size_t len, uint8_t type, int error) {
+	DTRACE_PROBE4(fastd, packet_sent, fastd_trace_peer_id(peer), len, type, error);
+}
+
+/** Tracepoint \e tuntap_read(len): A packet has been read from the TUN/TAP device */
+static inline void fastd_trace_tuntap_read(size_t len) {
+	DTRACE_PROBE1(fastd, tuntap_read, len);
+}
+
+/** Tracepoint \e tuntap_write(len): A packet has been written to the TUN/TAP device */
+static inline void fastd_trace_tuntap_write(size_t len) {
+	DTRACE_PROBE1(fastd, tuntap_write, len);
+}
+
+/** Tracepoint \e handshake_sent(peer, len): A handshake packet is sent */
+static inline void fastd_trace_handshake_sent(const fastd_peer_t *peer, size_t len) {
+	DTRACE_PROBE2(fastd, handshake_sent, fastd_trace_peer_id(peer), len);
+}
+
+/** Tracepoint \e handshake_received(peer, len, type): A handshake packet of a given handshake type has been received */
+static inline void fastd_trace_handshake_received(const fastd_peer_t *peer, size_t len, uint8_t type) {
+	DTRACE_PROBE3(fastd, handshake_received, fastd_trace_peer_id(peer), len, type);
+}
+
+/** Tracepoint \e peer_established(peer): A connection with a peer has been established */
+static inline void fastd_trace_peer_established(const fastd_peer_t *peer) {
+	DTRACE_PROBE1(fastd, peer_established, fastd_trace_peer_id(peer));
+}
+
+/** Tracepoint \e session_refresh(peer): A session refresh has been initiated */
+static inline void fastd_trace_session_refresh(const fastd_peer_t *peer) {
+	DTRACE_PROBE1(fastd, session_refresh, fastd_trace_peer_id(peer));
+}
+
+/** Tracepoint \e peer_reset(peer): A peer has been reset */
+static inline void fastd_trace_peer_reset(const fastd_peer_t *peer) {
+	DTRACE_PROBE1(fastd, peer_reset, fastd_trace_peer_id(peer));
+}
+
+#else
+
+static inline void fastd_trace_packet_received(UNUSED const fastd_peer_t *peer, UNUSED size_t len, UNUSED uint8_t type) {
+}
+
+static inline void fastd_trace_packet_decrypted(UNUSED const fastd_peer_t *peer, UNUSED size_t len, UNUSED bool reordered) {
+}
+
+static inline void fastd_trace_packet_encrypted(UNUSED const fastd_peer_t *peer, UNUSED size_t len) {
+}
+
+static inline void fastd_trace_packet_sent(UNUSED const fastd_peer_t *peer, UNUSED size_t len, UNUSED uint8_t type, UNUSED int error) {
+}
+
+static inline void fastd_trace_tuntap_read(UNUSED size_t len) {
+}
+
+static inline void fastd_trace_tuntap_write(UNUSED size_t len) {
+}
+
+static inline void fastd_trace_handshake_sent(UNUSED const fastd_peer_t *peer, UNUSED size_t len) {
+}
+
+static inline void fastd_trace_handshake_received(UNUSED const fastd_peer_t *peer, UNUSED size_t len, UNUSED uint8_t type) {
+}
+
+static inline void fastd_trace_peer_established(UNUSED const fastd_peer_t *peer) {
+}
+
+static inline void fastd_trace_session_refresh(UNUSED const fastd_peer_t *peer) {
+}
+
+static inline void fastd_trace_peer_reset(UNUSED const fastd_peer_t *peer) {
+}
+
+#endif
@@ -34,7 +34,9 @@
 */
 
 #include "fastd.h"
+#include "latency.h"
 #include "poll.h"
+#include "trace.h"
 
 #include <net/if.h>
 #include <sys/ioctl.h>
@@ -405,11 +407,14 @@ void fastd_tuntap_handle(void) {
 		exit_errno("read");
 
 	buffer.len = len;
+	fastd_latency_tx_start();
+	fastd_trace_tuntap_read(len);
 
 	if (multiaf_tun && conf.mode == MODE_TUN)
 		fastd_buffer_push_head(&buffer, 4);
 
 	fastd_send_data(buffer, NULL);
+	fastd_latency_tx_end();
 }
 
 /** Writes a packet to the TUN/TAP device */
@@ -428,7 +433,7 @@ void fastd_tuntap_write(fastd_buffer_t buffer) {
 			break;
 
 		default:
-			pr_warn("fastd_tuntap_write: unknown IP version %u", version);
+			pr_warn_ratelimited("fastd_tuntap_write: unknown IP version %u", version);
 			return;
 		}
 
@@ -437,7 +442,9 @@ void fastd_tuntap_write(fastd_buffer_t buffer) {
 	}
 
 	if (write(ctx.tunfd, buffer.data, buffer.len) < 0)
-		pr_debug2_errno("write");
+		pr_debug2_errno_ratelimited("write");
+	else
+		fastd_trace_tuntap_write(buffer.len);
 }
 
 /** Closes the TUN/TAP device */
@@ -91,7 +91,15 @@ typedef struct fastd_peer fastd_peer_t;
 typedef struct fastd_peer_eth_addr fastd_peer_eth_addr_t;
 typedef struct fastd_remote fastd_remote_t;
 typedef struct fastd_stats fastd_stats_t;
-typedef struct fastd_handshake_timeout fastd_handshake_timeout_t;
+typedef struct fastd_handshake_limit fastd_handshake_limit_t;
+typedef struct fastd_latency fastd_latency_t;
+typedef struct fastd_log_ring fastd_log_ring_t;
+typedef struct fastd_capture fastd_capture_t;
+typedef struct fastd_subscriber fastd_subscriber_t;
+typedef struct fastd_timer fastd_timer_t;
+typedef struct fastd_timer_wheel fastd_timer_wheel_t;
+typedef struct fastd_worker_job fastd_worker_job_t;
+typedef struct fastd_worker_pool fastd_worker_pool_t;
 
 typedef struct fastd_config fastd_config_t;
 typedef struct fastd_context fastd_context_t;
@@ -58,6 +58,9 @@
 			(type *)((char *)_mptr - offsetof(type, member)); \
 		})
 
+/** The assumed size of a CPU cache line */
+#define CACHELINE_SIZE 64
+
 /**
    Returns the number of elements of an array
 
@@ -0,0 +1,252 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Worker thread pool
+*/
+
+
+#include "worker.h"
+#include "async.h"
+#include "fastd.h"
+
+
+/** Appends a job to a job list */
+static inline void append_job(fastd_worker_job_t ***tail, fastd_worker_job_t *job) {
+	job->next = NULL;
+	**tail = job;
+	*tail = &job->next;
+}
+
+/**
+   Moves a finished job to the list of finished jobs (called with the pool mutex held)
+
+   \return true if the caller must notify the main thread using notify_finished() after releasing the mutex
+*/
+static bool finish_job(fastd_worker_pool_t *pool, fastd_worker_job_t *job) {
+	append_job(&pool->finished_tail, job);
+
+	if (pool->notified)
+		return false;
+
+	pool->notified = true;
+	return true;
+}
+
+/**
+   Notifies the main thread about finished jobs, retrying until the notification could be queued
+
+   The notification is dropped when the pool is stopped, as the main thread may not handle
+   notifications anymore then; fastd_worker_cleanup() completes the finished jobs itself.
+*/
+static void notify_finished(fastd_worker_pool_t *pool) {
+	while (!fastd_async_enqueue(ASYNC_TYPE_WORKER_RETURN, NULL, 0)) {
+		pthread_mutex_lock(&pool->mutex);
+		bool stop = pool->stop;
+		pthread_mutex_unlock(&pool->mutex);
+
+		if (stop)
+			return;
+
+		sleep(1);
+	}
+}
+
+/** The main function of the worker threads */
+static void * worker_thread(UNUSED void *p) {
+	fastd_worker_pool_t *pool = &ctx.worker_pool;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	while (true) {
+		while (!pool->stop && !pool->queue_head)
+			pthread_cond_wait(&pool->cond, &pool->mutex);
+
+		if (pool->stop)
+			break;
+
+		fastd_worker_job_t *job = pool->queue_head;
+		pool->queue_head = job->next;
+		if (!pool->queue_head)
+			pool->queue_tail = &pool->queue_head;
+		pool->queue_len--;
+
+		pthread_mutex_unlock(&pool->mutex);
+
+		job->run(job);
+
+		pthread_mutex_lock(&pool->mutex);
+
+		if (finish_job(pool, job)) {
+			pthread_mutex_unlock(&pool->mutex);
+			notify_finished(pool);
+			pthread_mutex_lock(&pool->mutex);
+		}
+	}
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	return NULL;
+}
+
+/** Starts the worker threads */
+void fastd_worker_init(void) {
+	fastd_worker_pool_t *pool = &ctx.worker_pool;
+
+	pool->queue_head = NULL;
+	pool->queue_tail = &pool->queue_head;
+	pool->queue_len = 0;
+
+	pool->finished_head = NULL;
+	pool->finished_tail = &pool->finished_head;
+	pool->notified = false;
+
+	pool->stop = false;
+
+	pool->n_threads = 0;
+	pool->threads = NULL;
+
+	if (!conf.handshake_workers)
+		return;
+
+	if ((errno = pthread_mutex_init(&pool->mutex, NULL)) != 0)
+		exit_errno("pthread_mutex_init");
+	if ((errno = pthread_cond_init(&pool->cond, NULL)) != 0)
+		exit_errno("pthread_cond_init");
+
+	pool->threads = fastd_new_array(conf.handshake_workers, pthread_t);
+
+	size_t i;
+	for (i = 0; i < conf.handshake_workers; i++) {
+		if ((errno = pthread_create(&pool->threads[i], NULL, worker_thread, NULL)) != 0) {
+			pr_error_errno("unable to create worker thread");
+			break;
+		}
+
+		pool->n_threads++;
+	}
+
+	if (pool->n_threads)
+		pr_debug("started %u worker thread(s)", (unsigned)pool->n_threads);
+}
+
+/** Calls the completion callbacks of all finished jobs */
+void fastd_worker_handle_finished(void) {
+	fastd_worker_pool_t *pool = &ctx.worker_pool;
+
+	if (!pool->n_threads)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+
+	fastd_worker_job_t *job = pool->finished_head;
+	pool->finished_head = NULL;
+	pool->finished_tail = &pool->finished_head;
+	pool->notified = false;
+
+	pthread_mutex_unlock(&pool->mutex);
+
+	while (job) {
+		fastd_worker_job_t *next = job->next;
+		job->complete(job);
+		job = next;
+	}
+}
+
+/**
+   Stops the worker threads
+
+   Finished jobs are completed; jobs that are still queued are discarded by calling
+   their completion callback without running them.
+*/
+void fastd_worker_cleanup(void) {
+	fastd_worker_pool_t *pool = &ctx.worker_pool;
+
+	if (!pool->n_threads)
+		return;
+
+	pthread_mutex_lock(&pool->mutex);
+	pool->stop = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	size_t i;
+	for (i = 0; i < pool->n_threads; i++)
+		pthread_join(pool->threads[i], NULL);
+
+	fastd_worker_handle_finished();
+
+	while (pool->queue_head) {
+		fastd_worker_job_t *job = pool->queue_head;
+		pool->queue_head = job->next;
+
+		job->complete(job);
+	}
+
+	pool->queue_tail = &pool->queue_head;
+	pool->queue_len = 0;
+
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->mutex);
+
+	free(pool->threads);
+	pool->threads = NULL;
+	pool->n_threads = 0;
+}
+
+/**
+   Hands a job to the worker threads
+
+   When no worker threads are running, the job is run and completed immediately.
+
+   \return false if the job was rejected because the queue is full; the job is not completed in this case
+*/
+bool fastd_worker_submit(fastd_worker_job_t *job) {
+	fastd_worker_pool_t *pool = &ctx.worker_pool;
+
+	if (!pool->n_threads) {
+		job->run(job);
+		job->complete(job);
+		return true;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+
+	if (pool->queue_len >= pool->n_threads * WORKER_QUEUE_LENGTH) {
+		pthread_mutex_unlock(&pool->mutex);
+		pool->dropped++;
+		return false;
+	}
+
+	append_job(&pool->queue_tail, job);
+	pool->queue_len++;
+
+	pthread_cond_signal(&pool->cond);
+	pthread_mutex_unlock(&pool->mutex);
+
+	return true;
+}
@@ -0,0 +1,88 @@
+/*
+  Copyright (c) 2012-2015, Matthias Schiffer <mschiffer@universe-factory.net>
+  All rights reserved.
+
+  Redistribution and use in source and binary forms, with or without
+  modification, are permitted provided that the following conditions are met:
+
+    1. Redistributions of source code must retain the above copyright notice,
+       this list of conditions and the following disclaimer.
+    2. Redistributions in binary form must reproduce the above copyright notice,
+       this list of conditions and the following disclaimer in the documentation
+       and/or other materials provided with the distribution.
+
+  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+  DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+  FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+  DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+  SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+  CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+  OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+  OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/**
+   \file
+
+   Worker thread pool
+
+   CPU-intensive tasks (like the key derivation of handshakes) can be handed to a pool of worker threads
+   to keep them from stalling the main loop. After a job has been run by a worker, it is put on a list of
+   finished jobs, and the main thread is woken up through the async notification mechanism to call the
+   completion callbacks.
+*/
+
+
+#pragma once
+
+#include "types.h"
+
+#include <pthread.h>
+
+
+/** The maximum number of jobs that may be queued per worker thread */
+#define WORKER_QUEUE_LENGTH 64
+
+
+/** A job callback */
+typedef void (*fastd_worker_cb_t)(fastd_worker_job_t *job);
+
+/**
+   A job to be run by a worker thread
+
+   Jobs are usually embedded into a larger structure containing the job's input and output data.
+*/
+struct fastd_worker_job {
+	fastd_worker_job_t *next;		/**< The next job in the queue */
+
+	fastd_worker_cb_t run;			/**< Is called in a worker thread to perform the actual work */
+	fastd_worker_cb_t complete;		/**< Is called in the main thread after \e run has finished (or without \e run being called when the job is discarded); must free the job */
+};
+
+/** The worker thread pool */
+struct fastd_worker_pool {
+	pthread_mutex_t mutex;			/**< Protects the queue and the list of finished jobs */
+	pthread_cond_t cond;			/**< Is signalled when a job is added to the queue or the pool is stopped */
+
+	fastd_worker_job_t *queue_head;		/**< The first queued job */
+	fastd_worker_job_t **queue_tail;	/**< The next pointer of the last queued job */
+	size_t queue_len;			/**< The number of queued jobs */
+	uint64_t dropped;			/**< The number of jobs rejected because the queue was full (only accessed by the main thread) */
+
+	fastd_worker_job_t *finished_head;	/**< The first finished job */
+	fastd_worker_job_t **finished_tail;	/**< The next pointer of the last finished job */
+	bool notified;				/**< true if a notification about the finished jobs has been or is being sent to the main thread */
+
+	bool stop;				/**< Set to make the worker threads terminate */
+
+	size_t n_threads;			/**< The number of worker threads */
+	pthread_t *threads;			/**< The worker threads */
+};
+
+
+void fastd_worker_init(void);
+void fastd_worker_cleanup(void);
+bool fastd_worker_submit(fastd_worker_job_t *job);
+void fastd_worker_handle_finished(void);